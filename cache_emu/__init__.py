@@ -1,3 +1,8 @@
-from .emu import CacheEmu, init_loader
-from .envs import PassiveCacheEnv, ActiveCacheEnv
+from .emu import CacheEmu, CacheEmuBatch, PolicyCacheEmu, init_loader, set_num_threads
+from .emu import init_loader_from_trace_file, init_loader_from_trace_stream, save_trace_file
+from .emu import init_loader_from_compressed_trace, compress_dataset, save_compressed_trace
+from .emu import init_loader_from_workload, get_num_requests, get_num_contents
+from .emu import slice_dataset_by_time, slice_dataset_by_boundaries, slice_dataset_by_count
+from .emu import profile_lru_hit_ratios
+from .envs import PassiveCacheEnv, ActiveCacheEnv, VecActiveCacheEnv
 from .callback import Callback, CallbackManager
\ No newline at end of file
@@ -1,17 +1,161 @@
+#include <memory>
+
 #include "apis.h"
 #include "cache_emu.hpp"
+#include "stack_distance.hpp"
+#include "thread_pool.hpp"
+#include "workload.hpp"
 
 RequestLoader loader;
 vector<CacheEmu *> cache_emus;
+StackDistanceProfiler stack_distance_profiler;
+
+//用于并行推进多个模拟器的线程池，默认只使用调用者线程
+unique_ptr<ThreadPool> thread_pool(new ThreadPool(1));
+
+//模拟器内部使用稠密ID，返回给调用者前需要转换为原始ID，每个模拟器各自保存转换结果
+struct RawIdBuffers
+{
+    ContentVector contents, candidates, step_elements, dense_input;
+};
+vector<RawIdBuffers> raw_id_bufs;
+
+//将稠密ID转换为原始ID，结果保存在buf中
+static IntBuffer to_raw_buffer(const ContentVector &v, ContentVector &buf)
+{
+    buf.resize(v.size());
+    for (size_t i = 0; i < v.size(); i++) {
+        buf[i] = loader.to_raw(v[i]);
+    }
+    return from_std_vector(buf);
+}
+
+//将原始ID转换为稠密ID，结果保存在buf中
+static void to_dense_vector(const ContentType *es, size_t size, ContentVector &buf)
+{
+    buf.resize(size);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = loader.to_dense(es[i]);
+    }
+}
 
 void load_dataset(ContentType *cs, TimestampType *ts, size_t size)
 {
     loader.load_dataset(cs, ts, size);
 }
 
+size_t generate_dataset(size_t num_requests, TimestampType num_timestamps, uint64_t seed,
+                        size_t num_contents, double alpha, double drift_rate,
+                        double diurnal_amplitude, TimestampType diurnal_period,
+                        size_t num_shots, TimestampType shot_lifetime, double shot_shape, double shot_fraction,
+                        double one_hit_fraction)
+{
+    WorkloadConfig config;
+    config.num_requests = num_requests;
+    config.num_timestamps = num_timestamps;
+    config.seed = seed;
+    config.num_contents = num_contents;
+    config.alpha = alpha;
+    config.drift_rate = drift_rate;
+    config.diurnal_amplitude = diurnal_amplitude;
+    config.diurnal_period = diurnal_period;
+    config.num_shots = num_shots;
+    config.shot_lifetime = shot_lifetime;
+    config.shot_shape = shot_shape;
+    config.shot_fraction = shot_fraction;
+    config.one_hit_fraction = one_hit_fraction;
+
+    auto error = config.check();
+    if (!error.empty()) {
+        cout << "generate_dataset: " << error << endl;
+        return 0;
+    }
+    return WorkloadGenerator(config).generate(loader, thread_pool.get());
+}
+
+int load_trace_file(const char *path)
+{
+    return loader.load_trace_file(path, thread_pool.get());
+}
+
+int open_trace_stream(const char *path)
+{
+    return loader.open_trace_stream(path);
+}
+
+size_t compress_dataset(size_t block_size)
+{
+    return block_size == 0 ? loader.compress() : loader.compress(block_size);
+}
+
+int load_compressed_trace(const char *path)
+{
+    return loader.load_compressed_trace(path);
+}
+
+int save_compressed_trace(const char *path)
+{
+    return loader.save_compressed_trace(path);
+}
+
+int save_trace_file(const char *path)
+{
+    return loader.save_trace_file(path);
+}
+
 int slice_dataset_by_time(TimestampType t_beg, TimestampType t_end, TimestampType interval)
 {
-    return loader.slice_by_time(t_beg, t_end, interval);
+    auto error = RequestLoader::check_time_slicing(t_beg, t_end, interval);
+    if (!error.empty()) {
+        cout << "slice_dataset_by_time: " << error << endl;
+        return -1;
+    }
+    return loader.slice_by_time(t_beg, t_end, interval, thread_pool.get());
+}
+
+int slice_dataset_by_boundaries(TimestampType *boundaries, size_t size)
+{
+    auto error = RequestLoader::check_boundaries(boundaries, size);
+    if (!error.empty()) {
+        cout << "slice_dataset_by_boundaries: " << error << endl;
+        return -1;
+    }
+    return loader.slice_by_boundaries(boundaries, size, thread_pool.get());
+}
+
+int slice_dataset_by_count(size_t num_requests_per_slice)
+{
+    auto error = RequestLoader::check_count_slicing(num_requests_per_slice);
+    if (!error.empty()) {
+        cout << "slice_dataset_by_count: " << error << endl;
+        return -1;
+    }
+    return loader.slice_by_count(num_requests_per_slice);
+}
+
+size_t profile_stack_distances(int *capacities, size_t num_capacities)
+{
+    return stack_distance_profiler.run(loader, capacities, num_capacities);
+}
+
+size_t profile_stack_distances_sampled(double rate, size_t max_samples, int *capacities, size_t num_capacities)
+{
+    return stack_distance_profiler.run_sampled(loader, rate, max_samples, capacities, num_capacities);
+}
+
+double get_stack_distance_sampling_rate()
+{
+    return stack_distance_profiler.get_sampling_rate();
+}
+
+FloatBuffer get_lru_hit_ratio_curve()
+{
+    return from_std_vector(*stack_distance_profiler.get_hit_ratios());
+}
+
+FloatBuffer get_lru_slice_hit_ratios()
+{
+    return from_std_vector(*stack_distance_profiler.get_slice_hit_ratios());
 }
 
 int init_cache_emu(int capacity, bool passive_mode)
@@ -31,9 +175,42 @@ int init_cache_emu(int capacity, bool passive_mode)
 
     cout << endl;
 
+    raw_id_bufs.emplace_back();
+
+    return handler;
+}
+
+int init_policy_cache_emu(int capacity, const char *policy)
+{
+    auto emu = new_policy_cache_emu(policy, capacity, &loader);
+    if (emu == nullptr) {
+        cout << "Unknown cache policy: " << policy << endl;
+        return -1;
+    }
+
+    auto handler = cache_emus.size();
+    cout << "Emu " << handler << ": " << policy << " policy." << endl;
+
+    cache_emus.push_back(emu);
+    raw_id_bufs.emplace_back();
+
     return handler;
 }
 
+size_t run_policy(int handler)
+{
+    auto emu = dynamic_cast<PolicyCacheEmu *>(cache_emus[handler]);
+    ASSERT(emu != nullptr);
+    return emu->run();
+}
+
+FloatBuffer get_slice_hit_rates(int handler)
+{
+    auto emu = dynamic_cast<PolicyCacheEmu *>(cache_emus[handler]);
+    ASSERT(emu != nullptr);
+    return from_std_vector(*emu->get_slice_hit_rates());
+}
+
 void reset(int handler)
 {
     if (DEBUG) {
@@ -48,16 +225,23 @@ Triple step(int handler)
     return res;
 }
 
+Triple step_until_miss(int handler)
+{
+    auto emu = dynamic_cast<PassiveCacheEmu *>(cache_emus[handler]);
+    ASSERT(emu != nullptr);
+    return emu->step_until_miss();
+}
+
 IntBuffer get_cache_contents(int handler)
 {
     auto v = cache_emus[handler]->get_cache_contents();
-    return from_std_vector(*v);
+    return to_raw_buffer(*v, raw_id_bufs[handler].contents);
 }
 
 IntBuffer get_candidates(int handler)
 {
     auto v = cache_emus[handler]->get_candidates();
-    return from_std_vector(*v);
+    return to_raw_buffer(*v, raw_id_bufs[handler].candidates);
 }
 
 FloatBuffer get_candidate_frequencies(int handler)
@@ -69,7 +253,7 @@ FloatBuffer get_candidate_frequencies(int handler)
 IntBuffer get_step_elements(int handler)
 {
     auto step_es = cache_emus[handler]->get_step_elements();
-    return from_std_vector(*step_es);
+    return to_raw_buffer(*step_es, raw_id_bufs[handler].step_elements);
 }
 
 int get_num_step_elements(int handler)
@@ -83,7 +267,9 @@ void update_cache(int handler, IntBuffer v)
     if (VERBOSE) {
         cout << "emu[" << handler << "].new_contents: " << buffer_to_string(v) << endl;
     }
-    cache_emus[handler]->update_cache((ContentType *) v.data, v.size);
+    auto &dense_es = raw_id_bufs[handler].dense_input;
+    to_dense_vector((ContentType *) v.data, v.size, dense_es);
+    cache_emus[handler]->update_cache(dense_es.data(), dense_es.size());
 }
 
 void setup_traditional_feature_types(int handler, bool use_lfu_feature, bool use_lru_feature, bool use_ogd_opt_feature)
@@ -104,16 +290,26 @@ void setup_traditional_feature_types(int handler, bool use_lfu_feature, bool use
 //使用带窗口衰减的LFU特征
 void setup_swlfu_feature_types(int handler, int *w_lens, size_t size)
 {
-    for (int i = 0; i < size; ++i) {
-        cache_emus[handler]->use_swlfu_feature(w_lens[i]);
+    if (size == 1) {
+        cache_emus[handler]->use_swlfu_feature(w_lens[0]);
     }
+    else if (size > 1) {
+        //多个窗口共用一个提取器，特征的顺序与w_lens相同
+        cache_emus[handler]->use_multi_swlfu_feature(vector<int>(w_lens, w_lens + size));
+    }
+}
+
+//使用到下一次被请求的距离特征
+void setup_next_use_feature(int handler)
+{
+    cache_emus[handler]->use_next_use_feature();
 }
 
 //获取所有特征
 FloatBuffer get_features(int handler, ContentType *es, size_t size)
 {
     ContentVector buf_e;
-    copy_to_std_vector(es, size, buf_e);
+    to_dense_vector(es, size, buf_e);
 
     auto features = cache_emus[handler]->get_features(buf_e);
 
@@ -124,6 +320,15 @@ FloatBuffer get_features(int handler, ContentType *es, size_t size)
     return features.to_buffer();
 }
 
+FloatBuffer get_features_columns(int handler, ContentType *es, size_t size)
+{
+    ContentVector buf_e;
+    to_dense_vector(es, size, buf_e);
+
+    auto features = cache_emus[handler]->get_features_columns(buf_e);
+    return features.to_buffer();
+}
+
 int finished(int handler)
 {
     return cache_emus[handler]->finished();
@@ -148,3 +353,100 @@ size_t feature_dims(int handler)
 {
     return cache_emus[handler]->feature_dims();
 }
+
+void step_observe(int handler, StepObservation *obs)
+{
+    auto emu = cache_emus[handler];
+    obs->triple = emu->step();
+    obs->num_candidates = emu->observe(obs->candidates, obs->frequencies, obs->features, obs->max_candidates);
+    obs->done = emu->finished();
+}
+
+int set_profiling(int handler, bool enabled)
+{
+    cache_emus[handler]->set_profiling(enabled);
+    return PROFILE;
+}
+
+ProfileStats get_profile_stats(int handler)
+{
+    return cache_emus[handler]->get_profile_stats();
+}
+
+void clear_profile_stats(int handler)
+{
+    cache_emus[handler]->clear_profile_stats();
+}
+
+void step_observe_delta(int handler, DeltaObservation *obs)
+{
+    auto emu = cache_emus[handler];
+    obs->triple = emu->step();
+    obs->num_candidates = emu->observe_delta(obs->rows, obs->candidates, obs->frequencies, obs->raw_features,
+                                             obs->offsets, obs->scales, obs->divisors, obs->max_candidates,
+                                             obs->num_rows);
+    obs->done = emu->finished();
+}
+
+size_t get_num_requests()
+{
+    return loader.get_num_requests();
+}
+
+size_t get_num_contents()
+{
+    return loader.get_num_contents();
+}
+
+size_t get_max_slice_size()
+{
+    return loader.get_max_slice_size();
+}
+
+void set_num_threads(int num_threads, bool pin_cores)
+{
+    thread_pool.reset();
+    thread_pool.reset(new ThreadPool(std::max(num_threads, 1), pin_cores));
+}
+
+int get_num_threads()
+{
+    return (int) thread_pool->get_num_threads();
+}
+
+void step_batch(int *handlers, size_t n, uint8_t *actions, size_t max_candidates,
+                ContentType *candidates, int32_t *num_candidates, float *features, float *rewards,
+                int32_t *dones, int32_t *num_steps)
+{
+    //每个模拟器只读共享的loader，且只写入自己的输出区域，因此并行结果与串行一致
+    thread_pool->parallel_for(n, [&](size_t i) {
+        auto emu = cache_emus[handlers[i]];
+        auto f_dims = emu->feature_dims();
+        num_steps[i] = 0;
+
+        //已经结束的模拟器不再推进
+        if (!emu->finished()) {
+            emu->update_cache_by_mask(actions + i * max_candidates, max_candidates);
+
+            auto passive_emu = dynamic_cast<PassiveCacheEmu *>(emu);
+            if (passive_emu != nullptr) {
+                //被动模式推进到下一次miss，num_steps为跨越的时间片边界数
+                num_steps[i] = (int32_t) passive_emu->step_until_miss().third;
+            }
+            else {
+                //跳过没有请求的时间片
+                while (!emu->finished()) {
+                    auto res = emu->step();
+                    num_steps[i]++;
+                    if (res.first != 0) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        num_candidates[i] = (int32_t) emu->observe(candidates + i * max_candidates, rewards + i * max_candidates,
+                                                   features + i * max_candidates * f_dims, max_candidates);
+        dones[i] = emu->finished();
+    });
+}
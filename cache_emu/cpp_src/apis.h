@@ -3,26 +3,176 @@
 
 #include "utils.h"
 #include "buffer.h"
+#include "profile.h"
+
+//单步观测，数组均由调用者分配，step_observe将结果直接写入其中
+struct StepObservation
+{
+    Triple triple;              //输出：step的返回值
+    int32_t *candidates;        //输出：候选内容（原始ID）[max_candidates]，空位填-1
+    float *frequencies;         //输出：候选内容在本步中的命中次数 [max_candidates]，空位填0
+    float *features;            //输出：候选内容特征 [max_candidates, feature_dims]，空位填0
+    size_t max_candidates;      //输入：候选内容的槽位数
+    size_t num_candidates;      //输出：候选内容个数
+    int32_t done;               //输出：是否处理完所有请求
+};
+
+//增量观测，数组均由调用者分配，只写入自上次增量观测以来变化的候选内容行，见CacheEmu::observe_delta
+struct DeltaObservation
+{
+    Triple triple;              //输出：step的返回值
+    int32_t *rows;              //输出：变化的行号，升序 [max_candidates]
+    int32_t *candidates;        //输出：这些行的候选内容（原始ID） [max_candidates]
+    float *frequencies;         //输出：这些行在本步中的命中次数 [max_candidates]，未变化的行命中次数为0
+    double *raw_features;       //输出：这些行的原始特征 [max_candidates, feature_dims]
+    double *offsets;            //输出：每一维特征的变换参数 [feature_dims]，
+    double *scales;             //      特征 = (float) ((raw + offset) * scale / divisor)
+    double *divisors;
+    size_t max_candidates;      //输入：候选内容的槽位数
+    size_t num_candidates;      //输出：候选内容个数
+    size_t num_rows;            //输出：变化的行数
+    int32_t done;               //输出：是否处理完所有请求
+};
 
 extern "C" {
 
 /**
  * 加载请求序列数据集
- * @param cs 请求的内容
+ * @param cs 请求的内容，须为非负且小于INT32_MAX，其他请求被丢弃并打印丢弃的个数
  * @param ts 请求发生的时间
  * @param size 请求的长度
  */
 void load_dataset(ContentType *cs, TimestampType *ts, size_t size);
 
 /**
- * 将请求序列根据时间进行分片
+ * 生成合成请求序列并替换已加载的数据集（见workload.hpp），使用set_num_threads设置的线程数并行生成，
+ * 相同的参数与种子总是得到相同的请求序列
+ * @param num_requests      请求数量
+ * @param num_timestamps    时间戳的范围为[0, num_timestamps)
+ * @param seed              随机数种子
+ * @param num_contents      IRM内容数量，请求按Zipf分布选取
+ * @param alpha             Zipf分布的参数
+ * @param drift_rate        每个时间戳热门排名平移的内容数，为0时热度不变
+ * @param diurnal_amplitude 到达率的昼夜变化幅度，取值范围[0, 1)
+ * @param diurnal_period    昼夜变化的周期（时间戳数）
+ * @param num_shots         散粒噪声模型中短时热门内容的数量
+ * @param shot_lifetime     短时热门内容被请求的时间戳数
+ * @param shot_shape        短时热门内容请求量的Pareto分布形状参数
+ * @param shot_fraction     短时热门内容的请求占所有请求的比例
+ * @param one_hit_fraction  只被请求一次的内容的请求占所有请求的比例
+ * @return      内容数量；参数不合法时打印原因并返回0，已加载的数据集不变
+ */
+size_t generate_dataset(size_t num_requests, TimestampType num_timestamps, uint64_t seed,
+                        size_t num_contents, double alpha, double drift_rate,
+                        double diurnal_amplitude, TimestampType diurnal_period,
+                        size_t num_shots, TimestampType shot_lifetime, double shot_shape, double shot_fraction,
+                        double one_hit_fraction);
+
+/**
+ * 以只读方式映射二进制请求序列文件，替换已加载的数据集。请求不做拷贝，
+ * 载入时用线程池并行扫描一遍请求，检查ID映射表有序且所有内容ID都在范围内
+ * @param path  由save_trace_file写入的文件路径
+ * @return      成功返回1，文件无法打开、格式不符或内容ID越界返回0
+ */
+int load_trace_file(const char *path);
+
+/**
+ * 以流的方式打开二进制请求序列文件，替换已加载的数据集。
+ * 请求不常驻内存，每个模拟器只缓存最近的若干个时间片（由滑动窗口特征的窗口长度决定）
+ * @param path  由save_trace_file写入的文件路径
+ * @return      成功返回1，文件无法打开或格式不符返回0
+ */
+int open_trace_stream(const char *path);
+
+/**
+ * 将已加载的数据集按块压缩（时间戳差分+varint，内容按请求次数编码），之后请求在step时按需解码
+ * @param block_size    每块的请求数，为0时使用默认值
+ * @return      压缩后占用的字节数
+ */
+size_t compress_dataset(size_t block_size);
+
+/**
+ * 读入压缩的请求序列文件，替换已加载的数据集
+ * @param path  由save_compressed_trace写入的文件路径
+ * @return      成功返回1，文件无法打开或格式不符返回0
+ */
+int load_compressed_trace(const char *path);
+
+/**
+ * 将压缩后的数据集写入文件
+ * @param path  文件路径
+ * @return      成功返回1，数据集未压缩或写入失败返回0
+ */
+int save_compressed_trace(const char *path);
+
+/**
+ * 将已加载的数据集写入二进制请求序列文件（格式见trace_file.hpp）
+ * @param path  文件路径
+ * @return      成功返回1，否则返回0
+ */
+int save_trace_file(const char *path);
+
+/**
+ * 将请求序列根据时间进行分片，可以对同一个数据集多次分片，每次分片的耗时与时间片个数成正比
  * @param t_beg 起始时间
  * @param t_end 终止时间
- * @param interval  间隔时间
- * @return      时间片的个数
+ * @param interval  间隔时间，必须为正数
+ * @return      时间片的个数；interval不为正或t_end早于t_beg时打印原因并返回-1，已有的分片不变
  */
 int slice_dataset_by_time(TimestampType t_beg, TimestampType t_end, TimestampType interval);
 
+/**
+ * 将请求序列按给定的时间边界分片，第i个时间片包含时间戳在[boundaries[i], boundaries[i + 1])中的请求
+ * @param boundaries    严格递增的时间边界
+ * @param size          边界个数
+ * @return      时间片的个数，即size - 1；边界不严格递增时打印原因并返回-1，已有的分片不变
+ */
+int slice_dataset_by_boundaries(TimestampType *boundaries, size_t size);
+
+/**
+ * 将请求序列按请求数分片，每个时间片包含连续的num_requests_per_slice个请求
+ * @param num_requests_per_slice    每个时间片的请求数，必须为正数
+ * @return      时间片的个数；num_requests_per_slice为0时打印原因并返回-1，已有的分片不变
+ */
+int slice_dataset_by_count(size_t num_requests_per_slice);
+
+/**
+ * 一遍扫描已分片的数据集，计算LRU在所有缓存容量下的命中率（Mattson栈距离），复杂度O(N log M)
+ * @param capacities        需要按时间片统计命中率的容量，可以为空
+ * @param num_capacities    容量个数
+ * @return      处理的请求数
+ */
+size_t profile_stack_distances(int *capacities, size_t num_capacities);
+
+/**
+ * 按内容哈希采样估计LRU的命中率曲线（SHARDS），只统计哈希值低于阈值的内容，栈距离按采样率放大，
+ * 结果同样由get_lru_hit_ratio_curve与get_lru_slice_hit_ratios获取。
+ * 容量小于1 / 采样率（见get_stack_distance_sampling_rate）时的结果不可靠
+ * @param rate              采样率，取值范围(0, 1]；max_samples不为0时为初始采样率
+ * @param max_samples       为0时固定采样率；否则最多同时统计max_samples个内容，超出时自动降低采样率
+ * @param capacities        需要按时间片统计命中率的容量，可以为空
+ * @param num_capacities    容量个数
+ * @return      处理的请求数
+ */
+size_t profile_stack_distances_sampled(double rate, size_t max_samples, int *capacities, size_t num_capacities);
+
+/**
+ * 获取最后一次栈距离分析结束时的采样率，不采样时为1
+ */
+double get_stack_distance_sampling_rate();
+
+/**
+ * 获取profile_stack_distances得到的命中率曲线，直接指向内部数组，下一次分析前有效
+ * @return      长度为内容数量+1，第c个元素为容量为c时LRU的命中率
+ */
+FloatBuffer get_lru_hit_ratio_curve();
+
+/**
+ * 获取profile_stack_distances得到的每个时间片的命中率，直接指向内部数组，下一次分析前有效
+ * @return      形状为[时间片数, 容量个数]，容量的顺序与调用时一致
+ */
+FloatBuffer get_lru_slice_hit_ratios();
+
 /**
  * 初始化一个缓存模拟器
  * @param capacity 缓存容量
@@ -30,6 +180,30 @@ int slice_dataset_by_time(TimestampType t_beg, TimestampType t_end, TimestampTyp
  */
 int init_cache_emu(int capacity, bool passive_mode);
 
+/**
+ * 初始化一个使用固定替换策略的缓存模拟器，每次step在C++中处理一个时间片的全部请求。
+ * 策略的状态按内容数量分配，需要先加载数据集
+ * @param capacity 缓存容量
+ * @param policy   替换策略：lru、lfu、fifo、arc、2q、lirs、s3fifo，
+ *                 以及离线最优的belady（首次使用时建立下一次使用索引）
+ * @return  缓存模拟器句柄，策略名无效时返回-1
+ */
+int init_policy_cache_emu(int capacity, const char *policy);
+
+/**
+ * 使用固定替换策略的模拟器处理剩余的所有时间片
+ * @param handler 由init_policy_cache_emu创建的模拟器句柄
+ * @return  处理的请求数
+ */
+size_t run_policy(int handler);
+
+/**
+ * 获取使用固定替换策略的模拟器在已处理的每个时间片上的命中率
+ * @param handler 由init_policy_cache_emu创建的模拟器句柄
+ * @return  每个时间片的命中率
+ */
+FloatBuffer get_slice_hit_rates(int handler);
+
 /**
  * 重置模拟器
  * @param handler
@@ -43,6 +217,14 @@ void reset(int handler);
  */
 Triple step(int handler);
 
+/**
+ * 被动模式下连续处理请求，直到发生miss或处理完所有请求，避免逐次调用step。
+ * 各候选内容的命中次数在内部累加，之后由get_candidate_frequencies返回
+ * @param handler 缓存模拟器句柄，必须为被动模式
+ * @return  (处理的请求数, 是否发生miss, 跨越的时间片边界数)
+ */
+Triple step_until_miss(int handler);
+
 /**
  * 获取当前缓存内容
  * @param handler 缓存模拟器句柄
@@ -83,7 +265,7 @@ int get_num_step_elements(int handler);
 /**
  * 更新缓存内容
  * @param handler   缓存模拟器句柄
- * @param v         接下来缓存存储的内容
+ * @param v         接下来缓存存储的内容，-1与其他负数的ID表示空位
  */
 void update_cache(int handler, IntBuffer v);
 
@@ -98,21 +280,36 @@ void setup_traditional_feature_types(int handler, bool use_lfu_feature, bool use
 
 
 /**
- * 使用带窗口衰减的LFU特征
+ * 使用带窗口衰减的LFU特征，多个窗口共用一个提取器，每个请求只更新一次
  * @param w_lens    滑动窗口大小的列表
  * @param size      滑动窗口的个数
  */
 void setup_swlfu_feature_types(int handler, int *w_lens, size_t size);
 
+/**
+ * 使用到下一次被请求的距离特征（离线特征，用于模仿学习），首次使用时建立下一次使用索引
+ * @param handler   缓存模拟器句柄
+ */
+void setup_next_use_feature(int handler);
+
 /**
  * 获取特征
  * @param handler   缓存模拟器句柄
- * @param es        需要提取特征的内容
+ * @param es        需要提取特征的内容，负数的ID按空位处理
  * @param size      内容的数量
  * @return          目标内容的特征
  */
 FloatBuffer get_features(int handler, ContentType *es, size_t size);
 
+/**
+ * 获取按列排列的特征，每一维特征的所有内容连续存放
+ * @param handler   缓存模拟器句柄
+ * @param es        需要提取特征的内容
+ * @param size      内容的数量
+ * @return          目标内容的特征 [feature_dims, size]
+ */
+FloatBuffer get_features_columns(int handler, ContentType *es, size_t size);
+
 /**
  * 缓存模拟器是否处理完所有请求
  * @param handler   缓存模拟器句柄
@@ -144,5 +341,90 @@ float on_episode_end(int handler);
 //获取特征维度
 size_t feature_dims(int handler);
 
+/**
+ * 处理一批请求，并将结果、候选内容、候选内容频率与特征直接写入调用者提供的内存
+ * @param handler   缓存模拟器句柄
+ * @param obs       单步观测
+ */
+void step_observe(int handler, StepObservation *obs);
+
+/**
+ * 处理一批请求，只将变化的候选内容行写入调用者提供的内存，调用者据此修补上一次的观测。
+ * 首次调用或重置后写入所有行；每步的开销与时间片大小成正比，而与缓存容量无关
+ * @param handler   缓存模拟器句柄
+ * @param obs       增量观测
+ */
+void step_observe_delta(int handler, DeltaObservation *obs);
+
+/**
+ * 开启或关闭模拟器的计时与计数：每步各阶段的时钟周期数与调用次数，以及Cache哈希表的探测统计。
+ * 开启时清空已有的结果；未开启的模拟器不读取时钟也不计数
+ * @param handler   缓存模拟器句柄
+ * @param enabled   是否开启
+ * @return          编译时启用了PROFILE返回1，否则返回0，此时不会记录任何结果
+ */
+int set_profiling(int handler, bool enabled);
+
+/**
+ * 获取模拟器的计时与计数结果，各字段见profile.h
+ * @param handler   缓存模拟器句柄
+ * @return          自开启或上次清空以来的累计结果
+ */
+ProfileStats get_profile_stats(int handler);
+
+/**
+ * 清空模拟器的计时与计数结果
+ * @param handler   缓存模拟器句柄
+ */
+void clear_profile_stats(int handler);
+
+/**
+ * 获取已加载数据集的请求数量
+ */
+size_t get_num_requests();
+
+/**
+ * 获取已加载数据集的内容数量（稠密ID的范围）
+ */
+size_t get_num_contents();
+
+/**
+ * 获取最大的时间片长度，主动模式下候选内容数不超过 容量+最大时间片长度
+ * @return  最大的时间片长度
+ */
+size_t get_max_slice_size();
+
+/**
+ * 设置批量接口使用的线程数
+ * @param num_threads   线程数（包括调用者线程），1表示串行
+ * @param pin_cores     是否将每个工作线程绑定到进程允许使用的不同的核，调用者线程不绑定
+ */
+void set_num_threads(int num_threads, bool pin_cores);
+
+/**
+ * 获取批量接口使用的线程数
+ * @return  线程数
+ */
+int get_num_threads();
+
+/**
+ * 批量推进多个模拟器：对每个模拟器先根据动作掩码更新缓存，再处理请求直到处理了至少一个请求或结束，
+ * 结果写入调用者提供的连续数组中，第一维为模拟器，所有模拟器的特征维度需相同。
+ * 设置了多个线程时各模拟器并行推进，结果与串行推进完全一致，句柄不能重复
+ * @param handlers          模拟器句柄数组 [n]
+ * @param n                 模拟器个数
+ * @param actions           动作掩码 [n, max_candidates]，非零表示缓存对应的候选内容
+ * @param max_candidates    每个模拟器的候选内容槽位数，超出部分被截断
+ * @param candidates        输出候选内容 [n, max_candidates]，空位填-1
+ * @param num_candidates    输出候选内容个数 [n]
+ * @param features          输出候选内容特征 [n, max_candidates, feature_dims]，空位填0
+ * @param rewards           输出候选内容在本步中的命中次数 [n, max_candidates]，空位填0；被动模式下为直到miss的累计命中次数
+ * @param dones             输出模拟器是否处理完所有请求 [n]
+ * @param num_steps         输出本次处理的时间片个数 [n]，用于触发回调；被动模式下为跨越的时间片边界数
+ */
+void step_batch(int *handlers, size_t n, uint8_t *actions, size_t max_candidates,
+                ContentType *candidates, int32_t *num_candidates, float *features, float *rewards,
+                int32_t *dones, int32_t *num_steps);
+
 };
 #endif
@@ -0,0 +1,1816 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <functional>
+#include <list>
+#include <map>
+#include <new>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+#include "apis.h"
+#include "cache_emu.hpp"
+#include "stack_distance.hpp"
+#include "workload.hpp"
+
+using namespace std;
+
+//替换全局的operator new以统计分配次数，new[]与delete[]的默认实现会转发到这里；
+//按对齐分配的版本（如StampedRows的AlignedAllocator）单独替换。
+//operator delete不内联，否则GCC会把内联后的free与调用方的new配对，误报-Wmismatched-new-delete
+static atomic<size_t> num_allocs{0};
+
+void *operator new(size_t size)
+{
+    num_allocs.fetch_add(1, memory_order_relaxed);
+    auto p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size, align_val_t align)
+{
+    num_allocs.fetch_add(1, memory_order_relaxed);
+    //aligned_alloc要求大小是对齐的整数倍
+    auto a = static_cast<size_t>(align);
+    auto p = aligned_alloc(a, (std::max(size, (size_t) 1) + a - 1) / a * a);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, align_val_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+//生成服从Zipf分布的请求序列，每slice_size个请求占用一个时间戳
+static void gen_zipf_requests(size_t num_requests, size_t num_contents, double alpha, size_t slice_size,
+                              vector<ContentType> &cs, vector<TimestampType> &ts, unsigned seed = 0)
+{
+    vector<double> cdf(num_contents);
+    double sum = 0;
+    for (size_t i = 0; i < num_contents; i++) {
+        sum += 1.0 / pow(i + 1, alpha);
+        cdf[i] = sum;
+    }
+
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> dist(0, sum);
+
+    cs.resize(num_requests);
+    ts.resize(num_requests);
+    for (size_t i = 0; i < num_requests; i++) {
+        cs[i] = (ContentType) (lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin());
+        ts[i] = (TimestampType) (i / slice_size);
+    }
+}
+
+//获取第i个时间片并填上其序号，滑动窗口类的特征提取器依赖i_slice移出过期的时间片
+static Slice get_indexed_slice(RequestLoader &loader, size_t i)
+{
+    auto ptrs = loader.get_slice_range_ptrs(i);
+    auto slice = loader.get_slice(ptrs.first, ptrs.second);
+    slice.i_slice = i;
+    return slice;
+}
+
+//运行func并返回耗时（秒）
+static double time_it(const function<void()> &func)
+{
+    auto t_beg = chrono::steady_clock::now();
+    func();
+    auto t_end = chrono::steady_clock::now();
+    return chrono::duration<double>(t_end - t_beg).count();
+}
+
+//测试OGD类特征提取器的吞吐量
+static void bench_ogd_extractor(const string &name, OgdFeatureExtractor *extractor, RequestLoader &loader)
+{
+    extractor->reset();
+
+    double seconds = time_it([&]() {
+        for (size_t i = 0; i < loader.get_num_slices(); i++) {
+            extractor->update(get_indexed_slice(loader, i));
+        }
+    });
+
+    cout << name << ": " << loader.get_num_requests() / seconds << " requests/s" << endl;
+}
+
+//测试特征提取器重置的耗时
+static void bench_reset(const string &name, FeatureExtractor *extractor, RequestLoader &loader, size_t num_resets)
+{
+    auto ptrs = loader.get_slice_range_ptrs(0);
+    auto slice = loader.get_slice(ptrs.first, ptrs.second);
+
+    double seconds = time_it([&]() {
+        for (size_t i = 0; i < num_resets; i++) {
+            extractor->reset();
+            extractor->update(slice);
+        }
+    });
+
+    cout << name << " reset: " << seconds * 1e6 / num_resets << " us/op" << endl;
+}
+
+//原先基于unordered_map的命中检测，用于对比
+class MapCacheIndex
+{
+private:
+    unordered_map<ContentType, size_t> pos_map;
+    unordered_map<ContentType, size_t> freq_map;
+
+public:
+    inline void set(size_t idx, ContentType e)
+    {
+        pos_map[e] = idx;
+    }
+
+    inline bool hit_test(ContentType e)
+    {
+        freq_map[e]++;
+        return pos_map.find(e) != pos_map.end();
+    }
+
+    inline void clear_frequencies()
+    {
+        freq_map.clear();
+    }
+};
+
+//测试命中检测的吞吐量，缓存中预先放入最热门的capacity个内容
+template<typename CacheType>
+static void bench_hit_test(const string &name, CacheType &cache, size_t capacity, RequestLoader &loader)
+{
+    for (size_t i = 0; i < capacity; i++) {
+        cache.set(i, (ContentType) i);
+    }
+
+    size_t hit_cnt = 0;
+    double seconds = time_it([&]() {
+        for (size_t i = 0; i < loader.get_num_slices(); i++) {
+            auto ptrs = loader.get_slice_range_ptrs(i);
+            auto slice = loader.get_slice(ptrs.first, ptrs.second);
+            for (size_t j = 0; j < slice.size; j++) {
+                hit_cnt += cache.hit_test(slice.data[j].content_id);
+            }
+            cache.clear_frequencies();
+        }
+    });
+
+    cout << name << ": " << loader.get_num_requests() / seconds << " requests/s, "
+         << seconds * 1e9 / loader.get_num_requests() << " ns/op, hit rate "
+         << (double) hit_cnt / loader.get_num_requests() << endl;
+}
+
+/**
+ * 替换策略的参考实现，直接用std::list与线性查找按论文中的描述逐步模拟，
+ * 只用于在小容量下与cache.hpp中的实现逐个请求对比是否命中
+ */
+namespace reference
+{
+    typedef list<ContentType> List;
+
+    inline bool contains(const List &l, ContentType e)
+    {
+        return std::find(l.begin(), l.end(), e) != l.end();
+    }
+
+    inline void remove(List &l, ContentType e)
+    {
+        l.erase(std::find(l.begin(), l.end(), e));
+    }
+
+    inline ContentType pop_back(List &l)
+    {
+        auto e = l.back();
+        l.pop_back();
+        return e;
+    }
+
+    struct Lru
+    {
+        size_t capacity;
+        List l;
+
+        explicit Lru(size_t capacity) : capacity(capacity) {}
+
+        bool access(ContentType e)
+        {
+            bool hit = contains(l, e);
+            if (hit) {
+                remove(l, e);
+            }
+            else if (l.size() >= capacity) {
+                l.pop_back();
+            }
+            l.push_front(e);
+            return hit;
+        }
+    };
+
+    struct Fifo
+    {
+        size_t capacity;
+        List l;
+
+        explicit Fifo(size_t capacity) : capacity(capacity) {}
+
+        bool access(ContentType e)
+        {
+            if (contains(l, e)) {
+                return true;
+            }
+            if (l.size() >= capacity) {
+                l.pop_back();
+            }
+            l.push_front(e);
+            return false;
+        }
+    };
+
+    //淘汰(命中次数, 达到该次数的时刻)最小的内容
+    struct Lfu
+    {
+        size_t capacity;
+        map<ContentType, pair<uint64_t, uint64_t>> entries;
+        uint64_t time = 0;
+
+        explicit Lfu(size_t capacity) : capacity(capacity) {}
+
+        bool access(ContentType e)
+        {
+            time++;
+            auto it = entries.find(e);
+            if (it != entries.end()) {
+                it->second = {it->second.first + 1, time};
+                return true;
+            }
+            if (entries.size() >= capacity) {
+                entries.erase(std::min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+                    return a.second < b.second;
+                }));
+            }
+            entries[e] = {1, time};
+            return false;
+        }
+    };
+
+    struct Arc
+    {
+        size_t capacity;
+        double p = 0;
+        List t1, t2, b1, b2;
+
+        explicit Arc(size_t capacity) : capacity(capacity) {}
+
+        void replace(bool in_b2)
+        {
+            if (!t1.empty() && ((double) t1.size() > p || (in_b2 && (double) t1.size() == p) || t2.empty())) {
+                b1.push_front(pop_back(t1));
+            }
+            else {
+                b2.push_front(pop_back(t2));
+            }
+        }
+
+        bool access(ContentType e)
+        {
+            if (contains(t1, e) || contains(t2, e)) {
+                remove(contains(t1, e) ? t1 : t2, e);
+                t2.push_front(e);
+                return true;
+            }
+            auto s1 = (double) b1.size(), s2 = (double) b2.size();
+            if (contains(b1, e)) {
+                p = std::min((double) capacity, p + std::max(s2 / s1, 1.0));
+                replace(false);
+                remove(b1, e);
+                t2.push_front(e);
+                return false;
+            }
+            if (contains(b2, e)) {
+                p = std::max(0.0, p - std::max(s1 / s2, 1.0));
+                replace(true);
+                remove(b2, e);
+                t2.push_front(e);
+                return false;
+            }
+
+            auto l1 = t1.size() + b1.size(), total = l1 + t2.size() + b2.size();
+            if (l1 == capacity) {
+                if (t1.size() < capacity) {
+                    b1.pop_back();
+                    replace(false);
+                }
+                else {
+                    t1.pop_back();
+                }
+            }
+            else if (total >= capacity) {
+                if (total == 2 * capacity) {
+                    b2.pop_back();
+                }
+                replace(false);
+            }
+            t1.push_front(e);
+            return false;
+        }
+    };
+
+    struct TwoQ
+    {
+        size_t capacity, k_in, k_out;
+        List a1_in, a1_out, am;
+
+        explicit TwoQ(size_t capacity)
+                : capacity(capacity), k_in(std::max(capacity / 4, (size_t) 1)), k_out(std::max(capacity / 2, (size_t) 1)) {}
+
+        void reclaim()
+        {
+            if (a1_in.size() + am.size() < capacity) {
+                return;
+            }
+            if (a1_in.size() > k_in || am.empty()) {
+                a1_out.push_front(pop_back(a1_in));
+                if (a1_out.size() > k_out) {
+                    a1_out.pop_back();
+                }
+            }
+            else {
+                am.pop_back();
+            }
+        }
+
+        bool access(ContentType e)
+        {
+            if (contains(am, e)) {
+                remove(am, e);
+                am.push_front(e);
+                return true;
+            }
+            if (contains(a1_in, e)) {
+                return true;
+            }
+            if (contains(a1_out, e)) {
+                remove(a1_out, e);
+                reclaim();
+                am.push_front(e);
+            }
+            else {
+                reclaim();
+                a1_in.push_front(e);
+            }
+            return false;
+        }
+    };
+
+    //s为栈S，q为驻留的HIR内容，n为S中非驻留的HIR内容（按变为非驻留的先后）
+    struct Lirs
+    {
+        enum { Lir, HirResident, HirNonResident };
+
+        size_t capacity, lir_capacity, num_lir = 0;
+        List s, q, n;
+        map<ContentType, int> status;
+
+        explicit Lirs(size_t capacity)
+                : capacity(capacity), lir_capacity(capacity - std::max(capacity / 100, (size_t) 1)) {}
+
+        void prune()
+        {
+            while (!s.empty() && status[s.back()] != Lir) {
+                auto e = pop_back(s);
+                if (status[e] == HirNonResident) {
+                    remove(n, e);
+                }
+            }
+        }
+
+        void demote()
+        {
+            if (num_lir <= lir_capacity) {
+                return;
+            }
+            prune();
+            auto e = pop_back(s);
+            status[e] = HirResident;
+            q.push_front(e);
+            num_lir--;
+            prune();
+        }
+
+        void make_lir(ContentType e)
+        {
+            remove(s, e);
+            s.push_front(e);
+            status[e] = Lir;
+            num_lir++;
+            demote();
+        }
+
+        bool access(ContentType e)
+        {
+            bool in_s = contains(s, e);
+            if (in_s && status[e] == Lir) {
+                bool at_bottom = s.back() == e;
+                remove(s, e);
+                s.push_front(e);
+                if (at_bottom) {
+                    prune();
+                }
+                return true;
+            }
+            if (contains(q, e)) {
+                remove(q, e);
+                if (in_s) {
+                    make_lir(e);
+                }
+                else {
+                    s.push_front(e);
+                    q.push_front(e);
+                }
+                return true;
+            }
+
+            if (num_lir + q.size() >= capacity) {
+                auto victim = pop_back(q);
+                if (contains(s, victim)) {
+                    status[victim] = HirNonResident;
+                    n.push_front(victim);
+                    if (n.size() > capacity) {
+                        remove(s, pop_back(n));
+                    }
+                }
+            }
+
+            if (contains(s, e)) {
+                remove(n, e);
+                make_lir(e);
+            }
+            else if (num_lir < lir_capacity) {
+                s.push_front(e);
+                status[e] = Lir;
+                num_lir++;
+            }
+            else {
+                s.push_front(e);
+                q.push_front(e);
+                status[e] = HirResident;
+            }
+            return false;
+        }
+    };
+
+    struct S3Fifo
+    {
+        size_t capacity, small_capacity, ghost_capacity;
+        List small, main, ghost;
+        map<ContentType, int> freqs;
+
+        explicit S3Fifo(size_t capacity)
+                : capacity(capacity), small_capacity(std::max(capacity / 10, (size_t) 1)),
+                  ghost_capacity(capacity - std::min(small_capacity, capacity)) {}
+
+        void evict_main()
+        {
+            while (!main.empty()) {
+                auto e = pop_back(main);
+                if (freqs[e] == 0) {
+                    return;
+                }
+                freqs[e]--;
+                main.push_front(e);
+            }
+        }
+
+        void evict_small()
+        {
+            while (!small.empty()) {
+                auto e = pop_back(small);
+                if (freqs[e] > 1) {
+                    main.push_front(e);
+                    continue;
+                }
+                ghost.push_front(e);
+                if (ghost.size() > ghost_capacity) {
+                    ghost.pop_back();
+                }
+                return;
+            }
+            evict_main();
+        }
+
+        bool access(ContentType e)
+        {
+            if (contains(small, e) || contains(main, e)) {
+                freqs[e] = std::min(freqs[e] + 1, 3);
+                return true;
+            }
+            while (small.size() + main.size() >= capacity) {
+                if (small.size() >= small_capacity || main.empty()) {
+                    evict_small();
+                }
+                else {
+                    evict_main();
+                }
+            }
+            freqs[e] = 0;
+            if (contains(ghost, e)) {
+                remove(ghost, e);
+                main.push_front(e);
+            }
+            else {
+                small.push_front(e);
+            }
+            return false;
+        }
+    };
+}
+
+//逐个请求对比策略与参考实现是否命中，并检查缓存内容不超过容量、reset后重新运行的结果不变，返回不一致的次数
+template<class Policy, class Reference>
+static size_t check_policy(const vector<ContentType> &trace, size_t num_contents, size_t capacity)
+{
+    Policy policy;
+    Reference reference(capacity);
+    policy.reset(capacity, num_contents);
+
+    size_t num_mismatches = 0, num_hits = 0;
+    for (auto e: trace) {
+        bool hit = policy.access(e);
+        num_hits += hit;
+        num_mismatches += hit != reference.access(e);
+    }
+
+    ContentVector contents;
+    policy.get_contents(contents);
+    num_mismatches += contents.size() > capacity;
+
+    policy.reset(capacity, num_contents);
+    for (auto e: trace) {
+        num_hits -= policy.access(e);
+    }
+    return num_mismatches + (num_hits != 0);
+}
+
+//在小容量下对比各替换策略与参考实现，请求序列为Zipf请求中穿插顺序扫描，扫描会触发ARC与LIRS中较少走到的分支
+static void bench_policy_references()
+{
+    size_t num_runs = 0, num_mismatches = 0;
+    for (unsigned seed = 0; seed < 6; seed++) {
+        size_t num_contents = 50 + seed * 40;
+        vector<ContentType> trace;
+        mt19937 rng(seed);
+        uniform_real_distribution<double> dist(0, 1);
+        for (size_t i = 0; i < 6000; i++) {
+            if (i % 1000 < 150) {
+                trace.push_back((ContentType) (i % num_contents));
+            }
+            else {
+                trace.push_back((ContentType) (num_contents * pow(dist(rng), 3)));
+            }
+        }
+
+        for (size_t capacity: {1, 2, 3, 7, 16, 40}) {
+            num_mismatches += check_policy<LruPolicy, reference::Lru>(trace, num_contents, capacity);
+            num_mismatches += check_policy<FifoPolicy, reference::Fifo>(trace, num_contents, capacity);
+            num_mismatches += check_policy<LfuPolicy, reference::Lfu>(trace, num_contents, capacity);
+            num_mismatches += check_policy<ArcPolicy, reference::Arc>(trace, num_contents, capacity);
+            num_mismatches += check_policy<TwoQPolicy, reference::TwoQ>(trace, num_contents, capacity);
+            num_mismatches += check_policy<LirsPolicy, reference::Lirs>(trace, num_contents, capacity);
+            num_mismatches += check_policy<S3FifoPolicy, reference::S3Fifo>(trace, num_contents, capacity);
+            num_runs += 7;
+        }
+    }
+    cout << "policy references: " << num_runs << " runs, " << num_mismatches << " mismatches"
+         << (num_mismatches == 0 ? "" : " (MISMATCH)") << endl;
+}
+
+//对比Belady最优替换、下一次使用索引与NextUse特征和朴素实现，请求分别在内存中、流式读取与压缩三种模式下
+static void bench_belady_references()
+{
+    size_t num_checks = 0, num_mismatches = 0;
+    for (auto mode: {"memory", "stream", "compressed"}) {
+        //原始ID稀疏，检验稠密ID的转换
+        vector<ContentType> cs;
+        vector<TimestampType> ts;
+        mt19937 rng(0);
+        uniform_real_distribution<double> dist(0, 1);
+        for (size_t i = 0; i < 20000; i++) {
+            cs.push_back((ContentType) (300 * pow(dist(rng), 2)) * 5 + 1);
+            ts.push_back((TimestampType) (i / 37));
+        }
+
+        RequestLoader loader;
+        loader.load_dataset(cs.data(), ts.data(), cs.size());
+        if (string(mode) == "stream") {
+            loader.save_trace_file("bench_next_use.bin");
+            loader.open_trace_stream("bench_next_use.bin");
+        }
+        else if (string(mode) == "compressed") {
+            loader.compress(64);
+        }
+        loader.slice_by_time(0, ts.back() + 1, 1);
+        loader.build_next_use_index();
+
+        //按时间片读出稠密ID，朴素地从后向前扫描得到每个请求的下一次使用位置与每个内容的第一次使用位置
+        vector<ContentType> trace;
+        vector<Request> buf;
+        for (size_t i = 0; i < loader.get_num_slices(); i++) {
+            auto ptrs = loader.get_slice_range_ptrs(i);
+            auto s = loader.read_slice(ptrs.first, ptrs.second, buf);
+            for (size_t j = 0; j < s.size; j++) {
+                trace.push_back(s.data[j].content_id);
+            }
+        }
+        auto n = trace.size();
+        vector<uint64_t> next_uses(n), first_uses(loader.get_num_contents(), RequestLoader::NeverUsed);
+        for (size_t i = n; i-- > 0;) {
+            next_uses[i] = first_uses[trace[i]];
+            first_uses[trace[i]] = i;
+        }
+        for (size_t i = 0; i < n; i++) {
+            num_mismatches += loader.get_next_use(i) != next_uses[i];
+        }
+        for (size_t e = 0; e < first_uses.size(); e++) {
+            num_mismatches += loader.get_first_use((ContentType) e) != first_uses[e];
+        }
+        num_checks += n + first_uses.size();
+
+        //朴素的最优替换：未命中时线性查找下一次使用最远的缓存内容，新内容的下一次使用更远时不放入缓存
+        for (size_t capacity: {1, 2, 5, 17, 60}) {
+            map<ContentType, uint64_t> cache;
+            size_t num_hits = 0, num_belady_hits = 0;
+            for (size_t i = 0; i < n; i++) {
+                auto e = trace[i];
+                if (cache.count(e)) {
+                    num_hits++;
+                    cache[e] = next_uses[i];
+                    continue;
+                }
+                if (next_uses[i] == RequestLoader::NeverUsed) {
+                    continue;
+                }
+                if (cache.size() < capacity) {
+                    cache[e] = next_uses[i];
+                    continue;
+                }
+                auto farthest = std::max_element(cache.begin(), cache.end(), [](const auto &a, const auto &b) {
+                    return a.second < b.second;
+                });
+                if (farthest->second > next_uses[i]) {
+                    cache.erase(farthest);
+                    cache[e] = next_uses[i];
+                }
+            }
+
+            BeladyCache belady(capacity);
+            belady.reset(loader.get_num_contents());
+            for (size_t i = 0; i < n; i++) {
+                num_belady_hits += belady.access(trace[i], loader.get_next_use(i));
+            }
+            num_mismatches += num_hits != num_belady_hits;
+            num_checks++;
+        }
+
+        //NextUse特征：每隔若干时间片，对所有内容与一个不存在的内容，与从当前位置向后扫描得到的距离对比
+        NextUseFeatureExtractor extractor(&loader);
+        extractor.reset();
+        ContentVector candidates(loader.get_num_contents());
+        std::iota(candidates.begin(), candidates.end(), 0);
+        candidates.push_back(NoneContentType);
+        vector<int64_t> dists(candidates.size());
+        size_t position = 0;
+        for (size_t i = 0; i < loader.get_num_slices(); i++) {
+            auto ptrs = loader.get_slice_range_ptrs(i);
+            auto s = loader.read_slice(ptrs.first, ptrs.second, buf);
+            s.i_slice = i;
+            extractor.update(s);
+            position = ptrs.second;
+            if (i % 10 != 0) {
+                continue;
+            }
+
+            std::fill(dists.begin(), dists.end(), (int64_t) (n + 1 - position));
+            for (size_t j = n; j-- > position;) {
+                dists[trace[j]] = (int64_t) (j - position);
+            }
+            auto f = extractor.get_features(candidates);
+            for (size_t k = 0; k < candidates.size(); k++) {
+                num_mismatches += f.get(k, 0) != -(float) dists[k];
+            }
+            num_checks += candidates.size();
+        }
+    }
+    remove("bench_next_use.bin");
+
+    cout << "belady/next_use references: " << num_checks << " checks, " << num_mismatches << " mismatches"
+         << (num_mismatches == 0 ? "" : " (MISMATCH)") << endl;
+}
+
+//测试各个固定替换策略的模拟器处理整个请求序列的吞吐量
+static void bench_policies(size_t capacity, RequestLoader &loader)
+{
+    //下一次使用索引只需建立一次，所有Belady模拟器共享
+    double index_seconds = time_it([&]() {
+        loader.build_next_use_index();
+    });
+    cout << "build_next_use_index: " << loader.get_num_requests() / index_seconds << " requests/s" << endl;
+
+    for (auto policy: {"lru", "lfu", "fifo", "arc", "2q", "lirs", "s3fifo", "belady"}) {
+        auto emu = new_policy_cache_emu(policy, (int) capacity, &loader);
+        emu->reset();
+
+        size_t num_requests = 0;
+        double seconds = time_it([&]() {
+            num_requests = emu->run();
+        });
+
+        cout << "policy " << policy << ": " << num_requests / seconds << " requests/s, hit rate "
+             << emu->get_mean_hit_rate() << endl;
+        delete emu;
+    }
+}
+
+//一遍栈距离分析得到所有容量下的命中率，与逐个容量运行LRU模拟器对比
+static void bench_stack_distance(RequestLoader &loader, const vector<int> &capacities)
+{
+    StackDistanceProfiler profiler;
+    double seconds = time_it([&]() {
+        profiler.run(loader, capacities.data(), capacities.size());
+    });
+    cout << "stack distance: " << loader.get_num_requests() / seconds << " requests/s, "
+         << profiler.get_hit_ratios()->size() << " capacities in one pass" << endl;
+
+    for (auto capacity: capacities) {
+        auto emu = new_policy_cache_emu("lru", capacity, &loader);
+        emu->reset();
+        double emu_seconds = time_it([&]() {
+            emu->run();
+        });
+        cout << "  capacity " << capacity << ": lru emulator " << emu_seconds * 1e3 << " ms, hit rate "
+             << emu->get_mean_hit_rate() << ", stack distance hit rate " << (*profiler.get_hit_ratios())[capacity]
+             << endl;
+        delete emu;
+    }
+}
+
+//SHARDS采样估计的命中率曲线与精确曲线对比，报告所有容量下的平均绝对误差与最大绝对误差
+static void bench_sampled_stack_distance(RequestLoader &loader)
+{
+    StackDistanceProfiler profiler;
+    double exact_seconds = time_it([&]() {
+        profiler.run(loader);
+    });
+    FloatVector exact = *profiler.get_hit_ratios();
+    cout << "exact stack distance: " << exact_seconds * 1e3 << " ms, " << profiler.get_num_bytes() / 1024
+         << " KB" << endl;
+
+    vector<pair<double, size_t>> settings = {{0.1, 0}, {0.01, 0}, {0.001, 0}, {1, 8192}, {1, 1024}};
+    for (auto &setting: settings) {
+        double seconds = time_it([&]() {
+            profiler.run_sampled(loader, setting.first, setting.second);
+        });
+        auto &curve = *profiler.get_hit_ratios();
+        double sum_error = 0, max_error = 0;
+        for (size_t c = 0; c < exact.size(); c++) {
+            double error = std::abs(curve[c] - exact[c]);
+            sum_error += error;
+            max_error = std::max(max_error, error);
+        }
+        cout << "  shards " << (setting.second ? "fixed size " + to_string(setting.second) : "fixed rate")
+             << ": rate " << profiler.get_sampling_rate() << ", " << seconds * 1e3 << " ms, "
+             << profiler.get_num_bytes() / 1024 << " KB, mean abs error " << sum_error / exact.size()
+             << ", max abs error " << max_error << endl;
+    }
+}
+
+//对比从数组导入与映射二进制文件两种方式加载数据集的耗时
+static void bench_trace_file(vector<ContentType> &cs, vector<TimestampType> &ts, const char *path)
+{
+    RequestLoader loader;
+    auto load_seconds = time_it([&]() {
+        loader.load_dataset(cs.data(), ts.data(), cs.size());
+    });
+    loader.save_trace_file(path);
+
+    RequestLoader mapped_loader;
+    auto map_seconds = time_it([&]() {
+        mapped_loader.load_trace_file(path);
+    });
+
+    //遍历一遍映射的请求，确认内容与导入的一致
+    bool same = mapped_loader.get_num_requests() == loader.get_num_requests();
+    auto a = loader.get_slice(0, loader.get_num_requests());
+    auto b = mapped_loader.get_slice(0, mapped_loader.get_num_requests());
+    for (size_t i = 0; same && i < a.size; i++) {
+        same = a.data[i].content_id == b.data[i].content_id && a.data[i].timestamp == b.data[i].timestamp;
+    }
+
+    cout << "load_dataset: " << load_seconds << " s, load_trace_file: " << map_seconds << " s"
+         << (same ? "" : " (DIFFERENT requests)") << endl;
+
+    //在内存中与流式读取两种方式下回放整个请求序列
+    RequestLoader stream_loader;
+    stream_loader.open_trace_stream(path);
+    float hit_rates[2];
+    for (int streaming = 0; streaming < 2; streaming++) {
+        auto &replay_loader = streaming ? stream_loader : loader;
+        replay_loader.slice_by_time(0, ts.back() + 1, 1);
+
+        ActiveCacheEmu emu(1000, &replay_loader);
+        emu.use_swlfu_feature(10);
+        emu.reset();
+        auto seconds = time_it([&]() {
+            while (!emu.finished()) {
+                emu.step();
+            }
+        });
+        hit_rates[streaming] = emu.get_mean_hit_rate();
+
+        cout << (streaming ? "replay (streaming): " : "replay (in memory): ")
+             << replay_loader.get_num_requests() / seconds << " requests/s";
+        if (streaming) {
+            cout << ", resident requests: " << emu.get_num_resident_requests()
+                 << " of " << replay_loader.get_num_requests()
+                 << (hit_rates[0] == hit_rates[1] ? "" : " (DIFFERENT hit rate)");
+        }
+        cout << endl;
+    }
+    remove(path);
+}
+
+//对比压缩存储与未压缩的内存存储：逐个时间片读取请求的吞吐量，以及回放整个请求序列的吞吐量
+static void bench_compressed_trace(vector<ContentType> &cs, vector<TimestampType> &ts)
+{
+    RequestLoader loaders[2];
+    size_t num_bytes[2];
+    for (int compressed = 0; compressed < 2; compressed++) {
+        auto &l = loaders[compressed];
+        l.load_dataset(cs.data(), ts.data(), cs.size());
+        num_bytes[compressed] = l.get_num_requests() * sizeof(Request) + l.get_num_contents() * sizeof(ContentType);
+        if (compressed) {
+            num_bytes[compressed] = l.compress();
+        }
+        l.slice_by_time(0, ts.back() + 1, 1);
+    }
+
+    //逐个时间片读取并累加内容ID，防止读取被优化掉
+    for (int compressed = 0; compressed < 2; compressed++) {
+        auto &l = loaders[compressed];
+        vector<Request> buf;
+        CompressedTrace::Cursor cursor;
+        int64_t checksum = 0;
+        auto seconds = time_it([&]() {
+            for (size_t i = 0; i < l.get_num_slices(); i++) {
+                auto ptrs = l.get_slice_range_ptrs(i);
+                auto slice = l.read_slice(ptrs.first, ptrs.second, buf, &cursor);
+                for (size_t j = 0; j < slice.size; j++) {
+                    checksum += slice.data[j].content_id + slice.data[j].timestamp;
+                }
+            }
+        });
+        cout << (compressed ? "read slices (compressed): " : "read slices (in memory): ")
+             << l.get_num_requests() / seconds << " requests/s, "
+             << (double) num_bytes[compressed] / l.get_num_requests() << " bytes/request, checksum " << checksum
+             << endl;
+    }
+
+    for (int compressed = 0; compressed < 2; compressed++) {
+        auto &l = loaders[compressed];
+        ActiveCacheEmu emu(1000, &l);
+        emu.use_swlfu_feature(10);
+        emu.reset();
+        auto seconds = time_it([&]() {
+            while (!emu.finished()) {
+                emu.step();
+            }
+        });
+        cout << (compressed ? "replay (compressed): " : "replay (in memory): ")
+             << l.get_num_requests() / seconds << " requests/s" << endl;
+    }
+}
+
+//测试不同时间间隔下重新分片的耗时，与原先逐个请求扫描的方式对比
+static void bench_slicing(RequestLoader &loader, TimestampType t_end, size_t max_threads)
+{
+    auto all = loader.get_slice(0, loader.get_num_requests());
+    ThreadPool pool(max_threads);
+
+    for (TimestampType interval: {1, 10, 100}) {
+        size_t num_slices = 0, ptr_sum = 0;
+        auto scan_seconds = time_it([&]() {
+            size_t ptr_end = 0;
+            for (TimestampType t = interval; t - interval < t_end; t += interval) {
+                while (ptr_end < all.size && all.data[ptr_end].timestamp < t) {
+                    ptr_end++;
+                }
+                ptr_sum += ptr_end;
+                num_slices++;
+            }
+        });
+        auto seconds = time_it([&]() {
+            loader.slice_by_time(0, t_end, interval);
+        });
+        auto parallel_seconds = time_it([&]() {
+            loader.slice_by_time(0, t_end, interval, &pool);
+        });
+
+        cout << "slice_by_time(interval " << interval << ", " << num_slices << " slices, checksum " << ptr_sum
+             << "): linear scan "
+             << scan_seconds * 1e3 << " ms, galloping " << seconds * 1e3 << " ms, " << max_threads << " threads "
+             << parallel_seconds * 1e3 << " ms" << endl;
+    }
+
+    auto count_seconds = time_it([&]() {
+        loader.slice_by_count(1000);
+    });
+    cout << "slice_by_count(1000): " << count_seconds * 1e3 << " ms" << endl;
+
+    loader.slice_by_time(0, t_end, 1);
+}
+
+//测试合成请求序列生成器的吞吐量，检查不同线程数下结果一致，并与逐个二分查找CDF的生成方式对比
+static void bench_workload(size_t num_requests, size_t max_threads)
+{
+    vector<ContentType> cs;
+    vector<TimestampType> ts;
+    auto cdf_seconds = time_it([&]() {
+        gen_zipf_requests(num_requests, 1000000, 0.8, 1000, cs, ts);
+    });
+    cout << "workload(" << num_requests << " requests): CDF lower_bound " << num_requests / cdf_seconds / 1e6
+         << " M/s" << endl;
+
+    //依次为纯IRM与加入漂移、昼夜变化、SNM及只被请求一次的内容的混合模型
+    WorkloadConfig irm;
+    irm.num_requests = num_requests;
+    irm.num_timestamps = (TimestampType) (num_requests / 1000);
+    irm.num_contents = 1000000;
+    irm.alpha = 0.8;
+
+    auto mixed = irm;
+    mixed.drift_rate = 10;
+    mixed.diurnal_amplitude = 0.5;
+    mixed.diurnal_period = mixed.num_timestamps / 4;
+    mixed.num_shots = 100000;
+    mixed.shot_lifetime = 50;
+    mixed.shot_fraction = 0.2;
+    mixed.one_hit_fraction = 0.1;
+
+    ThreadPool pool(max_threads);
+    for (auto config: {irm, mixed}) {
+        WorkloadGenerator generator(config);
+        RequestLoader loader;
+        size_t num_contents = 0, checksum = 0;
+        auto seconds = time_it([&]() {
+            num_contents = generator.generate(loader);
+        });
+        auto all = loader.get_slice(0, loader.get_num_requests());
+        for (size_t i = 0; i < all.size; i++) {
+            checksum = checksum * 31 + all.data[i].content_id * 7 + all.data[i].timestamp;
+        }
+
+        auto parallel_seconds = time_it([&]() {
+            generator.generate(loader, &pool);
+        });
+        size_t parallel_checksum = 0;
+        all = loader.get_slice(0, loader.get_num_requests());
+        for (size_t i = 0; i < all.size; i++) {
+            parallel_checksum = parallel_checksum * 31 + all.data[i].content_id * 7 + all.data[i].timestamp;
+        }
+
+        loader.slice_by_time(0, config.num_timestamps, 1);
+        auto emu = new_policy_cache_emu("lru", 1000, &loader);
+        emu->reset();
+        emu->run();
+
+        cout << "workload(" << (config.num_shots > 0 ? "mixed" : "irm") << ", " << num_contents << " contents): "
+             << num_requests / seconds / 1e6 << " M/s, " << max_threads << " threads "
+             << num_requests / parallel_seconds / 1e6 << " M/s, lru(1000) hit " << emu->get_mean_hit_rate()
+             << (checksum == parallel_checksum ? "" : " (MISMATCH)") << endl;
+        delete emu;
+    }
+}
+
+//比较多个SWLfuFeatureExtractor与一个MultiSWLfuFeatureExtractor：更新吞吐量、取特征吞吐量、计数表内存，并检查特征逐位一致
+static void bench_multi_swlfu(const vector<int> &w_lens, RequestLoader &loader)
+{
+    vector<FeatureExtractor *> separate;
+    for (auto w_len: w_lens) {
+        separate.push_back(new SWLfuFeatureExtractor(w_len, &loader));
+    }
+    auto multi = new MultiSWLfuFeatureExtractor(w_lens, &loader);
+    size_t k = w_lens.size(), num_slices = loader.get_num_slices();
+
+    auto run = [&](const function<void(const Slice &)> &update) {
+        return time_it([&]() {
+            for (size_t i = 0; i < num_slices; i++) {
+                update(get_indexed_slice(loader, i));
+            }
+        });
+    };
+    for (auto e: separate) {
+        e->reset();
+    }
+    auto separate_seconds = run([&](const Slice &s) {
+        for (auto e: separate) {
+            e->update(s);
+        }
+    });
+    multi->reset();
+    auto multi_seconds = run([&](const Slice &s) { multi->update(s); });
+
+    ContentVector candidates(10000);
+    mt19937 rng(0);
+    for (auto &e: candidates) {
+        e = (ContentType) (rng() % loader.get_num_contents());
+    }
+    size_t n = candidates.size(), num_calls = 200;
+    vector<FeatureType> separate_out(n * k), multi_out(n * k);
+    auto separate_get_seconds = time_it([&]() {
+        for (size_t c = 0; c < num_calls; c++) {
+            for (size_t j = 0; j < k; j++) {
+                separate[j]->write_features(candidates.data(), n, separate_out.data() + j, k, 1);
+            }
+        }
+    });
+    auto multi_get_seconds = time_it([&]() {
+        for (size_t c = 0; c < num_calls; c++) {
+            multi->write_features(candidates.data(), n, multi_out.data(), k, 1);
+        }
+    });
+
+    //逐步对比：每隔若干时间片比较一次所有候选内容的特征
+    bool same = true;
+    for (auto e: separate) {
+        e->reset();
+    }
+    multi->reset();
+    for (size_t i = 0; i < num_slices; i++) {
+        auto slice = get_indexed_slice(loader, i);
+        for (auto e: separate) {
+            e->update(slice);
+        }
+        multi->update(slice);
+        if (i % 97 == 0 || i + 1 == num_slices) {
+            for (size_t j = 0; j < k; j++) {
+                separate[j]->write_features(candidates.data(), n, separate_out.data() + j, k, 1);
+            }
+            multi->write_features(candidates.data(), n, multi_out.data(), k, 1);
+            same = same && memcmp(separate_out.data(), multi_out.data(), n * k * sizeof(FeatureType)) == 0;
+        }
+    }
+
+    //最短的窗口应已移出过时间片，否则上面只测试了计数递增
+    vector<double> offsets(k), scales(k), divisors(k);
+    multi->get_feature_transform(offsets.data(), scales.data(), divisors.data());
+    bool expired = divisors[0] < (double) loader.get_num_requests();
+
+    //SWLfuFeatureExtractor每个内容占一个{世代, 计数}槽位，MultiSWLfuFeatureExtractor每个内容占一行
+    size_t row_words = StampedRows(k).get_row_words();
+    auto num_requests = (double) loader.get_num_requests();
+    cout << "multi_swlfu(k=" << k << "): update " << num_requests / separate_seconds / 1e6 << " -> "
+         << num_requests / multi_seconds / 1e6 << " M req/s, get_features "
+         << (double) n * num_calls / separate_get_seconds / 1e6 << " -> "
+         << (double) n * num_calls / multi_get_seconds / 1e6 << " M contents/s, table "
+         << k * 8 << " -> " << row_words * 4 << " bytes/content"
+         << (same ? "" : " (MISMATCH)") << (expired ? "" : " (NO EXPIRY)") << endl;
+
+    for (auto e: separate) {
+        delete e;
+    }
+    delete multi;
+}
+
+//比较特征拼接的几种方式：逐个提取器取特征后复制（旧实现）、各提取器按步长直接写入（标量与AVX2）、按列写入，并检查结果逐位一致
+static void bench_feature_assembly(size_t capacity, RequestLoader &loader)
+{
+    FeatureManager manager;
+    manager.add_feature_extractor(new OgdLfuFeatureExtractor(capacity, &loader));
+    manager.add_feature_extractor(new OgdLruFeatureExtractor(capacity, &loader));
+    manager.add_feature_extractor(new OgdOptimalFeatureExtractor(capacity, &loader));
+    manager.add_feature_extractor(new LfuFeatureExtractor(&loader));
+    manager.add_feature_extractor(new LruFeatureExtractor(&loader));
+    manager.add_feature_extractor(new SWLfuFeatureExtractor(10, &loader));
+    manager.add_feature_extractor(new SWLfuFeatureExtractor(100, &loader));
+    vector<FeatureExtractor *> extractors = {new OgdLfuFeatureExtractor(capacity, &loader),
+                                             new OgdLruFeatureExtractor(capacity, &loader),
+                                             new OgdOptimalFeatureExtractor(capacity, &loader),
+                                             new LfuFeatureExtractor(&loader), new LruFeatureExtractor(&loader),
+                                             new SWLfuFeatureExtractor(10, &loader),
+                                             new SWLfuFeatureExtractor(100, &loader)};
+    manager.reset();
+    for (auto e: extractors) {
+        e->reset();
+    }
+    for (size_t i = 0; i < loader.get_num_slices(); i++) {
+        auto slice = get_indexed_slice(loader, i);
+        manager.update(slice);
+        for (auto e: extractors) {
+            e->update(slice);
+        }
+    }
+
+    //候选内容：缓存容量加一个时间片的内容，含少量不在数据集中的ID
+    ContentVector candidates(capacity + loader.get_max_slice_size());
+    mt19937 rng(0);
+    for (auto &e: candidates) {
+        e = rng() % 64 == 0 ? NoneContentType : (ContentType) (rng() % loader.get_num_contents());
+    }
+
+    size_t n = candidates.size(), f_dims = manager.feature_dims, num_calls = 2000;
+    vector<FeatureType> old_out(n * f_dims), scalar_out(n * f_dims), simd_out(n * f_dims), col_out(n * f_dims);
+
+    auto old_seconds = time_it([&]() {
+        for (size_t k = 0; k < num_calls; k++) {
+            Feature features(old_out.data(), n, f_dims);
+            size_t offset = 0;
+            for (auto e: extractors) {
+                auto f = e->get_features(candidates);
+                for (size_t j = 0; j < n; ++j) {
+                    for (size_t i = 0; i < f.feature_dims; ++i) {
+                        features.set(j, offset + i, f.get(j, i));
+                    }
+                }
+                offset += f.feature_dims;
+            }
+        }
+    });
+
+    simd_avx2_allowed() = false;
+    auto scalar_seconds = time_it([&]() {
+        for (size_t k = 0; k < num_calls; k++) {
+            manager.write_features(candidates, n, scalar_out.data());
+        }
+    });
+    simd_avx2_allowed() = true;
+    auto simd_seconds = time_it([&]() {
+        for (size_t k = 0; k < num_calls; k++) {
+            manager.write_features(candidates, n, simd_out.data());
+        }
+    });
+    auto col_seconds = time_it([&]() {
+        for (size_t k = 0; k < num_calls; k++) {
+            manager.write_features_columns(candidates, n, col_out.data());
+        }
+    });
+
+    //旧实现中各提取器的get_features同样走向量化路径，与标量实现对比即可覆盖两条路径
+    bool same = memcmp(old_out.data(), scalar_out.data(), n * f_dims * sizeof(FeatureType)) == 0
+                && memcmp(scalar_out.data(), simd_out.data(), n * f_dims * sizeof(FeatureType)) == 0;
+    for (size_t j = 0; j < n; j++) {
+        for (size_t i = 0; i < f_dims; i++) {
+            same = same && memcmp(&col_out[i * n + j], &simd_out[j * f_dims + i], sizeof(FeatureType)) == 0;
+        }
+    }
+
+    auto rate = [&](double seconds) { return (double) n * num_calls / seconds / 1e6; };
+    cout << "feature_assembly(" << n << " candidates, " << f_dims << " dims, avx2 "
+         << (simd_has_avx2() ? "on" : "unavailable") << "): copy " << rate(old_seconds) << " M rows/s, strided scalar "
+         << rate(scalar_seconds) << " M rows/s, strided simd " << rate(simd_seconds) << " M rows/s, column-major "
+         << rate(col_seconds) << " M rows/s" << (same ? "" : " (MISMATCH)") << endl;
+
+    for (auto e: extractors) {
+        delete e;
+    }
+}
+
+//测试批量接口在不同线程数下的吞吐量，并检查结果与串行一致
+static void bench_step_batch(size_t num_emus, size_t capacity, size_t num_trace_requests, size_t max_threads)
+{
+    vector<int> handlers;
+    int w_lens[] = {10, 100};
+    for (size_t i = 0; i < num_emus; i++) {
+        auto h = init_cache_emu((int) capacity, false);
+        setup_traditional_feature_types(h, true, true, false);
+        setup_swlfu_feature_types(h, w_lens, 2);
+        handlers.push_back(h);
+    }
+
+    size_t max_candidates = capacity + get_max_slice_size();
+    size_t f_dims = feature_dims(handlers[0]);
+    vector<uint8_t> actions(num_emus * max_candidates, 0);
+    vector<ContentType> candidates(num_emus * max_candidates);
+    vector<int32_t> num_candidates(num_emus), dones(num_emus), num_steps(num_emus);
+    vector<float> features(num_emus * max_candidates * f_dims), rewards(num_emus * max_candidates);
+
+    float serial_hit_rate = -1;
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        set_num_threads((int) num_threads, false);
+        for (auto h: handlers) {
+            reset(h);
+        }
+        fill(dones.begin(), dones.end(), 0);
+
+        size_t num_requests;
+        double seconds = time_it([&]() {
+            while (count(dones.begin(), dones.end(), 0) > 0) {
+                //动作只与候选内容的位置有关，保证各线程数下的动作序列相同
+                for (size_t i = 0; i < num_emus; i++) {
+                    for (size_t j = 0; j < max_candidates; j++) {
+                        actions[i * max_candidates + j] = j < (size_t) num_candidates[i] && (j + i) % 3 != 0;
+                    }
+                }
+                step_batch(handlers.data(), num_emus, actions.data(), max_candidates, candidates.data(),
+                           num_candidates.data(), features.data(), rewards.data(), dones.data(), num_steps.data());
+            }
+        });
+        num_requests = num_emus * num_trace_requests;
+
+        float hit_rate = 0;
+        for (auto h: handlers) {
+            hit_rate += get_mean_hit_rate(h) / num_emus;
+        }
+        if (serial_hit_rate < 0) {
+            serial_hit_rate = hit_rate;
+        }
+
+        cout << "step_batch: " << num_emus << " emus, " << num_threads << " threads: "
+             << num_requests / seconds << " requests/s, mean hit rate " << hit_rate
+             << (hit_rate == serial_hit_rate ? " (same as serial)" : " (DIFFERENT from serial)") << endl;
+    }
+}
+
+//比较计时关闭与开启时单个模拟器的吞吐量，并输出各阶段的耗时占比与哈希表的探测统计
+static void bench_profiling(size_t capacity, size_t num_trace_requests)
+{
+    auto h = init_cache_emu((int) capacity, false);
+    setup_traditional_feature_types(h, true, true, false);
+    int w_lens[] = {10, 100};
+    setup_swlfu_feature_types(h, w_lens, 2);
+
+    size_t max_candidates = capacity + get_max_slice_size();
+    vector<uint8_t> actions(max_candidates);
+    vector<ContentType> candidates(max_candidates);
+    vector<int32_t> num_candidates(1), dones(1), num_steps(1);
+    vector<float> features(max_candidates * feature_dims(h)), rewards(max_candidates);
+
+    auto run = [&]() {
+        reset(h);
+        dones[0] = 0;
+        return time_it([&]() {
+            while (!dones[0]) {
+                for (size_t j = 0; j < max_candidates; j++) {
+                    actions[j] = j < (size_t) num_candidates[0] && j % 3 != 0;
+                }
+                step_batch(&h, 1, actions.data(), max_candidates, candidates.data(), num_candidates.data(),
+                           features.data(), rewards.data(), dones.data(), num_steps.data());
+            }
+        });
+    };
+
+    set_num_threads(1, false);
+    run();
+    auto off_seconds = run();
+    set_profiling(h, true);
+    auto on_seconds = run();
+    auto stats = get_profile_stats(h);
+    set_profiling(h, false);
+
+    cout << "profiling(PROFILE=" << PROFILE << "): off " << num_trace_requests / off_seconds << " requests/s, on "
+         << num_trace_requests / on_seconds << " requests/s (" << (on_seconds / off_seconds - 1) * 100
+         << "% overhead)" << endl;
+
+    const char *names[] = {"slice_fetch", "hit_test", "feature_update", "candidates", "get_features", "update_cache"};
+    uint64_t total = 0;
+    for (auto c: stats.cycles) {
+        total += c;
+    }
+    for (int i = 0; i < NumProfilePhases; i++) {
+        cout << "  " << names[i] << ": " << stats.calls[i] << " calls, "
+             << (stats.cycles_per_second > 0 ? stats.cycles[i] / stats.cycles_per_second * 1e3 : 0) << " ms, "
+             << stats.cycles[i] * 100.0 / std::max(total, (uint64_t) 1) << "%" << endl;
+    }
+    cout << "  cache table: " << stats.num_lookups << " lookups, "
+         << (double) stats.num_probes / std::max(stats.num_lookups, (uint64_t) 1) << " probes/lookup, "
+         << stats.num_collisions << " collisions, max probe length " << stats.max_probe_length << ", "
+         << stats.num_rehashes << " rehashes" << endl;
+}
+
+//大容量下比较每步写入全部候选内容的观测与只写入变化行的增量观测，两个模拟器执行相同的动作
+static void bench_delta_observation(size_t capacity, size_t num_steps)
+{
+    int w_lens[] = {10, 100};
+    int handlers[2];
+    for (auto &h: handlers) {
+        h = init_cache_emu((int) capacity, false);
+        setup_traditional_feature_types(h, true, true, false);
+        setup_swlfu_feature_types(h, w_lens, 2);
+        reset(h);
+    }
+
+    size_t max_candidates = capacity + get_max_slice_size(), f_dims = feature_dims(handlers[0]);
+    vector<int32_t> candidates(max_candidates), rows(max_candidates);
+    vector<float> frequencies(max_candidates), features(max_candidates * f_dims);
+    vector<double> raw_features(max_candidates * f_dims), offsets(f_dims), scales(f_dims), divisors(f_dims);
+
+    StepObservation obs{};
+    obs.candidates = candidates.data();
+    obs.frequencies = frequencies.data();
+    obs.features = features.data();
+    obs.max_candidates = max_candidates;
+
+    DeltaObservation delta{};
+    delta.rows = rows.data();
+    delta.candidates = candidates.data();
+    delta.frequencies = frequencies.data();
+    delta.raw_features = raw_features.data();
+    delta.offsets = offsets.data();
+    delta.scales = scales.data();
+    delta.divisors = divisors.data();
+    delta.max_candidates = max_candidates;
+
+    //动作：保留缓存内容，用发生miss的内容填满空位
+    double seconds[2] = {0, 0};
+    size_t num_rows = 0, num_candidates = 0;
+    vector<int32_t> selected;
+    for (int k = 0; k < 2; k++) {
+        auto h = handlers[k];
+        for (size_t i = 0; i < num_steps && !finished(h); i++) {
+            auto t_beg = chrono::steady_clock::now();
+            if (k == 0) {
+                step_observe(h, &obs);
+            }
+            else {
+                step_observe_delta(h, &delta);
+                num_rows += delta.num_rows;
+                num_candidates += delta.num_candidates;
+            }
+            seconds[k] += chrono::duration<double>(chrono::steady_clock::now() - t_beg).count();
+
+            auto contents = get_cache_contents(h);
+            selected.assign(contents.data, contents.data + contents.size);
+            selected.erase(remove(selected.begin(), selected.end(), NoneContentType), selected.end());
+            auto misses = get_candidates(h);
+            for (size_t j = contents.size; j < misses.size && selected.size() < capacity; j++) {
+                selected.push_back(misses.data[j]);
+            }
+            update_cache(h, {selected.data(), selected.size()});
+        }
+    }
+
+    cout << "delta_observation(capacity " << capacity << ", " << f_dims << " dims): full " << seconds[0] / num_steps * 1e6
+         << " us/step, delta " << seconds[1] / num_steps * 1e6 << " us/step, " << (double) num_rows / num_steps
+         << " of " << (double) num_candidates / num_steps << " rows/step, hit rate "
+         << get_mean_hit_rate(handlers[0]) << " / " << get_mean_hit_rate(handlers[1]) << endl;
+}
+
+//被动模式：逐次调用step并累加命中次数，与step_until_miss对比
+static void bench_step_until_miss(size_t capacity)
+{
+    double hit_rates[2];
+    for (int native = 0; native < 2; native++) {
+        auto handler = init_cache_emu((int) capacity, true);
+        reset(handler);
+
+        size_t num_decisions = 0, num_calls = 0;
+        vector<float> reward(capacity + 1);
+        vector<ContentType> selected;
+        auto seconds = time_it([&]() {
+            while (!finished(handler)) {
+                //依次用miss的内容替换缓存中的一个位置
+                auto candidates = get_candidates(handler);
+                selected.assign(candidates.data, candidates.data + candidates.size);
+                if (selected.size() > capacity) {
+                    selected.erase(selected.begin() + (num_decisions % capacity));
+                }
+                update_cache(handler, IntBuffer{selected.data(), selected.size()});
+                num_decisions++;
+
+                if (native) {
+                    step_until_miss(handler);
+                    num_calls++;
+                    continue;
+                }
+
+                std::fill(reward.begin(), reward.end(), 0);
+                while (true) {
+                    auto res = step(handler);
+                    auto freqs = get_candidate_frequencies(handler);
+                    num_calls += 2;
+                    for (size_t i = 0; i < freqs.size && i < reward.size(); i++) {
+                        reward[i] += freqs.data[i];
+                    }
+                    if (res.second > 0 || finished(handler)) {
+                        break;
+                    }
+                }
+            }
+        });
+        hit_rates[native] = get_mean_hit_rate(handler);
+
+        cout << (native ? "step_until_miss" : "step loop") << ": " << num_decisions / seconds << " decisions/s, "
+             << (double) num_calls / num_decisions << " calls/decision, mean hit rate " << hit_rates[native] << endl;
+    }
+    if (hit_rates[0] != hit_rates[1]) {
+        cout << "step_until_miss: DIFFERENT hit rate from step loop" << endl;
+    }
+}
+
+//微基准测试的参数：请求序列服从参数为alpha的Zipf分布，每slice_size个请求占用一个时间戳
+struct MicroParams
+{
+    double alpha;
+    size_t num_contents;
+    size_t capacity;
+    size_t slice_size;
+    size_t num_requests;
+};
+
+//累计多段计时区间的耗时与其中的分配次数
+struct MicroTimer
+{
+    double seconds = 0;
+    size_t allocs = 0;
+
+    template<class Func>
+    inline void measure(Func &&func)
+    {
+        auto allocs_beg = num_allocs.load(memory_order_relaxed);
+        auto t_beg = chrono::steady_clock::now();
+        func();
+        auto t_end = chrono::steady_clock::now();
+        seconds += chrono::duration<double>(t_end - t_beg).count();
+        allocs += num_allocs.load(memory_order_relaxed) - allocs_beg;
+    }
+};
+
+//输出一行JSON：num_ops为计时区间内的操作数，num_requests为其中处理的请求数
+static void report_micro(ostream &out, const string &name, const MicroParams &p, const MicroTimer &timer,
+                         size_t num_ops, size_t num_requests)
+{
+    out << "{\"bench\": \"" << name << "\", \"alpha\": " << p.alpha << ", \"num_contents\": " << p.num_contents
+        << ", \"capacity\": " << p.capacity << ", \"slice_size\": " << p.slice_size
+        << ", \"num_requests\": " << num_requests << ", \"ops\": " << num_ops << ", \"seconds\": " << timer.seconds
+        << ", \"requests_per_s\": " << num_requests / (timer.seconds + 1e-12)
+        << ", \"ns_per_op\": " << timer.seconds * 1e9 / std::max(num_ops, (size_t) 1)
+        << ", \"allocs_per_op\": " << (double) timer.allocs / std::max(num_ops, (size_t) 1) << "}" << endl;
+}
+
+//按候选内容在当前时间片的命中次数从高到低选出capacity个内容，作为外部决策
+static void select_by_frequency(CacheEmu &emu, size_t capacity, ContentVector &selected, vector<size_t> &order)
+{
+    auto &candidates = *emu.get_candidates();
+    auto &freqs = *emu.get_candidate_frequencies();
+    order.resize(candidates.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return freqs[a] > freqs[b];
+    });
+
+    selected.resize(0);
+    for (size_t i = 0; i < order.size() && selected.size() < capacity; i++) {
+        if (candidates[order[i]] != NoneContentType) {
+            selected.push_back(candidates[order[i]]);
+        }
+    }
+}
+
+//逐个时间片调用extractor的update，时间片带有序号，滑动窗口会正常移出过期的时间片
+static void bench_micro_extractor(ostream &out, const string &name, FeatureExtractor *extractor,
+                                  RequestLoader &loader, const MicroParams &p)
+{
+    extractor->reset();
+    MicroTimer timer;
+    timer.measure([&]() {
+        for (size_t i = 0; i < loader.get_num_slices(); i++) {
+            extractor->update(get_indexed_slice(loader, i));
+        }
+    });
+    report_micro(out, name + "::update", p, timer, loader.get_num_requests(), loader.get_num_requests());
+    delete extractor;
+}
+
+//在一组参数下测试所有热点路径
+static void run_micro_benches(ostream &out, const MicroParams &p)
+{
+    vector<ContentType> cs;
+    vector<TimestampType> ts;
+    gen_zipf_requests(p.num_requests, p.num_contents, p.alpha, p.slice_size, cs, ts);
+
+    RequestLoader loader;
+    loader.load_dataset(cs.data(), ts.data(), cs.size());
+    loader.slice_by_time(0, ts.back() + 1, 1);
+    auto num_requests = loader.get_num_requests();
+    auto num_slices = loader.get_num_slices();
+
+    //Cache::hit_test：缓存中预先放入最热门的capacity个内容，每个时间片结束时清除频率
+    {
+        Cache cache(p.capacity);
+        for (size_t i = 0; i < p.capacity; i++) {
+            cache.set(i, (ContentType) i);
+        }
+        size_t hit_cnt = 0;
+        MicroTimer timer;
+        timer.measure([&]() {
+            for (size_t i = 0; i < num_slices; i++) {
+                auto ptrs = loader.get_slice_range_ptrs(i);
+                auto slice = loader.get_slice(ptrs.first, ptrs.second);
+                for (size_t j = 0; j < slice.size; j++) {
+                    hit_cnt += cache.hit_test(slice.data[j].content_id);
+                }
+                cache.clear_frequencies();
+            }
+        });
+        report_micro(out, "Cache::hit_test", p, timer, num_requests, num_requests);
+    }
+
+    //Cache::replace：缓存满后每次miss都按轮转的位置替换一个内容
+    {
+        Cache cache(p.capacity);
+        size_t num_replaces = 0;
+        MicroTimer timer;
+        timer.measure([&]() {
+            for (size_t i = 0; i < num_slices; i++) {
+                auto ptrs = loader.get_slice_range_ptrs(i);
+                auto slice = loader.get_slice(ptrs.first, ptrs.second);
+                for (size_t j = 0; j < slice.size; j++) {
+                    auto e = slice.data[j].content_id;
+                    if (cache.find(e) != -1) {
+                        continue;
+                    }
+                    auto e_old = cache.full() ? cache.get(num_replaces % p.capacity) : NoneContentType;
+                    cache.replace(e, e_old);
+                    num_replaces++;
+                }
+                cache.clear_frequencies();
+            }
+        });
+        report_micro(out, "Cache::replace", p, timer, num_replaces, num_requests);
+    }
+
+    //ActiveCacheEmu::step与CacheEmu::update_cache：不使用特征，每步按命中次数选出新的缓存内容
+    {
+        ActiveCacheEmu emu((int) p.capacity, &loader);
+        emu.reset();
+        ContentVector selected;
+        vector<size_t> order;
+        MicroTimer step_timer, update_timer;
+        size_t num_steps = 0;
+        while (!emu.finished()) {
+            step_timer.measure([&]() {
+                emu.step();
+            });
+            select_by_frequency(emu, p.capacity, selected, order);
+            update_timer.measure([&]() {
+                emu.update_cache(selected.data(), selected.size());
+            });
+            num_steps++;
+        }
+        report_micro(out, "ActiveCacheEmu::step", p, step_timer, num_steps, num_requests);
+        report_micro(out, "CacheEmu::update_cache", p, update_timer, num_steps, num_requests);
+    }
+
+    //PassiveCacheEmu::step：缓存固定为最热门的capacity个内容，每次调用处理到下一次miss为止
+    {
+        PassiveCacheEmu emu((int) p.capacity, &loader);
+        emu.reset();
+        ContentVector hottest(p.capacity);
+        std::iota(hottest.begin(), hottest.end(), 0);
+        emu.update_cache(hottest.data(), hottest.size());
+
+        MicroTimer timer;
+        size_t num_steps = 0;
+        timer.measure([&]() {
+            while (!emu.finished()) {
+                emu.step();
+                num_steps++;
+            }
+        });
+        report_micro(out, "PassiveCacheEmu::step", p, timer, num_steps, num_requests);
+    }
+
+    //FeatureManager::get_features：使用LFU、LRU与滑动窗口LFU特征，每个操作为一个候选内容
+    {
+        ActiveCacheEmu emu((int) p.capacity, &loader);
+        emu.use_lfu_feature();
+        emu.use_lru_feature();
+        emu.use_swlfu_feature(10);
+        emu.reset();
+        ContentVector selected;
+        vector<size_t> order;
+        MicroTimer timer;
+        size_t num_candidates = 0;
+        while (!emu.finished()) {
+            emu.step();
+            auto &candidates = *emu.get_candidates();
+            timer.measure([&]() {
+                emu.get_features(candidates);
+            });
+            num_candidates += candidates.size();
+            select_by_frequency(emu, p.capacity, selected, order);
+            emu.update_cache(selected.data(), selected.size());
+        }
+        report_micro(out, "FeatureManager::get_features", p, timer, num_candidates, num_requests);
+    }
+
+    loader.build_next_use_index();
+    bench_micro_extractor(out, "IdFeatureExtractor", new IdFeatureExtractor(&loader), loader, p);
+    bench_micro_extractor(out, "LruFeatureExtractor", new LruFeatureExtractor(&loader), loader, p);
+    bench_micro_extractor(out, "LfuFeatureExtractor", new LfuFeatureExtractor(&loader), loader, p);
+    bench_micro_extractor(out, "SWLfuFeatureExtractor", new SWLfuFeatureExtractor(10, &loader), loader, p);
+    bench_micro_extractor(out, "MultiSWLfuFeatureExtractor", new MultiSWLfuFeatureExtractor({10, 100, 1000}, &loader),
+                          loader, p);
+    bench_micro_extractor(out, "NextUseFeatureExtractor", new NextUseFeatureExtractor(&loader), loader, p);
+    bench_micro_extractor(out, "OgdOptimalFeatureExtractor", new OgdOptimalFeatureExtractor(p.capacity, &loader),
+                          loader, p);
+    bench_micro_extractor(out, "OgdLruFeatureExtractor", new OgdLruFeatureExtractor(p.capacity, &loader), loader, p);
+    bench_micro_extractor(out, "OgdLfuFeatureExtractor", new OgdLfuFeatureExtractor(p.capacity, &loader), loader, p);
+}
+
+//解析以逗号分隔的数值列表，失败时返回false
+template<class T>
+static bool parse_list(const string &s, vector<T> &out)
+{
+    out.clear();
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        char *end = nullptr;
+        auto v = strtod(item.c_str(), &end);
+        if (item.empty() || *end != '\0' || v <= 0) {
+            return false;
+        }
+        out.push_back((T) v);
+    }
+    return !out.empty();
+}
+
+/**
+ * 微基准测试：bench_cache_emu --micro [--alphas 0.8,1.2] [--contents 100000] [--capacities 100,1000]
+ *                                    [--slice-sizes 1000] [--requests 1000000] [--output PATH]
+ * 对各参数的每种组合测试所有热点路径，每个结果输出一行JSON，默认输出到标准输出
+ */
+static int micro_main(int argc, char **argv)
+{
+    vector<double> alphas = {0.8};
+    vector<size_t> contents = {100000}, capacities = {100}, slice_sizes = {1000}, requests = {1000000};
+    string output_path;
+
+    for (int i = 2; i < argc; i += 2) {
+        string key = argv[i];
+        string value = i + 1 < argc ? argv[i + 1] : "";
+        bool ok;
+        if (key == "--alphas") {
+            ok = parse_list(value, alphas);
+        }
+        else if (key == "--contents") {
+            ok = parse_list(value, contents);
+        }
+        else if (key == "--capacities") {
+            ok = parse_list(value, capacities);
+        }
+        else if (key == "--slice-sizes") {
+            ok = parse_list(value, slice_sizes);
+        }
+        else if (key == "--requests") {
+            ok = parse_list(value, requests);
+        }
+        else if (key == "--output") {
+            output_path = value;
+            ok = !value.empty();
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            cerr << "invalid option " << key << " " << value << endl;
+            cerr << "usage: bench_cache_emu --micro [--alphas A1,A2,...] [--contents N1,...] [--capacities C1,...]"
+                 << " [--slice-sizes S1,...] [--requests R1,...] [--output PATH]" << endl;
+            return 1;
+        }
+    }
+
+    ofstream file;
+    if (!output_path.empty()) {
+        file.open(output_path);
+    }
+    ostream &out = output_path.empty() ? cout : file;
+
+    for (auto alpha: alphas) {
+        for (auto num_contents: contents) {
+            for (auto capacity: capacities) {
+                for (auto slice_size: slice_sizes) {
+                    for (auto num_requests: requests) {
+                        run_micro_benches(out, {alpha, num_contents, capacity, slice_size, num_requests});
+                    }
+                }
+            }
+        }
+    }
+
+    if (!output_path.empty()) {
+        file.close();
+        if (!file) {
+            cerr << "failed to write " << output_path << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && string(argv[1]) == "--micro") {
+        return micro_main(argc, argv);
+    }
+
+    size_t num_requests = 200000, num_contents = 100000, capacity = 100, slice_size = 1000;
+    double alpha = 0.8;
+
+    vector<ContentType> cs;
+    vector<TimestampType> ts;
+    gen_zipf_requests(num_requests, num_contents, alpha, slice_size, cs, ts);
+
+    RequestLoader loader;
+    loader.load_dataset(cs.data(), ts.data(), cs.size());
+    loader.slice_by_time(0, ts.back() + 1, 1);
+
+    cout << "requests: " << num_requests << ", contents: " << num_contents << ", alpha: " << alpha
+         << ", capacity: " << capacity << ", slice size: " << slice_size << endl;
+
+    bench_ogd_extractor("OgdLfuFeatureExtractor", new OgdLfuFeatureExtractor(capacity, &loader), loader);
+    bench_ogd_extractor("OgdLruFeatureExtractor", new OgdLruFeatureExtractor(capacity, &loader), loader);
+    bench_ogd_extractor("OgdOptimalFeatureExtractor", new OgdOptimalFeatureExtractor(capacity, &loader), loader);
+    bench_feature_assembly(capacity, loader);
+    bench_policy_references();
+    bench_belady_references();
+
+    //命中检测使用更长的请求序列
+    for (double hit_alpha: {0.8, 1.2}) {
+        size_t hit_capacity = 1000;
+        gen_zipf_requests(10000000, 1000000, hit_alpha, slice_size, cs, ts);
+        RequestLoader hit_loader;
+        hit_loader.load_dataset(cs.data(), ts.data(), cs.size());
+        hit_loader.slice_by_time(0, ts.back() + 1, 1);
+
+        cout << "hit_test: requests: " << cs.size() << ", contents: 1000000, alpha: " << hit_alpha
+             << ", capacity: " << hit_capacity << endl;
+
+        if (hit_alpha == 0.8) {
+            bench_reset("LfuFeatureExtractor", new LfuFeatureExtractor(&hit_loader), hit_loader, 1000);
+            bench_reset("SWLfuFeatureExtractor", new SWLfuFeatureExtractor(10, &hit_loader), hit_loader, 1000);
+            bench_multi_swlfu({10, 100, 1000}, hit_loader);
+            bench_multi_swlfu({10, 20, 50, 100, 200, 500, 1000}, hit_loader);
+            bench_reset("OgdLfuFeatureExtractor", new OgdLfuFeatureExtractor(hit_capacity, &hit_loader), hit_loader, 1000);
+            bench_trace_file(cs, ts, "bench_trace.bin");
+            bench_compressed_trace(cs, ts);
+            bench_slicing(hit_loader, ts.back() + 1, std::max(thread::hardware_concurrency(), 1u));
+            bench_workload(cs.size(), std::max(thread::hardware_concurrency(), 1u));
+            bench_stack_distance(hit_loader, {100, 1000, 10000});
+        }
+
+        bench_sampled_stack_distance(hit_loader);
+
+        MapCacheIndex map_cache;
+        bench_hit_test("unordered_map", map_cache, hit_capacity, hit_loader);
+        Cache cache(hit_capacity);
+        bench_hit_test("Cache", cache, hit_capacity, hit_loader);
+
+        bench_policies(hit_capacity, hit_loader);
+    }
+
+    //批量接口使用apis.cpp中的全局loader
+    gen_zipf_requests(1000000, 100000, 0.8, slice_size, cs, ts);
+    load_dataset(cs.data(), ts.data(), cs.size());
+    slice_dataset_by_time(0, ts.back() + 1, 1);
+    bench_step_batch(32, 100, cs.size(), std::max(thread::hardware_concurrency(), 1u));
+    bench_profiling(100, cs.size());
+
+    //增量观测使用大容量、较短的时间片
+    gen_zipf_requests(1000000, 1000000, 0.8, 100, cs, ts);
+    load_dataset(cs.data(), ts.data(), cs.size());
+    slice_dataset_by_time(0, ts.back() + 1, 1);
+    bench_delta_observation(10000, 2000);
+
+    //被动模式使用命中率较高、时间片较短的请求序列，此时两次miss之间常跨越多个时间片
+    gen_zipf_requests(200000, 10000, 1.2, 10, cs, ts);
+    load_dataset(cs.data(), ts.data(), cs.size());
+    slice_dataset_by_time(0, ts.back() + 1, 1);
+    bench_step_until_miss(100);
+
+    return 0;
+}
@@ -1,24 +1,25 @@
 #pragma once
 
 #include <vector>
-#include <unordered_map>
 #include <ostream>
+#include <cstdint>
+#include <algorithm>
 
 using namespace std;
 
 #include "utils.h"
+#include "content_table.hpp"
 
 class Cache
 {
 private:
     //缓存内容
     ContentVector contents;
-    //保存返回的频率值
-    FloatVector freq_ret;
 
-    //缓存内容集合，用于检测缓存命中与否
-    unordered_map<ContentType, size_t> pos_map;
-    unordered_map<ContentType, size_t> freq_map;
+    //缓存内容及其位置、当前步命中次数，用于检测缓存命中与否
+    ContentTable table;
+    //缓存中内容数量
+    size_t num_cached = 0;
 
     inline void check_idx(size_t idx)
     {
@@ -27,7 +28,7 @@ private:
 
 public:
     explicit Cache(size_t _capacity)
-            : contents(_capacity, NoneContentType), freq_ret(_capacity, 0) {}
+            : contents(_capacity, NoneContentType), table(2 * _capacity) {}
 
     void reset()
     {
@@ -38,8 +39,14 @@ public:
         for (auto &e : contents) {
             e = NoneContentType;
         }
-        pos_map.clear();
-        freq_map.clear();
+        table.clear();
+        num_cached = 0;
+    }
+
+    //设置哈希表探测统计写入的位置，为nullptr时不统计
+    inline void set_probe_stats(ProfileStats *stats)
+    {
+        this->table.set_probe_stats(stats);
     }
 
     //获取所有缓存内容
@@ -51,38 +58,28 @@ public:
     //获取某一个元素的频率
     inline float get_frequency(ContentType e)
     {
-        float freq = 0;
-        auto it = this->freq_map.find(e);
-        if (it != this->freq_map.end()) {
-            freq = it->second;
-        }
-        return freq;
+        auto slot = this->table.find(e);
+        return slot == nullptr ? 0 : (float) this->table.get_freq(slot);
     }
 
-    //获取每个内容的命中次数
-    inline FloatVector *get_frequencies(const ContentVector *elements)
+    //获取每个内容的命中次数，写入freqs中
+    inline void get_frequencies(const ContentVector *elements, float *freqs)
     {
-        freq_ret.resize(0);
-
-        for (auto &e: *elements) {
-            auto freq = this->get_frequency(e);
-            freq_ret.push_back(freq);
+        for (size_t i = 0; i < elements->size(); i++) {
+            freqs[i] = this->get_frequency((*elements)[i]);
         }
-
-        return &freq_ret;
     }
 
-
     //清楚统计的内容频率
     inline void clear_frequencies()
     {
-        this->freq_map.clear();
+        this->table.clear_freqs();
     }
 
     //缓存中内容数量
     inline size_t size()
     {
-        return this->pos_map.size();
+        return this->num_cached;
     }
 
     //缓存的最大容量
@@ -107,37 +104,34 @@ public:
     //将内容放置在某处
     inline void set(size_t idx, ContentType e)
     {
-        ASSERT((this->pos_map.find(e) == this->pos_map.end()) && "Error: content is already in the cache!");
+        ASSERT((this->find(e) == -1) && "Error: content is already in the cache!");
 
         this->check_idx(idx);
         auto e_old = this->contents[idx];
-        auto it = this->pos_map.find(e_old);
-        if (it != this->pos_map.end()) {
-            this->pos_map.erase(it);
+        auto slot_old = this->table.find(e_old);
+        if (slot_old != nullptr && slot_old->pos != -1) {
+            slot_old->pos = -1;
+            this->num_cached--;
         }
 
         this->contents[idx] = e;
-        this->pos_map[e] = idx;
+        this->table.find_or_insert(e)->pos = (int32_t) idx;
+        this->num_cached++;
     }
 
     //根据元素查找它在缓存中的位置，-1表示该元素不在缓存中
     inline int find(ContentType e)
     {
-        auto it = this->pos_map.find(e);
-        if (it != this->pos_map.end()) {
-            return it->second;
-        }
-        else {
-            return -1;
-        }
+        auto slot = this->table.find(e);
+        return slot == nullptr ? -1 : slot->pos;
     }
 
     //检测内容是否在缓存中，同时更新内容频率
     inline bool hit_test(ContentType e)
     {
-        freq_map[e]++;
-        auto idx = this->find(e);
-        return idx != -1;
+        auto slot = this->table.find_or_insert(e);
+        this->table.add_freq(slot);
+        return slot->pos != -1;
     }
 
     //使用新的内容替换老的内容
@@ -158,3 +152,828 @@ public:
         this->set(idx, e_new);
     }
 };
+
+
+/**
+ * 若干条共用节点数组的侵入式双向链表，节点即内容的稠密ID，每个内容同一时刻至多位于其中一条链表中。
+ * 第i条链表的表头为下标num_contents + i的哨兵节点，front为表头之后的一端，back为表头之前的一端
+ */
+class DenseLists
+{
+private:
+    //同一节点的前后指针与所在链表放在一起，访问一个节点只需读取一个缓存行
+    struct Node
+    {
+        int32_t prev, next;
+        uint8_t owner;  //内容所在的链表
+    };
+
+    vector<Node> nodes;
+    vector<size_t> sizes;
+    int32_t base = 0;
+
+public:
+    static constexpr uint8_t NoneList = UINT8_MAX;
+
+    //清空所有链表，只需遍历链表中的节点；内容数量变化时重新分配节点数组
+    void reset(size_t num_contents, size_t num_lists)
+    {
+        if ((size_t) base != num_contents || sizes.size() != num_lists) {
+            nodes.assign(num_contents + num_lists, Node{0, 0, NoneList});
+            sizes.assign(num_lists, 0);
+            base = (int32_t) num_contents;
+        }
+        else {
+            for (size_t i = 0; i < num_lists; i++) {
+                for (auto e = front(i); e != head(i); e = nodes[e].next) {
+                    nodes[e].owner = NoneList;
+                }
+                sizes[i] = 0;
+            }
+        }
+
+        for (size_t i = 0; i < num_lists; i++) {
+            nodes[head(i)].prev = nodes[head(i)].next = head(i);
+        }
+    }
+
+    //链表的哨兵节点
+    inline int32_t head(size_t list) const
+    {
+        return base + (int32_t) list;
+    }
+
+    //内容所在的链表，NoneList表示不在任何链表中
+    inline uint8_t which(ContentType e) const
+    {
+        return nodes[e].owner;
+    }
+
+    inline size_t size(size_t list) const
+    {
+        return sizes[list];
+    }
+
+    inline bool empty(size_t list) const
+    {
+        return sizes[list] == 0;
+    }
+
+    inline ContentType front(size_t list) const
+    {
+        return nodes[head(list)].next;
+    }
+
+    inline ContentType back(size_t list) const
+    {
+        return nodes[head(list)].prev;
+    }
+
+    //节点的前一个节点，可能是哨兵节点
+    inline int32_t prev_of(int32_t e) const
+    {
+        return nodes[e].prev;
+    }
+
+    //将e插入到链表list中的节点pos之后，pos可以是哨兵节点
+    inline void insert_after(size_t list, int32_t pos, ContentType e)
+    {
+        auto n = nodes[pos].next;
+        nodes[e] = Node{pos, n, (uint8_t) list};
+        nodes[pos].next = e;
+        nodes[n].prev = e;
+        sizes[list]++;
+    }
+
+    inline void push_front(size_t list, ContentType e)
+    {
+        insert_after(list, head(list), e);
+    }
+
+    inline void push_back(size_t list, ContentType e)
+    {
+        insert_after(list, nodes[head(list)].prev, e);
+    }
+
+    inline void remove(ContentType e)
+    {
+        auto &node = nodes[e];
+        nodes[node.prev].next = node.next;
+        nodes[node.next].prev = node.prev;
+        sizes[node.owner]--;
+        node.owner = NoneList;
+    }
+
+    inline ContentType pop_front(size_t list)
+    {
+        auto e = front(list);
+        remove(e);
+        return e;
+    }
+
+    inline ContentType pop_back(size_t list)
+    {
+        auto e = back(list);
+        remove(e);
+        return e;
+    }
+
+    inline void move_to_front(size_t list, ContentType e)
+    {
+        remove(e);
+        push_front(list, e);
+    }
+
+    //将链表中的内容从front到back依次追加到out中
+    void append_to(size_t list, ContentVector &out) const
+    {
+        for (auto e = front(list); e != head(list); e = nodes[e].next) {
+            out.push_back(e);
+        }
+    }
+};
+
+/**
+ * 以下为PolicyCache使用的替换策略，均以稠密ID为下标保存状态，每个请求的处理复杂度为O(1)（均摊）。
+ * 策略需实现：
+ *   void reset(size_t capacity, size_t num_contents)  清空缓存
+ *   bool access(ContentType e)                         访问内容，返回是否命中，未命中时将内容放入缓存
+ *   void get_contents(ContentVector &out) const        获取缓存中的内容
+ * capacity大于0由PolicyCache保证
+ */
+
+//最近最少使用
+class LruPolicy
+{
+private:
+    DenseLists lists;
+    size_t capacity = 0;
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        lists.reset(num_contents, 1);
+    }
+
+    inline bool access(ContentType e)
+    {
+        if (lists.which(e) == 0) {
+            lists.move_to_front(0, e);
+            return true;
+        }
+
+        if (lists.size(0) >= capacity) {
+            lists.pop_back(0);
+        }
+        lists.push_front(0, e);
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        lists.append_to(0, out);
+    }
+};
+
+//先进先出
+class FifoPolicy
+{
+private:
+    DenseLists lists;
+    size_t capacity = 0;
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        lists.reset(num_contents, 1);
+    }
+
+    inline bool access(ContentType e)
+    {
+        if (lists.which(e) == 0) {
+            return true;
+        }
+
+        if (lists.size(0) >= capacity) {
+            lists.pop_back(0);
+        }
+        lists.push_front(0, e);
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        lists.append_to(0, out);
+    }
+};
+
+/**
+ * 最不经常使用，只统计内容进入缓存后的命中次数，次数相同时淘汰最早达到该次数的内容。
+ * 缓存内容按(次数, 达到该次数的先后)升序排成一条链表，bucket_last记录每个次数的最后一个内容，
+ * 命中时内容只需移动到下一个次数的末尾
+ */
+class LfuPolicy
+{
+private:
+    DenseLists lists;
+    size_t capacity = 0;
+
+    vector<uint32_t> freqs;         //缓存内容的命中次数
+    vector<int32_t> bucket_last;    //每个次数的最后一个内容，-1表示没有该次数的内容
+
+    //将内容从链表中移除，并维护其所在次数的最后一个内容
+    inline void unlink(ContentType e)
+    {
+        auto f = freqs[e];
+        if (bucket_last[f] == e) {
+            auto p = lists.prev_of(e);
+            bucket_last[f] = (p != lists.head(0) && freqs[p] == f) ? p : NoneContentType;
+        }
+        lists.remove(e);
+    }
+
+    //将内容插入到pos之后，作为次数freqs[e]的最后一个内容
+    inline void link_after(int32_t pos, ContentType e)
+    {
+        auto f = freqs[e];
+        if (f >= bucket_last.size()) {
+            bucket_last.resize(std::max((size_t) f + 1, bucket_last.size() * 2), NoneContentType);
+        }
+        if (bucket_last[f] != NoneContentType) {
+            pos = bucket_last[f];
+        }
+        lists.insert_after(0, pos, e);
+        bucket_last[f] = e;
+    }
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        lists.reset(num_contents, 1);
+        freqs.resize(num_contents);
+        bucket_last.assign(16, NoneContentType);
+    }
+
+    inline bool access(ContentType e)
+    {
+        if (lists.which(e) == 0) {
+            //次数freqs[e]中没有其他内容时，新位置紧接在原来的前一个内容之后
+            auto p = lists.prev_of(e);
+            unlink(e);
+            auto f = freqs[e];
+            if (bucket_last[f] != NoneContentType) {
+                p = bucket_last[f];
+            }
+            freqs[e] = f + 1;
+            link_after(p, e);
+            return true;
+        }
+
+        if (lists.size(0) >= capacity) {
+            unlink(lists.front(0));
+        }
+        freqs[e] = 1;
+        link_after(lists.head(0), e);
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        lists.append_to(0, out);
+    }
+};
+
+/**
+ * ARC（Megiddo & Modha, FAST 2003），T1/T2为只访问过一次/多次的缓存内容，
+ * B1/B2为从T1/T2中淘汰的内容，根据B1/B2的命中情况自适应调整T1的目标大小p
+ */
+class ArcPolicy
+{
+private:
+    enum { T1, T2, B1, B2 };
+
+    DenseLists lists;
+    size_t capacity = 0;
+    double p = 0;
+
+    //从T1或T2中淘汰一个内容到对应的B1或B2
+    inline void replace(bool in_b2)
+    {
+        auto t1 = lists.size(T1);
+        if (t1 > 0 && ((double) t1 > p || (in_b2 && (double) t1 == p) || lists.empty(T2))) {
+            lists.push_front(B1, lists.pop_back(T1));
+        }
+        else {
+            lists.push_front(B2, lists.pop_back(T2));
+        }
+    }
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        this->p = 0;
+        lists.reset(num_contents, 4);
+    }
+
+    inline bool access(ContentType e)
+    {
+        auto w = lists.which(e);
+        if (w == T1 || w == T2) {
+            lists.move_to_front(T2, e);
+            return true;
+        }
+
+        auto b1 = (double) lists.size(B1), b2 = (double) lists.size(B2);
+        if (w == B1) {
+            p = std::min((double) capacity, p + std::max(b2 / b1, 1.0));
+            replace(false);
+            lists.move_to_front(T2, e);
+            return false;
+        }
+        if (w == B2) {
+            p = std::max(0.0, p - std::max(b1 / b2, 1.0));
+            replace(true);
+            lists.move_to_front(T2, e);
+            return false;
+        }
+
+        auto l1 = lists.size(T1) + lists.size(B1);
+        auto l2 = lists.size(T2) + lists.size(B2);
+        if (l1 >= capacity) {
+            if (lists.size(T1) < capacity) {
+                lists.pop_back(B1);
+                replace(false);
+            }
+            else {
+                lists.pop_back(T1);
+            }
+        }
+        else if (l1 + l2 >= capacity) {
+            if (l1 + l2 >= 2 * capacity) {
+                lists.pop_back(B2);
+            }
+            replace(false);
+        }
+        lists.push_front(T1, e);
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        lists.append_to(T1, out);
+        lists.append_to(T2, out);
+    }
+};
+
+/**
+ * 2Q（Johnson & Shasha, VLDB 1994）的完整版本：A1in为首次访问内容的FIFO队列，
+ * A1out记录从A1in中淘汰的内容，Am为再次访问内容的LRU队列。Kin = 25%，Kout = 50%
+ */
+class TwoQPolicy
+{
+private:
+    enum { A1in, A1out, Am };
+
+    DenseLists lists;
+    size_t capacity = 0, k_in = 0, k_out = 0;
+
+    //缓存已满时腾出一个位置
+    inline void reclaim()
+    {
+        if (lists.size(A1in) + lists.size(Am) < capacity) {
+            return;
+        }
+
+        if (lists.size(A1in) > k_in || lists.empty(Am)) {
+            lists.push_front(A1out, lists.pop_back(A1in));
+            if (lists.size(A1out) > k_out) {
+                lists.pop_back(A1out);
+            }
+        }
+        else {
+            lists.pop_back(Am);
+        }
+    }
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        this->k_in = std::max(capacity / 4, (size_t) 1);
+        this->k_out = std::max(capacity / 2, (size_t) 1);
+        lists.reset(num_contents, 3);
+    }
+
+    inline bool access(ContentType e)
+    {
+        auto w = lists.which(e);
+        if (w == Am) {
+            lists.move_to_front(Am, e);
+            return true;
+        }
+        if (w == A1in) {
+            return true;
+        }
+
+        if (w == A1out) {
+            lists.remove(e);
+            reclaim();
+            lists.push_front(Am, e);
+        }
+        else {
+            reclaim();
+            lists.push_front(A1in, e);
+        }
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        lists.append_to(A1in, out);
+        lists.append_to(Am, out);
+    }
+};
+
+/**
+ * LIRS（Jiang & Zhang, SIGMETRICS 2002），栈S按最近访问排列LIR内容与最近访问过的HIR内容，
+ * 队列Q保存驻留在缓存中的HIR内容，HIR部分占缓存的1%（至少1个）。
+ * 栈底始终为LIR内容，低于最后一个LIR内容的HIR内容被剪除。
+ * S中非驻留的HIR内容另按变为非驻留的先后排成队列N，数量超过缓存容量时移除最早的，使S的长度有界
+ */
+class LirsPolicy
+{
+private:
+    enum : uint8_t { Lir, HirResident, HirNonResident };
+    enum { Q, N };
+
+    DenseLists stack, hirs;  //hirs中的Q与N分别为驻留与非驻留的HIR内容
+    vector<uint8_t> status;  //位于S或Q中的内容的状态
+    size_t capacity = 0, lir_capacity = 0, num_lir = 0;
+
+    //剪除栈底的HIR内容
+    inline void prune()
+    {
+        while (!stack.empty(0) && status[stack.back(0)] != Lir) {
+            auto e = stack.pop_back(0);
+            if (status[e] == HirNonResident) {
+                hirs.remove(e);
+            }
+        }
+    }
+
+    //LIR内容超出上限时，将栈底的LIR内容转为驻留的HIR内容
+    inline void demote()
+    {
+        if (num_lir <= lir_capacity) {
+            return;
+        }
+
+        prune();
+        auto e = stack.pop_back(0);
+        status[e] = HirResident;
+        hirs.push_front(Q, e);
+        num_lir--;
+        prune();
+    }
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        this->lir_capacity = capacity - std::max(capacity / 100, (size_t) 1);
+        this->num_lir = 0;
+        stack.reset(num_contents, 1);
+        hirs.reset(num_contents, 2);
+        status.resize(num_contents);
+    }
+
+    inline bool access(ContentType e)
+    {
+        bool in_stack = stack.which(e) == 0;
+
+        if (in_stack && status[e] == Lir) {
+            bool at_bottom = stack.back(0) == e;
+            stack.move_to_front(0, e);
+            if (at_bottom) {
+                prune();
+            }
+            return true;
+        }
+
+        if (hirs.which(e) == Q) {
+            if (in_stack) {
+                hirs.remove(e);
+                stack.move_to_front(0, e);
+                status[e] = Lir;
+                num_lir++;
+                demote();
+            }
+            else {
+                stack.push_front(0, e);
+                hirs.move_to_front(Q, e);
+            }
+            return true;
+        }
+
+        //淘汰Q中最早的内容，若它仍在S中则转为非驻留的HIR内容
+        if (num_lir + hirs.size(Q) >= capacity) {
+            auto victim = hirs.pop_back(Q);
+            if (stack.which(victim) == 0) {
+                status[victim] = HirNonResident;
+                hirs.push_front(N, victim);
+                if (hirs.size(N) > capacity) {
+                    //栈底为LIR内容，移除的内容不会位于栈底
+                    stack.remove(hirs.pop_back(N));
+                }
+            }
+        }
+
+        //e可能刚刚从N中移除，需要重新判断
+        if (stack.which(e) == 0) {
+            hirs.remove(e);
+            stack.move_to_front(0, e);
+            status[e] = Lir;
+            num_lir++;
+            demote();
+        }
+        else if (num_lir < lir_capacity) {
+            stack.push_front(0, e);
+            status[e] = Lir;
+            num_lir++;
+        }
+        else {
+            stack.push_front(0, e);
+            hirs.push_front(Q, e);
+            status[e] = HirResident;
+        }
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        //LIR内容都在S中，驻留的HIR内容都在Q中
+        stack.append_to(0, out);
+        out.erase(std::remove_if(out.end() - stack.size(0), out.end(), [this](ContentType e) {
+            return status[e] != Lir;
+        }), out.end());
+        hirs.append_to(Q, out);
+    }
+};
+
+/**
+ * S3-FIFO（Yang et al., SOSP 2023），小队列S占缓存的10%，主队列M占90%，
+ * 幽灵队列G记录从S中淘汰的内容，长度与M相同。每个内容有一个至多为3的访问计数
+ */
+class S3FifoPolicy
+{
+private:
+    enum { Small, Main, Ghost };
+
+    DenseLists lists;
+    vector<uint8_t> freqs;
+    size_t capacity = 0, small_capacity = 0, ghost_capacity = 0;
+
+    inline void evict_main()
+    {
+        while (!lists.empty(Main)) {
+            auto e = lists.back(Main);
+            if (freqs[e] > 0) {
+                freqs[e]--;
+                lists.move_to_front(Main, e);
+            }
+            else {
+                lists.remove(e);
+                return;
+            }
+        }
+    }
+
+    inline void evict_small()
+    {
+        while (!lists.empty(Small)) {
+            auto e = lists.pop_back(Small);
+            if (freqs[e] > 1) {
+                lists.push_front(Main, e);
+            }
+            else {
+                lists.push_front(Ghost, e);
+                if (lists.size(Ghost) > ghost_capacity) {
+                    lists.pop_back(Ghost);
+                }
+                return;
+            }
+        }
+        //S中的内容全部移入M，改为从M中淘汰
+        evict_main();
+    }
+
+public:
+    void reset(size_t capacity, size_t num_contents)
+    {
+        this->capacity = capacity;
+        this->small_capacity = std::max(capacity / 10, (size_t) 1);
+        this->ghost_capacity = capacity - std::min(small_capacity, capacity);
+        lists.reset(num_contents, 3);
+        freqs.resize(num_contents);
+    }
+
+    inline bool access(ContentType e)
+    {
+        auto w = lists.which(e);
+        if (w == Small || w == Main) {
+            freqs[e] = std::min(freqs[e] + 1, 3);
+            return true;
+        }
+
+        while (lists.size(Small) + lists.size(Main) >= capacity) {
+            if (lists.size(Small) >= small_capacity || lists.empty(Main)) {
+                evict_small();
+            }
+            else {
+                evict_main();
+            }
+        }
+
+        //淘汰时e可能被挤出G，需要重新判断
+        freqs[e] = 0;
+        if (lists.which(e) == Ghost) {
+            lists.remove(e);
+            lists.push_front(Main, e);
+        }
+        else {
+            lists.push_front(Small, e);
+        }
+        return false;
+    }
+
+    void get_contents(ContentVector &out) const
+    {
+        lists.append_to(Small, out);
+        lists.append_to(Main, out);
+    }
+};
+
+/**
+ * 使用固定替换策略的缓存，请求直接在C++中处理，不需要外部决定缓存内容。
+ * 内容为稠密ID，取值范围为[0, num_contents)
+ */
+template<class Policy>
+class PolicyCache
+{
+private:
+    Policy policy;
+    size_t cache_capacity;
+
+public:
+    explicit PolicyCache(size_t capacity) : cache_capacity(capacity) {}
+
+    void reset(size_t num_contents)
+    {
+        this->policy.reset(this->cache_capacity, num_contents);
+    }
+
+    //依次访问一批请求，返回其中命中的次数
+    inline size_t access(const Request *requests, size_t size)
+    {
+        if (this->cache_capacity == 0) {
+            return 0;
+        }
+
+        size_t num_hits = 0;
+        for (size_t i = 0; i < size; i++) {
+            num_hits += this->policy.access(requests[i].content_id);
+        }
+        return num_hits;
+    }
+
+    inline size_t capacity() const
+    {
+        return this->cache_capacity;
+    }
+
+    //获取缓存中的内容，写入out
+    void get_contents(ContentVector &out) const
+    {
+        out.resize(0);
+        this->policy.get_contents(out);
+    }
+};
+
+/**
+ * Belady最优替换（离线），需要知道每个请求的下一次使用位置。
+ * 缓存内容按下一次使用位置组成最大堆，未命中时若新内容的下一次使用比堆顶更远则不放入缓存，
+ * 否则替换堆顶，得到的命中率是给定容量下的最优值。每个请求的复杂度为O(log C)
+ */
+class BeladyCache
+{
+private:
+    size_t cache_capacity;
+
+    ContentVector heap;             //缓存内容组成的最大堆
+    vector<uint64_t> keys;          //堆中每个位置的内容的下一次使用位置
+    vector<int32_t> heap_idxs;      //每个内容在堆中的位置，-1表示不在缓存中
+
+    inline void place(size_t idx, ContentType e, uint64_t key)
+    {
+        heap[idx] = e;
+        keys[idx] = key;
+        heap_idxs[e] = (int32_t) idx;
+    }
+
+    inline void sift_up(size_t idx, ContentType e, uint64_t key)
+    {
+        while (idx > 0) {
+            size_t parent = (idx - 1) / 2;
+            if (keys[parent] >= key) {
+                break;
+            }
+            place(idx, heap[parent], keys[parent]);
+            idx = parent;
+        }
+        place(idx, e, key);
+    }
+
+    inline void sift_down(size_t idx, ContentType e, uint64_t key)
+    {
+        size_t n = heap.size();
+        while (true) {
+            size_t child = 2 * idx + 1;
+            if (child >= n) {
+                break;
+            }
+            if (child + 1 < n && keys[child + 1] > keys[child]) {
+                child++;
+            }
+            if (keys[child] <= key) {
+                break;
+            }
+            place(idx, heap[child], keys[child]);
+            idx = child;
+        }
+        place(idx, e, key);
+    }
+
+public:
+    explicit BeladyCache(size_t capacity) : cache_capacity(capacity) {}
+
+    void reset(size_t num_contents)
+    {
+        if (heap_idxs.size() != num_contents) {
+            heap_idxs.assign(num_contents, -1);
+        }
+        else {
+            for (auto e: heap) {
+                heap_idxs[e] = -1;
+            }
+        }
+        heap.resize(0);
+        keys.resize(0);
+        heap.reserve(cache_capacity);
+        keys.reserve(cache_capacity);
+    }
+
+    /**
+     * 访问内容
+     * @param next_use  该请求之后内容下一次被请求的位置，不再被请求时为UINT64_MAX
+     * @return  是否命中
+     */
+    inline bool access(ContentType e, uint64_t next_use)
+    {
+        auto idx = heap_idxs[e];
+        if (idx != -1) {
+            //命中的内容的下一次使用位置只会变大
+            sift_up((size_t) idx, e, next_use);
+            return true;
+        }
+
+        if (next_use == UINT64_MAX || cache_capacity == 0) {
+            return false;
+        }
+
+        if (heap.size() < cache_capacity) {
+            heap.push_back(e);
+            keys.push_back(next_use);
+            sift_up(heap.size() - 1, e, next_use);
+        }
+        else if (keys[0] > next_use) {
+            heap_idxs[heap[0]] = -1;
+            sift_down(0, e, next_use);
+        }
+        return false;
+    }
+
+    inline size_t capacity() const
+    {
+        return this->cache_capacity;
+    }
+
+    //获取缓存中的内容，写入out
+    void get_contents(ContentVector &out) const
+    {
+        out.assign(heap.begin(), heap.end());
+    }
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <iostream>
 #include <set>
 
@@ -7,6 +9,7 @@ using namespace std;
 #include "cache.hpp"
 #include "request.hpp"
 #include "feature.hpp"
+#include "profile.h"
 
 class CacheEmu
 {
@@ -16,6 +19,8 @@ protected:
     Cache cache;
     FeatureManager feature_manager;
     RequestLoader *loader = nullptr;
+    SliceRing slice_ring;  //最近读取的时间片，流式读取时只有这些请求在内存中
+    Profiler profiler;     //各阶段的计时与计数，默认关闭
 
     //用于记录已经处理的请求数以及其中命中的次数
     int request_cnt = 0, hit_cnt = 0;
@@ -30,18 +35,40 @@ protected:
 
     //缓冲区，用于保存用于返回的结果
     ContentVector step_buf;
+    ContentVector selected_buf;
     ContentVector candidate_buf;
     FloatVector candidate_frequency_buf;
 
+    //增量观测：自上次增量观测以来内容被替换的缓存位置
+    vector<uint8_t> row_marks;
+    IntVector dirty_rows;
+    ContentVector delta_buf;
+
+    inline void mark_row(int row)
+    {
+        if (row < 0) {
+            return;
+        }
+        if (row_marks.size() < (size_t) capacity) {
+            row_marks.resize(capacity, 0);
+        }
+        if (!row_marks[row]) {
+            row_marks[row] = 1;
+            dirty_rows.push_back(row);
+        }
+    }
+
 public:
     explicit CacheEmu(int capacity, RequestLoader *loader)
-            : cache(capacity), feature_manager()
+            : cache(capacity), feature_manager(), slice_ring(loader)
     {
         this->capacity = capacity;
         this->loader = loader;
     }
 
-    void reset()
+    virtual ~CacheEmu() = default;
+
+    virtual void reset()
     {
         if (DEBUG) {
             cout << "CacheEmu reset." << endl;
@@ -57,16 +84,15 @@ public:
 
         this->cache.reset();
         this->feature_manager.reset();
+        this->slice_ring.reset();
 
         candidate_buf.resize(0);
         for (auto e: *cache.get_contents()) {
             candidate_buf.push_back(e);
         }
 
-        candidate_frequency_buf.resize(0);
-        for (auto e: *this->cache.get_frequencies(&candidate_buf)) {
-            candidate_frequency_buf.push_back(e);
-        }
+        candidate_frequency_buf.resize(candidate_buf.size());
+        this->cache.get_frequencies(&candidate_buf, candidate_frequency_buf.data());
         this->cache.clear_frequencies();
     }
 
@@ -74,33 +100,45 @@ public:
     //使用id特征
     void use_id_feature()
     {
-        this->feature_manager.add_feature_extractor(new IdFeatureExtractor());
+        this->feature_manager.add_feature_extractor(new IdFeatureExtractor(this->loader));
     }
 
     //使用lfu特征
     void use_lfu_feature()
     {
-        //this->feature_manager.add_feature_extractor(new LfuFeatureExtractor());
-        this->feature_manager.add_feature_extractor(new OgdLfuFeatureExtractor(this->capacity));
+        //this->feature_manager.add_feature_extractor(new LfuFeatureExtractor(this->loader));
+        this->feature_manager.add_feature_extractor(new OgdLfuFeatureExtractor(this->capacity, this->loader));
     }
 
     //使用lru特征
     void use_lru_feature()
     {
-        //this->feature_manager.add_feature_extractor(new LruFeatureExtractor());
-        this->feature_manager.add_feature_extractor(new OgdLruFeatureExtractor(this->capacity));
+        //this->feature_manager.add_feature_extractor(new LruFeatureExtractor(this->loader));
+        this->feature_manager.add_feature_extractor(new OgdLruFeatureExtractor(this->capacity, this->loader));
     }
 
     //使用ogd_optimal特征
     void use_ogd_opt_feature()
     {
-        this->feature_manager.add_feature_extractor(new OgdOptimalFeatureExtractor(this->capacity));
+        this->feature_manager.add_feature_extractor(new OgdOptimalFeatureExtractor(this->capacity, this->loader));
     }
 
     //使用带滑动窗口的LFU特征
     void use_swlfu_feature(size_t history_sw_len)
     {
-        this->feature_manager.add_feature_extractor(new SWLfuFeatureExtractor(history_sw_len, this->loader));
+        this->feature_manager.add_feature_extractor(new SWLfuFeatureExtractor(history_sw_len, this->loader, &this->slice_ring));
+    }
+
+    //使用多个窗口长度的滑动窗口LFU特征，一次扫描更新所有窗口，每个窗口对应一维特征
+    void use_multi_swlfu_feature(const vector<int> &history_sw_lens)
+    {
+        this->feature_manager.add_feature_extractor(new MultiSWLfuFeatureExtractor(history_sw_lens, this->loader, &this->slice_ring));
+    }
+
+    //使用到下一次被请求的距离特征（离线，用于模仿学习）
+    void use_next_use_feature()
+    {
+        this->feature_manager.add_feature_extractor(new NextUseFeatureExtractor(this->loader));
     }
 
     //返回特征维度大小
@@ -112,12 +150,22 @@ public:
     //获取特征
     inline Feature get_features(ContentVector &v)
     {
+        ProfileScope scope(this->profiler, PhaseGetFeatures);
         return this->feature_manager.get_features(v);
     }
 
+    //获取按列排列的特征，形状为[feature_dims, v.size()]
+    inline Feature get_features_columns(ContentVector &v)
+    {
+        ProfileScope scope(this->profiler, PhaseGetFeatures);
+        return this->feature_manager.get_features_columns(v);
+    }
+
     //更新缓存内容
     inline void update_cache(ContentType *es, size_t size)
     {
+        ProfileScope scope(this->profiler, PhaseUpdateCache);
+
         s_buf_old.clear();
         s_buf_new.clear();
 
@@ -151,6 +199,144 @@ public:
             cache.replace(*it2, NoneContentType);
             it2++;
         }
+
+        if (this->feature_manager.is_tracking_dirty()) {
+            for (auto e: s_buf_new) {
+                this->mark_row(this->cache.find(e));
+            }
+        }
+    }
+
+    //将当前的候选内容（原始ID）、候选内容频率与特征直接写入调用者的内存，空位填充-1或0，返回写入的候选内容数
+    inline size_t observe(ContentType *candidates, float *frequencies, FeatureType *features, size_t max_candidates)
+    {
+        auto size = std::min(candidate_buf.size(), max_candidates);
+        auto f_dims = this->feature_dims();
+
+        for (size_t i = 0; i < max_candidates; i++) {
+            candidates[i] = i < size ? this->loader->to_raw(candidate_buf[i]) : NoneContentType;
+            frequencies[i] = i < size && i < candidate_frequency_buf.size() ? candidate_frequency_buf[i] : 0;
+        }
+
+        auto cycles = this->profiler.begin();
+        this->feature_manager.write_features(candidate_buf, size, features);
+        this->profiler.end(PhaseGetFeatures, cycles);
+        std::fill(features + size * f_dims, features + max_candidates * f_dims, 0);
+
+        return size;
+    }
+
+    /**
+     * 增量观测：只写入自上次增量观测以来可能变化的候选内容行，首次调用或重置后写入所有行。
+     * 缓存位置上的行在内容被替换、或内容被请求以及特征以其他方式变化时写入，之后的（发生miss的）行总是写入。
+     * 特征以原始值与每一维的变换参数给出：特征 = (float) ((raw + offset) * scale / divisor)，
+     * 未写入的行的原始值不变、命中次数为0。开销只与时间片大小和被替换的内容数有关，与缓存容量无关
+     * @param rows          输出变化的行号，升序 [max_candidates]
+     * @param candidates    输出这些行的候选内容（原始ID） [max_candidates]
+     * @param frequencies   输出这些行的命中次数 [max_candidates]
+     * @param raw_features  输出这些行的原始特征 [max_candidates, feature_dims]
+     * @param offsets       输出每一维的变换参数 [feature_dims]，scales与divisors相同
+     * @param num_rows      输出变化的行数
+     * @return  候选内容数
+     */
+    inline size_t observe_delta(int32_t *rows, ContentType *candidates, float *frequencies, double *raw_features,
+                                double *offsets, double *scales, double *divisors, size_t max_candidates,
+                                size_t &num_rows)
+    {
+        ProfileScope scope(this->profiler, PhaseGetFeatures);
+        if (!this->feature_manager.is_tracking_dirty()) {
+            this->feature_manager.enable_dirty_tracking();
+        }
+
+        auto size = std::min(candidate_buf.size(), max_candidates);
+        auto num_cache_rows = std::min(this->cache.get_contents()->size(), size);
+        auto &dirty = this->feature_manager.get_dirty_contents();
+
+        num_rows = 0;
+        if (dirty.is_all()) {
+            for (size_t i = 0; i < size; i++) {
+                rows[num_rows++] = (int32_t) i;
+            }
+        }
+        else {
+            for (auto e: dirty.get_contents()) {
+                this->mark_row(this->cache.find(e));
+            }
+            std::sort(dirty_rows.begin(), dirty_rows.end());
+            for (auto row: dirty_rows) {
+                if ((size_t) row < num_cache_rows) {
+                    rows[num_rows++] = row;
+                }
+            }
+            for (auto i = num_cache_rows; i < size; i++) {
+                rows[num_rows++] = (int32_t) i;
+            }
+        }
+        for (auto row: dirty_rows) {
+            row_marks[row] = 0;
+        }
+        dirty_rows.resize(0);
+
+        delta_buf.resize(num_rows);
+        for (size_t k = 0; k < num_rows; k++) {
+            auto row = rows[k];
+            delta_buf[k] = candidate_buf[row];
+            candidates[k] = this->loader->to_raw(candidate_buf[row]);
+            frequencies[k] = (size_t) row < candidate_frequency_buf.size() ? candidate_frequency_buf[row] : 0;
+        }
+        this->feature_manager.write_raw_features(delta_buf.data(), num_rows, raw_features);
+        this->feature_manager.get_feature_transform(offsets, scales, divisors);
+        this->feature_manager.clear_dirty_contents(this->loader->get_num_contents());
+
+        return size;
+    }
+
+    //计算候选内容在本步中的请求次数：前num_cache_rows个候选内容为缓存内容，只查找本步被请求的内容，
+    //开销与请求数成正比，与缓存容量无关
+    inline void update_candidate_frequencies(size_t num_cache_rows)
+    {
+        candidate_frequency_buf.assign(candidate_buf.size(), 0);
+        for (auto e: step_buf) {
+            auto pos = this->cache.find(e);
+            if (pos >= 0 && (size_t) pos < num_cache_rows) {
+                candidate_frequency_buf[pos]++;
+            }
+        }
+        for (auto i = num_cache_rows; i < candidate_buf.size(); i++) {
+            candidate_frequency_buf[i] = this->cache.get_frequency(candidate_buf[i]);
+        }
+        this->cache.clear_frequencies();
+    }
+
+    //根据动作掩码更新缓存内容，掩码非零的候选内容将被缓存，超出缓存容量的部分被忽略
+    inline void update_cache_by_mask(const uint8_t *mask, size_t size)
+    {
+        selected_buf.resize(0);
+        for (size_t i = 0; i < size && i < candidate_buf.size() && selected_buf.size() < (size_t) capacity; i++) {
+            if (mask[i]) {
+                selected_buf.push_back(candidate_buf[i]);
+            }
+        }
+        this->update_cache(selected_buf.data(), selected_buf.size());
+    }
+
+    //开启或关闭各阶段的计时与Cache哈希表的探测统计，开启时清空已有的结果
+    void set_profiling(bool enabled)
+    {
+        this->profiler.set_enabled(enabled);
+        this->cache.set_probe_stats(this->profiler.probe_stats());
+    }
+
+    //清空计时与计数结果
+    void clear_profile_stats()
+    {
+        this->profiler.clear();
+    }
+
+    //获取计时与计数结果
+    inline ProfileStats get_profile_stats() const
+    {
+        return this->profiler.get_stats();
     }
 
     //获取总时间片数
@@ -165,6 +351,12 @@ public:
         return this->i_slice;
     }
 
+    //流式读取时常驻内存的请求数
+    inline size_t get_num_resident_requests() const
+    {
+        return this->slice_ring.get_num_resident_requests();
+    }
+
     //获取平均命中率
     inline float get_mean_hit_rate()
     {
@@ -185,7 +377,7 @@ public:
     }
 
     //获取当前缓存中的内容
-    ContentVector *get_cache_contents()
+    virtual ContentVector *get_cache_contents()
     {
         auto contents = this->cache.get_contents();
         if (VERBOSE) {
@@ -255,14 +447,16 @@ public:
         missed_content_set.clear();
         step_buf.resize(0);
 
-        auto slice_range_ptrs = loader->get_slice_range_ptrs(this->i_slice);
-        auto slice = loader->get_slice(slice_range_ptrs.first, slice_range_ptrs.second);
+        auto cycles = profiler.begin();
+        auto slice = slice_ring.get(this->i_slice);
         this->i_slice++;  //步计数增一
+        profiler.end(PhaseSliceFetch, cycles);
 
         if (VERBOSE) {
             cout << "step " << i_slice << ":" << slice << endl;
         }
 
+        cycles = profiler.begin();
         for (size_t i = 0; i < slice.size; i++) {
             auto r = slice.data[i];
             step_buf.push_back(r.content_id);
@@ -277,25 +471,24 @@ public:
         }
         this->request_cnt += slice.size;
         this->episode_request_cnt += slice.size;
+        profiler.end(PhaseHitTest, cycles);
 
+        cycles = profiler.begin();
         this->feature_manager.update(slice);
+        profiler.end(PhaseFeatureUpdate, cycles);
 
         //生成candidates及其对应的频率
-        candidate_buf.resize(0);
-
-        for (auto e: *cache.get_contents()) {
-            candidate_buf.push_back(e);
-        }
+        cycles = profiler.begin();
+        auto cache_contents = cache.get_contents();
+        candidate_buf.assign(cache_contents->begin(), cache_contents->end());
 
+        auto num_cache_rows = candidate_buf.size();
         for (auto e: missed_content_set) {
             candidate_buf.push_back(e);
         }
 
-        candidate_frequency_buf.resize(0);
-        for (auto e: *this->cache.get_frequencies(&candidate_buf)) {
-            candidate_frequency_buf.push_back(e);
-        }
-        this->cache.clear_frequencies();
+        this->update_candidate_frequencies(num_cache_rows);
+        profiler.end(PhaseCandidates, cycles);
 
         return {slice.size, missed_content_set.size(), 0};
     }
@@ -306,6 +499,9 @@ class PassiveCacheEmu : public CacheEmu
 private:
     Slice slice, slice_processed;
 
+    //step_until_miss中累计的候选内容命中次数
+    FloatVector reward_buf;
+
 public:
     PassiveCacheEmu(int capacity, RequestLoader *loader) : CacheEmu(capacity, loader) {}
 
@@ -314,16 +510,18 @@ public:
         step_buf.resize(0);
         ContentType missed_element = NoneContentType;
 
+        auto cycles = profiler.begin();
         if (slice.size == 0) {
-            auto slice_range_ptrs = loader->get_slice_range_ptrs(this->i_slice);
-            this->slice = loader->get_slice(slice_range_ptrs.first, slice_range_ptrs.second);
+            this->slice = slice_ring.get(this->i_slice);
             this->i_slice++;
         }
+        profiler.end(PhaseSliceFetch, cycles);
 
         if (VERBOSE) {
             cout << "Slice " << this->i_slice << ": " << slice << endl;
         }
 
+        cycles = profiler.begin();
         int idx = 0;
         while (idx < slice.size) {
             auto r = slice.data[idx];
@@ -345,27 +543,235 @@ public:
 
         this->request_cnt += this->slice_processed.size;
         this->episode_request_cnt += this->slice_processed.size;
+        profiler.end(PhaseHitTest, cycles);
+
+        cycles = profiler.begin();
         this->feature_manager.update(this->slice_processed);
+        profiler.end(PhaseFeatureUpdate, cycles);
 
         //生成candidates及其对应的频率
-        candidate_buf.resize(0);
-        for (auto &e: *cache.get_contents()) {
-            candidate_buf.push_back(e);
-        }
+        cycles = profiler.begin();
+        auto cache_contents = cache.get_contents();
+        candidate_buf.assign(cache_contents->begin(), cache_contents->end());
 
+        auto num_cache_rows = candidate_buf.size();
         if (missed_element != NoneContentType) {
             candidate_buf.push_back(missed_element);
         }
 
-        candidate_frequency_buf.resize(0);
-        for (auto &e: *this->cache.get_frequencies(&candidate_buf)) {
-            candidate_frequency_buf.push_back(e);
-        }
-        this->cache.clear_frequencies();
+        this->update_candidate_frequencies(num_cache_rows);
         while (candidate_frequency_buf.size() < this->capacity + 1) {
             candidate_frequency_buf.push_back(0);
         }
+        profiler.end(PhaseCandidates, cycles);
 
         return {slice_processed.size, missed_element != NoneContentType, slice.size};
     }
-};
\ No newline at end of file
+
+    /**
+     * 连续调用step，跨越时间片边界，直到发生miss或处理完所有请求。
+     * 各次step的候选内容命中次数按位置累加，结束后通过get_candidate_frequencies获取
+     * @return  (处理的请求数, 是否发生miss, 跨越的时间片边界数)
+     */
+    Triple step_until_miss()
+    {
+        size_t num_processed = 0, num_slices_crossed = 0, missed = 0;
+
+        reward_buf.assign(this->capacity + 1, 0);
+        do {
+            auto res = this->step();
+            num_processed += res.first;
+            missed = res.second;
+            num_slices_crossed += res.third == 0;
+
+            //未发生miss时缓存内容不变，各次step的候选内容位置一致
+            for (size_t i = 0; i < candidate_frequency_buf.size() && i < reward_buf.size(); i++) {
+                reward_buf[i] += candidate_frequency_buf[i];
+            }
+        } while (missed == 0 && !this->finished());
+
+        candidate_frequency_buf.swap(reward_buf);
+
+        return {num_processed, missed, num_slices_crossed};
+    }
+};
+
+/**
+ * 使用固定替换策略的模拟器，每一步在C++中处理一个时间片的全部请求，不需要外部决策，
+ * 用于计算LRU等传统策略的基线。不更新特征，也不生成候选内容
+ */
+class PolicyCacheEmu : public CacheEmu
+{
+protected:
+    //每个时间片的命中率
+    FloatVector slice_hit_rates;
+
+public:
+    PolicyCacheEmu(int capacity, RequestLoader *loader) : CacheEmu(capacity, loader) {}
+
+    void reset() override
+    {
+        CacheEmu::reset();
+        this->slice_hit_rates.resize(0);
+
+        //没有候选内容
+        candidate_buf.resize(0);
+        candidate_frequency_buf.resize(0);
+    }
+
+    //处理剩余的所有时间片，返回处理的请求数
+    size_t run()
+    {
+        size_t num_requests = 0;
+        while (!this->finished()) {
+            num_requests += this->step().first;
+        }
+        return num_requests;
+    }
+
+    //获取已处理的每个时间片的命中率
+    inline FloatVector *get_slice_hit_rates()
+    {
+        return &this->slice_hit_rates;
+    }
+};
+
+template<class Policy>
+class TypedPolicyCacheEmu : public PolicyCacheEmu
+{
+private:
+    PolicyCache<Policy> policy_cache;
+    ContentVector contents_buf;
+
+public:
+    //策略的状态按内容数量分配，创建前需要先加载数据集
+    TypedPolicyCacheEmu(int capacity, RequestLoader *loader)
+            : PolicyCacheEmu(capacity, loader), policy_cache(capacity)
+    {
+        this->policy_cache.reset(loader->get_num_contents());
+    }
+
+    void reset() override
+    {
+        PolicyCacheEmu::reset();
+        this->policy_cache.reset(this->loader->get_num_contents());
+    }
+
+    Triple step() override
+    {
+        step_buf.resize(0);
+
+        auto cycles = profiler.begin();
+        auto slice = slice_ring.get(this->i_slice);
+        this->i_slice++;
+        profiler.end(PhaseSliceFetch, cycles);
+
+        cycles = profiler.begin();
+        auto num_hits = this->policy_cache.access(slice.data, slice.size);
+        profiler.end(PhaseHitTest, cycles);
+        this->hit_cnt += num_hits;
+        this->episode_hit_cnt += num_hits;
+        this->request_cnt += slice.size;
+        this->episode_request_cnt += slice.size;
+        this->slice_hit_rates.push_back((float) num_hits / (slice.size + EPS));
+
+        if (VERBOSE) {
+            cout << "step " << i_slice << ": " << num_hits << "/" << slice.size << " hits" << endl;
+        }
+
+        return {slice.size, slice.size - num_hits, 0};
+    }
+
+    ContentVector *get_cache_contents() override
+    {
+        this->policy_cache.get_contents(this->contents_buf);
+        return &this->contents_buf;
+    }
+};
+
+/**
+ * 使用Belady最优替换的模拟器，基于loader的下一次使用索引，得到给定容量下命中率的上界
+ */
+class BeladyCacheEmu : public PolicyCacheEmu
+{
+private:
+    BeladyCache belady_cache;
+    ContentVector contents_buf;
+
+public:
+    //下一次使用索引在创建时建立，需要先加载数据集
+    BeladyCacheEmu(int capacity, RequestLoader *loader) : PolicyCacheEmu(capacity, loader), belady_cache(capacity)
+    {
+        this->loader->build_next_use_index();
+        this->belady_cache.reset(loader->get_num_contents());
+    }
+
+    void reset() override
+    {
+        PolicyCacheEmu::reset();
+        this->loader->build_next_use_index();
+        this->belady_cache.reset(this->loader->get_num_contents());
+    }
+
+    Triple step() override
+    {
+        step_buf.resize(0);
+
+        auto cycles = profiler.begin();
+        auto ptr_beg = this->loader->get_slice_range_ptrs(this->i_slice).first;
+        auto slice = slice_ring.get(this->i_slice);
+        this->i_slice++;
+        profiler.end(PhaseSliceFetch, cycles);
+
+        cycles = profiler.begin();
+        size_t num_hits = 0;
+        for (size_t i = 0; i < slice.size; i++) {
+            num_hits += this->belady_cache.access(slice.data[i].content_id, this->loader->get_next_use(ptr_beg + i));
+        }
+        profiler.end(PhaseHitTest, cycles);
+
+        this->hit_cnt += num_hits;
+        this->episode_hit_cnt += num_hits;
+        this->request_cnt += slice.size;
+        this->episode_request_cnt += slice.size;
+        this->slice_hit_rates.push_back((float) num_hits / (slice.size + EPS));
+
+        return {slice.size, slice.size - num_hits, 0};
+    }
+
+    ContentVector *get_cache_contents() override
+    {
+        this->belady_cache.get_contents(this->contents_buf);
+        return &this->contents_buf;
+    }
+};
+
+//根据策略名（lru、lfu、fifo、arc、2q、lirs、s3fifo、belady）创建模拟器，策略名无效时返回nullptr
+inline PolicyCacheEmu *new_policy_cache_emu(const string &policy, int capacity, RequestLoader *loader)
+{
+    if (policy == "lru") {
+        return new TypedPolicyCacheEmu<LruPolicy>(capacity, loader);
+    }
+    if (policy == "lfu") {
+        return new TypedPolicyCacheEmu<LfuPolicy>(capacity, loader);
+    }
+    if (policy == "fifo") {
+        return new TypedPolicyCacheEmu<FifoPolicy>(capacity, loader);
+    }
+    if (policy == "arc") {
+        return new TypedPolicyCacheEmu<ArcPolicy>(capacity, loader);
+    }
+    if (policy == "2q") {
+        return new TypedPolicyCacheEmu<TwoQPolicy>(capacity, loader);
+    }
+    if (policy == "lirs") {
+        return new TypedPolicyCacheEmu<LirsPolicy>(capacity, loader);
+    }
+    if (policy == "s3fifo") {
+        return new TypedPolicyCacheEmu<S3FifoPolicy>(capacity, loader);
+    }
+    if (policy == "belady") {
+        return new BeladyCacheEmu(capacity, loader);
+    }
+    return nullptr;
+}
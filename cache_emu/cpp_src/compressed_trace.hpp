@@ -0,0 +1,395 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "utils.h"
+#include "trace_file.hpp"
+
+/**
+ * 按块压缩的请求序列，每块block_size个请求，块内逐个请求交替存放：
+ *   varint(zigzag(时间戳 - 上一个请求的时间戳))  块内第一个请求相对块的起始时间戳
+ *   varint(内容编码)                              内容按请求次数降序编码，热门内容只占1个字节
+ * 块索引记录每块的字节偏移量与起始时间戳，因此可以从任意一块开始解码
+ */
+class CompressedTrace
+{
+private:
+    struct Block
+    {
+        uint64_t offset;                //块在data中的字节偏移量
+        TimestampType first_timestamp;  //块内第一个请求的时间戳
+        uint32_t padding;
+    };
+
+    size_t num_requests = 0;
+    size_t block_size = DefaultBlockSize;
+
+    ContentVector dense_to_raw;   //稠密ID到原始ID的映射
+    ContentVector code_to_dense;  //内容编码到稠密ID的映射
+    vector<Block> blocks;
+    vector<uint8_t> data;
+
+    static inline void put_varint(vector<uint8_t> &out, uint64_t v)
+    {
+        while (v >= 0x80) {
+            out.push_back((uint8_t) (v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((uint8_t) v);
+    }
+
+    static inline uint64_t get_varint(const uint8_t *&p)
+    {
+        //大部分编码只有1个字节
+        uint64_t v = *p++;
+        if (v < 0x80) {
+            return v;
+        }
+        v &= 0x7F;
+        for (int shift = 7;; shift += 7) {
+            uint64_t b = *p++;
+            v |= (b & 0x7F) << shift;
+            if (b < 0x80) {
+                return v;
+            }
+        }
+    }
+
+    //带边界检查的get_varint，用于读入文件时校验数据，编码越过end或超过10个字节时返回false
+    static inline bool get_varint_checked(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 70 && p < end; shift += 7) {
+            uint64_t b = *p++;
+            v |= (b & 0x7F) << shift;
+            if (b < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static inline uint64_t zigzag(int64_t v)
+    {
+        return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+    }
+
+    static inline int64_t unzigzag(uint64_t v)
+    {
+        return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+    }
+
+public:
+    static constexpr size_t DefaultBlockSize = 256;
+
+    //顺序解码时的位置，按时间片依次读取时从上一次结束的位置继续解码，不必跳过块内已读的请求
+    struct Cursor
+    {
+        size_t next = SIZE_MAX;    //下一个请求的序号
+        size_t offset = 0;         //下一个请求在data中的字节偏移量
+        int64_t timestamp = 0;     //上一个请求的时间戳
+    };
+
+    //分块读取未压缩请求的函数：读取第beg个请求开始的size个请求
+    typedef function<void(size_t beg, size_t size, Request *out)> RequestReader;
+
+    /**
+     * 压缩请求序列，请求分两遍读取：第一遍统计内容的请求次数，第二遍编码
+     * @param num_requests  请求数量
+     * @param dense_to_raw  稠密ID到原始ID的映射，其长度即内容数量
+     * @param reader        读取未压缩请求的函数
+     */
+    void encode(size_t num_requests, const ContentVector &dense_to_raw, const RequestReader &reader,
+                size_t block_size = DefaultBlockSize)
+    {
+        this->num_requests = num_requests;
+        this->block_size = std::max(block_size, (size_t) 1);
+        this->dense_to_raw = dense_to_raw;
+
+        auto num_contents = dense_to_raw.size();
+        vector<Request> chunk(std::max(this->block_size, (size_t) 1 << 16) / this->block_size * this->block_size);
+
+        //按请求次数降序为内容编码，次数相同时稠密ID小的在前
+        vector<uint64_t> counts(num_contents, 0);
+        for (size_t beg = 0; beg < num_requests; beg += chunk.size()) {
+            auto size = std::min(chunk.size(), num_requests - beg);
+            reader(beg, size, chunk.data());
+            for (size_t i = 0; i < size; i++) {
+                counts[chunk[i].content_id]++;
+            }
+        }
+
+        code_to_dense.resize(num_contents);
+        std::iota(code_to_dense.begin(), code_to_dense.end(), 0);
+        std::stable_sort(code_to_dense.begin(), code_to_dense.end(), [&](ContentType a, ContentType b) {
+            return counts[a] > counts[b];
+        });
+
+        ContentVector dense_to_code(num_contents);
+        for (size_t code = 0; code < num_contents; code++) {
+            dense_to_code[code_to_dense[code]] = (ContentType) code;
+        }
+
+        blocks.clear();
+        data.clear();
+        for (size_t beg = 0; beg < num_requests; beg += chunk.size()) {
+            auto size = std::min(chunk.size(), num_requests - beg);
+            reader(beg, size, chunk.data());
+
+            for (size_t i = 0; i < size; i++) {
+                if ((beg + i) % this->block_size == 0) {
+                    blocks.push_back({data.size(), chunk[i].timestamp, 0});
+                }
+                auto prev = (beg + i) % this->block_size == 0 ? chunk[i].timestamp : chunk[i - 1].timestamp;
+                put_varint(data, zigzag((int64_t) chunk[i].timestamp - prev));
+                put_varint(data, (uint64_t) dense_to_code[chunk[i].content_id]);
+            }
+        }
+        data.shrink_to_fit();
+    }
+
+    //解码第beg个请求开始的size个请求，cursor不为空时从其位置继续解码并在结束后更新
+    void decode(size_t beg, size_t size, Request *out, Cursor *cursor = nullptr) const
+    {
+        ASSERT(beg + size <= num_requests);
+
+        auto end = beg + size;
+        const uint8_t *p = nullptr;
+        int64_t t = 0;
+        for (auto i_block = beg / block_size; beg < end; i_block++) {
+            auto block_beg = i_block * block_size;
+            auto block_end = std::min(block_beg + block_size, num_requests);
+
+            if (cursor != nullptr && cursor->next == beg && beg != block_beg) {
+                p = data.data() + cursor->offset;
+                t = cursor->timestamp;
+            }
+            else {
+                p = data.data() + blocks[i_block].offset;
+                t = blocks[i_block].first_timestamp;
+
+                //跳过块内beg之前的请求
+                for (auto i = block_beg; i < beg; i++) {
+                    t += unzigzag(get_varint(p));
+                    get_varint(p);
+                }
+            }
+
+            for (auto i = beg; i < block_end && i < end; i++) {
+                t += unzigzag(get_varint(p));
+                *out++ = {code_to_dense[get_varint(p)], (TimestampType) t};
+            }
+            beg = std::min(block_end, end);
+        }
+
+        if (cursor != nullptr && p != nullptr) {
+            cursor->next = end;
+            cursor->offset = p - data.data();
+            cursor->timestamp = t;
+        }
+    }
+
+    inline size_t get_num_requests() const
+    {
+        return num_requests;
+    }
+
+    inline const ContentVector &get_dense_to_raw() const
+    {
+        return dense_to_raw;
+    }
+
+    //压缩后占用的字节数
+    inline size_t get_num_bytes() const
+    {
+        return data.size() + blocks.size() * sizeof(Block)
+               + (code_to_dense.size() + dense_to_raw.size()) * sizeof(ContentType);
+    }
+
+    //写入文件，成功时返回true
+    bool write(const char *path) const
+    {
+        FILE *f = fopen(path, "wb");
+        if (f == nullptr) {
+            return false;
+        }
+
+        CompressedTraceHeader header{};
+        memcpy(header.magic, CompressedTraceMagic, sizeof(CompressedTraceMagic));
+        header.version = CompressedTraceVersion;
+        header.byte_order = TraceByteOrder;
+        header.block_size = block_size;
+        header.num_requests = num_requests;
+        header.num_contents = dense_to_raw.size();
+        header.num_blocks = blocks.size();
+        header.data_size = data.size();
+
+        auto write_all = [f](const auto &v) {
+            return v.empty() || fwrite(v.data(), sizeof(v[0]), v.size(), f) == v.size();
+        };
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+                  && write_all(dense_to_raw) && write_all(code_to_dense) && write_all(blocks) && write_all(data);
+
+        return fclose(f) == 0 && ok;
+    }
+
+    //从文件读入，返回空字符串表示成功，否则返回错误原因
+    string read(const char *path)
+    {
+        FILE *f = fopen(path, "rb");
+        if (f == nullptr) {
+            return "cannot open file";
+        }
+
+        CompressedTraceHeader header{};
+        string error;
+        struct stat st{};
+        if (fstat(fileno(f), &st) != 0) {
+            error = "cannot stat file";
+        }
+        else if (fread(&header, sizeof(header), 1, f) != 1) {
+            error = "file truncated";
+        }
+        else {
+            error = check_header(header, (size_t) st.st_size);
+        }
+
+        if (error.empty()) {
+            num_requests = header.num_requests;
+            block_size = header.block_size;
+            dense_to_raw.resize(header.num_contents);
+            code_to_dense.resize(header.num_contents);
+            blocks.resize(header.num_blocks);
+            data.resize(header.data_size);
+
+            auto read_all = [f](auto &v) {
+                return v.empty() || fread(v.data(), sizeof(v[0]), v.size(), f) == v.size();
+            };
+            if (!(read_all(dense_to_raw) && read_all(code_to_dense) && read_all(blocks) && read_all(data))) {
+                error = "file truncated";
+            }
+            else {
+                error = this->check_data();
+            }
+        }
+
+        fclose(f);
+        if (!error.empty()) {
+            *this = CompressedTrace();
+        }
+        return error;
+    }
+
+private:
+    struct CompressedTraceHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t block_size;
+        uint64_t num_requests;
+        uint64_t num_contents;
+        uint64_t num_blocks;
+        uint64_t data_size;
+    };
+
+    static constexpr char CompressedTraceMagic[8] = {'C', 'E', 'M', 'U', 'C', 'T', 'R', '\0'};
+    static constexpr uint32_t CompressedTraceVersion = 1;
+
+    //校验文件头，各部分的大小之和必须恰好等于文件大小，因此之后按文件头分配的内存不会超过文件大小
+    static string check_header(const CompressedTraceHeader &header, size_t file_size)
+    {
+        if (memcmp(header.magic, CompressedTraceMagic, sizeof(CompressedTraceMagic)) != 0) {
+            return "not a compressed trace file";
+        }
+        if (header.version != CompressedTraceVersion) {
+            return "unsupported version " + to_string(header.version);
+        }
+        if (header.byte_order != TraceByteOrder) {
+            return "byte order mismatch";
+        }
+        if (header.block_size == 0
+            || header.num_blocks != header.num_requests / header.block_size
+                                    + (header.num_requests % header.block_size != 0)) {
+            return "corrupted block index";
+        }
+        if (header.num_contents > (uint64_t) std::numeric_limits<ContentType>::max()) {
+            return "too many contents";
+        }
+        //逐项与剩余大小比较，避免乘法与加法溢出
+        auto rest = file_size - sizeof(CompressedTraceHeader);
+        auto take = [&rest](uint64_t count, size_t item_size) {
+            if (count > rest / item_size) {
+                return false;
+            }
+            rest -= count * item_size;
+            return true;
+        };
+        if (!(take(header.num_contents, 2 * sizeof(ContentType)) && take(header.num_blocks, sizeof(Block))
+              && take(header.data_size, 1))) {
+            return "file truncated";
+        }
+        if (rest != 0) {
+            return "file size mismatch";
+        }
+        return "";
+    }
+
+    //校验ID映射表、内容编码表、块索引与每块的编码，保证decode不会越界
+    string check_data() const
+    {
+        auto error = check_trace_dictionary(dense_to_raw.data(), dense_to_raw.size());
+        if (!error.empty()) {
+            return error;
+        }
+
+        auto num_contents = code_to_dense.size();
+        for (auto e: code_to_dense) {
+            if (e < 0 || (size_t) e >= num_contents) {
+                return "corrupted content codes";
+            }
+        }
+
+        for (size_t i_block = 0; i_block < blocks.size(); i_block++) {
+            auto block_end = i_block + 1 < blocks.size() ? blocks[i_block + 1].offset : (uint64_t) data.size();
+            //偏移量从0开始且不减
+            if ((i_block == 0 && blocks[0].offset != 0) || blocks[i_block].offset > block_end
+                || block_end > data.size()) {
+                return "corrupted block index";
+            }
+
+            //解码整块，编码必须恰好在下一块的起始位置结束，时间戳与内容编码不能越界
+            auto p = data.data() + blocks[i_block].offset, end = data.data() + block_end;
+            int64_t t = blocks[i_block].first_timestamp;
+            auto size = std::min(block_size, num_requests - i_block * block_size);
+            for (size_t i = 0; i < size; i++) {
+                uint64_t delta, code;
+                if (!get_varint_checked(p, end, delta) || !get_varint_checked(p, end, code) || code >= num_contents) {
+                    return "corrupted block " + to_string(i_block);
+                }
+                //两个32位时间戳之差不超过2^32，先检查差值以免相加溢出
+                auto d = unzigzag(delta);
+                if (d < -((int64_t) 1 << 32) || d > ((int64_t) 1 << 32)) {
+                    return "corrupted block " + to_string(i_block);
+                }
+                t += d;
+                if (t < std::numeric_limits<TimestampType>::min() || t > std::numeric_limits<TimestampType>::max()) {
+                    return "corrupted block " + to_string(i_block);
+                }
+            }
+            if (p != end) {
+                return "corrupted block " + to_string(i_block);
+            }
+        }
+        return "";
+    }
+};
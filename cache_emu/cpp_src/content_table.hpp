@@ -0,0 +1,423 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <new>
+
+using namespace std;
+
+#include "utils.h"
+#include "profile.h"
+
+/**
+ * 带世代标记的定长表，每个槽位记录写入时的世代，世代过期的槽位读出默认值，
+ * 因此清空整张表只需将世代加一，复杂度为O(1)
+ */
+template<typename T>
+class StampedVector
+{
+private:
+    struct Slot
+    {
+        uint32_t stamp;
+        T value;
+    };
+
+    vector<Slot> slots;
+    uint32_t generation = 1;
+    T default_value;
+
+public:
+    StampedVector(size_t size, T default_value) : slots(size, Slot{0, default_value}), default_value(default_value) {}
+
+    inline size_t size() const
+    {
+        return slots.size();
+    }
+
+    //读取槽位，过期的槽位返回默认值
+    inline T get(size_t i) const
+    {
+        return slots[i].stamp == generation ? slots[i].value : default_value;
+    }
+
+    //获取槽位的引用用于写入，过期的槽位先置为默认值
+    inline T &at(size_t i)
+    {
+        auto &slot = slots[i];
+        if (slot.stamp != generation) {
+            slot.stamp = generation;
+            slot.value = default_value;
+        }
+        return slot.value;
+    }
+
+    //槽位数组的起始地址，每个槽位依次为世代与值，供simd.hpp中的批量读取使用，要求T为32位
+    inline const uint32_t *raw_slots() const
+    {
+        static_assert(sizeof(Slot) == 2 * sizeof(uint32_t), "raw_slots requires a 32-bit value type");
+        return reinterpret_cast<const uint32_t *>(slots.data());
+    }
+
+    inline uint32_t get_generation() const
+    {
+        return generation;
+    }
+
+    inline T get_default_value() const
+    {
+        return default_value;
+    }
+
+    //清空所有槽位，并将表的长度调整为size
+    inline void reset(size_t size)
+    {
+        if (size != slots.size()) {
+            slots.resize(size, Slot{0, default_value});
+        }
+
+        generation++;
+        if (generation == 0) {
+            //世代溢出时才真正清空一次
+            for (auto &slot: slots) {
+                slot.stamp = 0;
+            }
+            generation = 1;
+        }
+    }
+};
+
+//按Align字节对齐分配内存的分配器，用于需要按缓存行对齐的vector
+template<typename T, size_t Align>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Align> other;
+    };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align> &) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Align> &) const
+    {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Align> &) const
+    {
+        return false;
+    }
+};
+
+/**
+ * 带世代标记的定长表，每行有width个int32_t计数与一个世代标记，按行连续存放，过期的行读出0。
+ * 每行占用的字数（世代加计数）向上取整到2的幂，且行数组按64字节对齐，width不超过15时一行总是落在同一缓存行中；
+ * width更大时每行按width + 1个字紧密存放，会跨越多个缓存行
+ */
+class StampedRows
+{
+private:
+    vector<uint32_t, AlignedAllocator<uint32_t, 64>> words;  //每行依次为世代与width个计数
+    size_t width, row_words, num_rows = 0;
+    uint32_t generation = 1;
+
+public:
+    explicit StampedRows(size_t width, size_t num_rows = 0) : width(width)
+    {
+        row_words = 1;
+        while (row_words < width + 1 && row_words < 16) {
+            row_words <<= 1;
+        }
+        row_words = std::max(row_words, width + 1);
+        this->reset(num_rows);
+    }
+
+    inline size_t size() const
+    {
+        return num_rows;
+    }
+
+    inline size_t get_width() const
+    {
+        return width;
+    }
+
+    //读取第i行的第j个计数，过期的行返回0
+    inline int32_t get(size_t i, size_t j) const
+    {
+        auto p = &words[i * row_words];
+        return p[0] == generation ? (int32_t) p[1 + j] : 0;
+    }
+
+    //获取第i行计数的起始地址用于写入，过期的行先清零
+    inline int32_t *row(size_t i)
+    {
+        auto p = &words[i * row_words];
+        if (p[0] != generation) {
+            p[0] = generation;
+            std::fill(p + 1, p + 1 + width, 0);
+        }
+        return reinterpret_cast<int32_t *>(p + 1);
+    }
+
+    //预取第i行，用于按请求序列随机访问各行时隐藏缓存未命中的延迟
+    inline void prefetch(size_t i) const
+    {
+        __builtin_prefetch(words.data() + i * row_words, 1);
+    }
+
+    //行数组的起始地址，每行占get_row_words()个字，第0个字为世代，供simd.hpp中的批量读取使用
+    inline const uint32_t *raw_slots() const
+    {
+        return words.data();
+    }
+
+    inline size_t get_row_words() const
+    {
+        return row_words;
+    }
+
+    inline uint32_t get_generation() const
+    {
+        return generation;
+    }
+
+    //清空所有行，并将表的行数调整为num_rows
+    inline void reset(size_t size)
+    {
+        if (size != num_rows) {
+            words.resize(size * row_words, 0);
+            num_rows = size;
+        }
+
+        generation++;
+        if (generation == 0) {
+            for (size_t i = 0; i < words.size(); i += row_words) {
+                words[i] = 0;
+            }
+            generation = 1;
+        }
+    }
+};
+
+//ContentTable中的一个槽位，同时保存内容在缓存中的位置与内容的命中次数
+struct ContentSlot
+{
+    ContentType key;
+    int32_t pos;      //内容在缓存中的位置，-1表示内容不在缓存中，EmptyPos表示空槽位
+    uint32_t freq;    //内容在stamp对应的步中被请求的次数
+    uint32_t stamp;   //freq所属的世代，与当前世代不同时freq视为0
+};
+
+/**
+ * 以ContentType为键的开放寻址哈希表（线性探测），
+ * 一次探测即可同时得到内容在缓存中的位置与命中次数。
+ * 命中次数带有世代标记，清除所有命中次数只需将世代加一；
+ * 不在缓存中且命中次数过期的槽位视为失效槽位，插入时复用，扩容时丢弃
+ */
+class ContentTable
+{
+private:
+    vector<ContentSlot> slots;
+    size_t mask = 0;
+    size_t num_used = 0;
+    int shift = 64;
+    uint32_t generation = 1;
+
+    //探测统计，为nullptr时不统计
+    ProfileStats *probe_stats = nullptr;
+
+    static constexpr size_t min_slots = 16;
+
+    //记录一次探测了n个槽位的查找
+    inline void record_probes(size_t n)
+    {
+        if (PROFILE && probe_stats != nullptr) {
+            probe_stats->num_lookups++;
+            probe_stats->num_probes += n;
+            probe_stats->num_collisions += n > 1;
+            probe_stats->max_probe_length = std::max(probe_stats->max_probe_length, (uint64_t) n);
+        }
+    }
+
+    inline bool alive(const ContentSlot &slot) const
+    {
+        return slot.pos != EmptyPos && (slot.pos != -1 || slot.stamp == generation);
+    }
+
+    inline size_t home(ContentType key) const
+    {
+        //Fibonacci哈希，使连续的ID也能均匀分布
+        return (size_t) (((uint64_t) (uint32_t) key * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    //重建哈希表，丢弃失效槽位
+    inline void rehash(size_t num_slots)
+    {
+        vector<ContentSlot> old_slots(num_slots, ContentSlot{NoneContentType, EmptyPos, 0, 0});
+        old_slots.swap(slots);
+        if (PROFILE && probe_stats != nullptr) {
+            probe_stats->num_rehashes++;
+        }
+
+        mask = num_slots - 1;
+        shift = 64;
+        for (size_t n = num_slots; n > 1; n >>= 1) {
+            shift--;
+        }
+
+        num_used = 0;
+        for (auto &slot: old_slots) {
+            if (alive(slot)) {
+                size_t i = home(slot.key);
+                while (slots[i].pos != EmptyPos) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+                num_used++;
+            }
+        }
+    }
+
+public:
+    static constexpr int32_t EmptyPos = -2;
+
+    explicit ContentTable(size_t expected_size = 0)
+    {
+        size_t num_slots = min_slots;
+        while (num_slots < 2 * expected_size) {
+            num_slots <<= 1;
+        }
+        rehash(num_slots);
+    }
+
+    //设置探测统计写入的位置，为nullptr时不统计
+    inline void set_probe_stats(ProfileStats *stats)
+    {
+        probe_stats = stats;
+    }
+
+    //已占用的槽位数，包括失效槽位
+    inline size_t size() const
+    {
+        return num_used;
+    }
+
+    //当前世代的命中次数
+    inline uint32_t get_freq(const ContentSlot *slot) const
+    {
+        return slot->stamp == generation ? slot->freq : 0;
+    }
+
+    //命中次数加一
+    inline void add_freq(ContentSlot *slot)
+    {
+        if (slot->stamp != generation) {
+            slot->stamp = generation;
+            slot->freq = 0;
+        }
+        slot->freq++;
+    }
+
+    //清除所有内容的命中次数
+    inline void clear_freqs()
+    {
+        generation++;
+        if (generation == 0) {
+            for (auto &slot: slots) {
+                slot.stamp = 0;
+            }
+            generation = 1;
+        }
+    }
+
+    //查找内容所在的槽位，不存在则返回nullptr
+    inline ContentSlot *find(ContentType key)
+    {
+        size_t i = home(key), n = 1;
+        while (slots[i].pos != EmptyPos) {
+            if (slots[i].key == key) {
+                record_probes(n);
+                return &slots[i];
+            }
+            i = (i + 1) & mask;
+            n++;
+        }
+        record_probes(n);
+        return nullptr;
+    }
+
+    //查找内容所在的槽位，不存在则插入一个不在缓存中、频率为0的槽位
+    inline ContentSlot *find_or_insert(ContentType key)
+    {
+        size_t i = home(key), n = 1;
+        ContentSlot *reusable = nullptr;  //探测路径上第一个失效槽位
+        while (slots[i].pos != EmptyPos) {
+            if (slots[i].key == key) {
+                record_probes(n);
+                return &slots[i];
+            }
+            if (reusable == nullptr && !alive(slots[i])) {
+                reusable = &slots[i];
+            }
+            i = (i + 1) & mask;
+            n++;
+        }
+        record_probes(n);
+
+        if (reusable != nullptr) {
+            *reusable = {key, -1, 0, 0};
+            return reusable;
+        }
+
+        //装载率保持在1/2以下，重建时丢弃失效槽位；
+        //重建后存活槽位不超过1/8，保证两次重建之间有足够多的插入来分摊重建的开销
+        if (2 * (num_used + 1) > slots.size()) {
+            size_t num_alive = 0;
+            for (auto &slot: slots) {
+                num_alive += alive(slot);
+            }
+            size_t num_slots = slots.size();
+            while (8 * (num_alive + 1) > num_slots) {
+                num_slots <<= 1;
+            }
+            rehash(num_slots);
+
+            i = home(key);
+            while (slots[i].pos != EmptyPos) {
+                i = (i + 1) & mask;
+            }
+        }
+
+        num_used++;
+        slots[i] = {key, -1, 0, 0};
+        return &slots[i];
+    }
+
+    inline void clear()
+    {
+        for (auto &slot: slots) {
+            slot.pos = EmptyPos;
+        }
+        num_used = 0;
+    }
+};
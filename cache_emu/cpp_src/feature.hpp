@@ -5,7 +5,10 @@
 #include <unordered_map>
 
 #include "utils.h"
+#include "buffer.h"
 #include "request.hpp"
+#include "content_table.hpp"
+#include "simd.hpp"
 
 using namespace std;
 
@@ -61,15 +64,84 @@ struct Feature
     }
 };
 
+/**
+ * 自上次增量观测以来特征可能发生变化的内容，按内容ID去重。
+ * 不在表中的内容被标记时退化为全部内容都发生变化
+ */
+class DirtyContents
+{
+private:
+    StampedVector<uint8_t> marks;
+    ContentVector contents;
+    bool all = true;
+
+public:
+    DirtyContents() : marks(0, 0) {}
+
+    //清空标记，表的长度调整为num_contents
+    inline void clear(size_t num_contents)
+    {
+        marks.reset(num_contents);
+        contents.resize(0);
+        all = false;
+    }
+
+    inline void mark(ContentType e)
+    {
+        if (e < 0 || (size_t) e >= marks.size()) {
+            all = true;
+            return;
+        }
+        auto &m = marks.at(e);
+        if (!m) {
+            m = 1;
+            contents.push_back(e);
+        }
+    }
+
+    inline void mark_all()
+    {
+        all = true;
+    }
+
+    inline bool is_all() const
+    {
+        return all;
+    }
+
+    inline const ContentVector &get_contents() const
+    {
+        return contents;
+    }
+};
+
 class FeatureExtractor
 {
 protected:
     size_t feature_dims;
     vector<FeatureType> f_buf;
+    DirtyContents *dirty = nullptr;  //为空时不记录变化的内容
+
+    //标记特征发生变化的内容，时间片中的内容已由FeatureManager标记，这里只需标记其他内容
+    inline void mark_dirty(ContentType e)
+    {
+        if (this->dirty != nullptr) {
+            this->dirty->mark(e);
+        }
+    }
+
+    inline void mark_all_dirty()
+    {
+        if (this->dirty != nullptr) {
+            this->dirty->mark_all();
+        }
+    }
 
 public:
     explicit FeatureExtractor(size_t _feature_dims) : feature_dims(_feature_dims) {}
 
+    virtual ~FeatureExtractor() = default;
+
     inline size_t get_feature_dims()
     {
         return this->feature_dims;
@@ -79,13 +151,73 @@ public:
 
     virtual void update(const Slice &s) = 0;
 
-    virtual Feature get_features(ContentVector &v) = 0;
+    /**
+     * 将前n个内容的特征直接写入out，第j个内容的第k维特征位于out[j * row_stride + k * dim_stride]。
+     * 按行排列时row_stride为总特征维度、dim_stride为1，按列排列时row_stride为1、dim_stride为内容数
+     */
+    virtual void write_features(const ContentType *v, size_t n, FeatureType *out,
+                                size_t row_stride, size_t dim_stride) = 0;
+
+    //提取特征，按行保存在f_buf中
+    Feature get_features(ContentVector &v)
+    {
+        f_buf.resize(v.size() * this->feature_dims);
+        this->write_features(v.data(), v.size(), f_buf.data(), this->feature_dims, 1);
+        return {f_buf.data(), v.size(), feature_dims};
+    }
+
+    inline void set_dirty_contents(DirtyContents *dirty_contents)
+    {
+        this->dirty = dirty_contents;
+    }
+
+    /**
+     * 增量观测：特征 = (float) ((raw + offset) * scale / divisor)，其中raw只与内容本身有关，
+     * 只在内容被标记时改变，offset、scale、divisor对所有内容相同。
+     * 返回false表示每一步所有内容的raw都可能改变，此时FeatureManager每步将所有内容标记为已变化
+     */
+    virtual bool has_stable_raw_features() const
+    {
+        return false;
+    }
+
+    //写入原始特征，第j个内容的第k维位于out[j * row_stride + k]；默认即特征本身
+    virtual void write_raw_features(const ContentType *v, size_t n, double *out, size_t row_stride)
+    {
+        f_buf.resize(n * this->feature_dims);
+        this->write_features(v, n, f_buf.data(), this->feature_dims, 1);
+        for (size_t j = 0; j < n; j++) {
+            for (size_t k = 0; k < this->feature_dims; k++) {
+                out[j * row_stride + k] = f_buf[j * this->feature_dims + k];
+            }
+        }
+    }
+
+    //写入每一维特征的变换参数；默认为恒等变换
+    virtual void get_feature_transform(double *offsets, double *scales, double *divisors)
+    {
+        for (size_t k = 0; k < this->feature_dims; k++) {
+            offsets[k] = 0;
+            scales[k] = 1;
+            divisors[k] = 1;
+        }
+    }
+
+protected:
+    //内容是否落在按内容数量分配的表中，数据集中不存在的内容（负ID）不在表中
+    static inline bool in_table(ContentType e, size_t table_size)
+    {
+        return e >= 0 && (size_t) e < table_size;
+    }
 };
 
 class IdFeatureExtractor : public FeatureExtractor
 {
+private:
+    RequestLoader *loader;
+
 public:
-    IdFeatureExtractor() : FeatureExtractor(1) {}
+    explicit IdFeatureExtractor(RequestLoader *loader) : FeatureExtractor(1), loader(loader) {}
 
     void reset() override
     {
@@ -96,27 +228,30 @@ public:
 
     void update(const Slice &s) override {}
 
-    Feature get_features(ContentVector &v) override
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t) override
     {
-        f_buf.resize(v.size() * this->feature_dims);
-
-        for (size_t i = 0; i < v.size(); i++) {
-            f_buf[i] = v[i];
+        for (size_t i = 0; i < n; i++) {
+            out[i * row_stride] = loader->to_raw(v[i]);
         }
+    }
 
-        return {f_buf.data(), v.size(), feature_dims};
+    bool has_stable_raw_features() const override
+    {
+        return true;
     }
 };
 
 class LruFeatureExtractor : public FeatureExtractor
 {
 private:
-    vector<TimestampType> W;  //用于每个内容最后访问的时间
+    StampedVector<TimestampType> W;  //用于每个内容最后访问的时间
 
     TimestampType latest_time = -1;
+    RequestLoader *loader;
 
 public:
-    LruFeatureExtractor() : FeatureExtractor(1), W(MAX_CONTENTS, -1) {}
+    explicit LruFeatureExtractor(RequestLoader *loader)
+            : FeatureExtractor(1), W(loader->get_num_contents(), -1), loader(loader) {}
 
     void reset() override
     {
@@ -124,9 +259,7 @@ public:
             cout << "LruFeatureExtractor reset." << endl;
         }
         latest_time = -1;
-        for (int i = 0; i < MAX_CONTENTS; i++) {
-            W[i] = -1;
-        }
+        W.reset(loader->get_num_contents());
     }
 
     void update(const Slice &s) override
@@ -134,86 +267,109 @@ public:
         for (size_t i = 0; i < s.size; i++) {
             auto cid = s.data[i].content_id;
             auto t = s.data[i].timestamp;
-            this->W[cid] = t;
+            this->W.at(cid) = t;
         }
         this->latest_time = s.data[s.size - 1].timestamp;
     }
 
-    Feature get_features(ContentVector &v) override
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t) override
     {
-        f_buf.resize(v.size() * this->feature_dims);
+        //特征为-(latest_time - t)，这里添加符号是为了让lru特征的顺序和lfu一致
+        gather_affine(W.raw_slots(), W.size(), W.get_generation(), W.get_default_value(), v, n,
+                      -latest_time, 1, out, row_stride);
+    }
 
-        for (size_t i = 0; i < v.size(); i++) {
-            //这里添加符号是为了让lru特征的顺序和lfu一致
-            f_buf[i] = -(latest_time - W[v[i]]);
+    //raw为最后访问时间，offset为-latest_time
+    bool has_stable_raw_features() const override
+    {
+        return true;
+    }
+
+    void write_raw_features(const ContentType *v, size_t n, double *out, size_t row_stride) override
+    {
+        for (size_t i = 0; i < n; i++) {
+            out[i * row_stride] = in_table(v[i], W.size()) ? W.get(v[i]) : W.get_default_value();
         }
+    }
 
-        return {f_buf.data(), v.size(), feature_dims};
+    void get_feature_transform(double *offsets, double *scales, double *divisors) override
+    {
+        offsets[0] = -latest_time;
+        scales[0] = 1;
+        divisors[0] = 1;
     }
 };
 
 class LfuFeatureExtractor : public FeatureExtractor
 {
 private:
-    IntVector W;  //用于每个内容被访问的次数
+    StampedVector<int32_t> W;  //用于每个内容被访问的次数
+    RequestLoader *loader;
 
 public:
-    LfuFeatureExtractor() : FeatureExtractor(1), W(MAX_CONTENTS, 0) {}
+    explicit LfuFeatureExtractor(RequestLoader *loader)
+            : FeatureExtractor(1), W(loader->get_num_contents(), 0), loader(loader) {}
 
     void reset() override
     {
         if (VERBOSE) {
             cout << "LfuFeatureExtractor reset." << endl;
         }
-        for (int i = 0; i < MAX_CONTENTS; i++) {
-            W[i] = 0;
-        }
+        W.reset(loader->get_num_contents());
     }
 
     void update(const Slice &s) override
     {
         for (size_t i = 0; i < s.size; i++) {
             auto cid = s.data[i].content_id;
-            this->W[cid]++;
+            this->W.at(cid)++;
         }
     }
 
-    Feature get_features(ContentVector &v) override
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t) override
     {
-        f_buf.resize(v.size() * this->feature_dims);
-
-        for (size_t i = 0; i < v.size(); i++) {
-            f_buf[i] = W[v[i]];
-        }
+        gather_affine(W.raw_slots(), W.size(), W.get_generation(), W.get_default_value(), v, n,
+                      0, 1, out, row_stride);
+    }
 
-        return {f_buf.data(), v.size(), feature_dims};
+    bool has_stable_raw_features() const override
+    {
+        return true;
     }
 };
 
 class SWLfuFeatureExtractor : public FeatureExtractor
 {
 private:
-    IntVector W;  //用于每个内容被访问的次数
+    StampedVector<int32_t> W;  //用于每个内容被访问的次数
     int history_w_len, history_num_requests;
     int i_slice = 0;
     RequestLoader *loader;
+    SliceRing *history;  //为空时直接从loader读取历史时间片
 
 private:
+    inline Slice get_history_slice(size_t i)
+    {
+        if (this->history != nullptr) {
+            return this->history->get(i);
+        }
+        auto range_ptr = loader->get_slice_range_ptrs(i);
+        return loader->get_slice(range_ptr.first, range_ptr.second);
+    }
 
-    inline void deque_expired_histories(TimestampType curr_timestamp)
+    inline void deque_expired_histories(int curr_i_slice)
     {
-        auto curr_i_slice = this->loader->get_i_slice_by_timestamp(curr_timestamp);
         if (curr_i_slice != this->i_slice && curr_i_slice > history_w_len) {
             auto i_slice_beg = std::max(this->i_slice - history_w_len, 0);
             auto i_slice_end = std::max(curr_i_slice - history_w_len, 0);
 
             for (; i_slice_beg < i_slice_end; i_slice_beg++) {
-                auto range_ptr = loader->get_slice_range_ptrs(i_slice_beg);
-                Slice history_slice = loader->get_slice(range_ptr.first, range_ptr.second);
+                Slice history_slice = this->get_history_slice(i_slice_beg);
 
                 for (size_t i = 0; i < history_slice.size; i++) {
                     auto cid = history_slice.data[i].content_id;
-                    this->W[cid]--;
+                    this->W.at(cid)--;
+                    this->mark_dirty(cid);
                 }
                 this->history_num_requests -= history_slice.size;
             }
@@ -223,11 +379,15 @@ private:
     }
 
 public:
-    SWLfuFeatureExtractor(int history_w_len, RequestLoader *loader)
-            : FeatureExtractor(1), W(MAX_CONTENTS, 0)
+    SWLfuFeatureExtractor(int history_w_len, RequestLoader *loader, SliceRing *history = nullptr)
+            : FeatureExtractor(1), W(loader->get_num_contents(), 0)
     {
         this->history_w_len = history_w_len;
         this->loader = loader;
+        this->history = history;
+        if (history != nullptr) {
+            history->reserve_history(history_w_len);
+        }
         this->i_slice = 0;
         this->history_num_requests = 0;
     }
@@ -239,9 +399,7 @@ public:
         }
         this->i_slice = 0;
         this->history_num_requests = 0;
-        for (int i = 0; i < MAX_CONTENTS; i++) {
-            W[i] = 0;
-        }
+        W.reset(loader->get_num_contents());
     }
 
     inline void update(const Slice &s) override
@@ -260,12 +418,12 @@ public:
         //更新参数
         for (size_t i = 0; i < s.size; i++) {
             auto r = s.data[i];
-            this->W[r.content_id]++;
+            this->W.at(r.content_id)++;
         }
         this->history_num_requests += s.size;
 
         if (s.size > 0) {
-            this->deque_expired_histories(s.get(-1).timestamp);
+            this->deque_expired_histories((int) s.i_slice);
         }
     }
 
@@ -273,88 +431,510 @@ public:
     {
         for (size_t i = 0; i < s.size; i++) {
             auto cid = s.data[i].content_id;
-            this->W[cid]++;
+            this->W.at(cid)++;
         }
         this->history_num_requests += s.size;
 
         if (i_slice >= history_w_len) {
-            auto range_ptr = loader->get_slice_range_ptrs(i_slice - history_w_len);
-            Slice history_slice = loader->get_slice(range_ptr.first, range_ptr.second);
+            Slice history_slice = this->get_history_slice(i_slice - history_w_len);
 
             for (size_t i = 0; i < history_slice.size; i++) {
                 auto cid = history_slice.data[i].content_id;
-                this->W[cid]--;
+                this->W.at(cid)--;
+                this->mark_dirty(cid);
             }
             this->history_num_requests -= history_slice.size;
         }
         i_slice++;
     }
 
-    Feature get_features(ContentVector &v) override
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t) override
     {
-        f_buf.resize(v.size() * this->feature_dims);
+        //窗口内的请求次数除以窗口内的请求数
+        gather_affine(W.raw_slots(), W.size(), W.get_generation(), W.get_default_value(), v, n,
+                      0, history_num_requests + EPS, out, row_stride);
+    }
 
-        for (size_t i = 0; i < v.size(); i++) {
-            f_buf[i] = (float) W[v[i]] / (history_num_requests + EPS);
+    //raw为窗口内的请求次数，divisor为窗口内的请求数，移出窗口的内容在deque_expired_histories中标记
+    bool has_stable_raw_features() const override
+    {
+        return true;
+    }
+
+    void write_raw_features(const ContentType *v, size_t n, double *out, size_t row_stride) override
+    {
+        for (size_t i = 0; i < n; i++) {
+            out[i * row_stride] = (float) (in_table(v[i], W.size()) ? W.get(v[i]) : 0);
         }
+    }
 
-        return {f_buf.data(), v.size(), feature_dims};
+    void get_feature_transform(double *offsets, double *scales, double *divisors) override
+    {
+        offsets[0] = 0;
+        scales[0] = 1;
+        divisors[0] = history_num_requests + EPS;
+    }
+};
+
+/**
+ * 多个窗口长度的SWLfu特征，第j维与SWLfuFeatureExtractor(w_lens[j])的特征逐位一致。
+ * 所有窗口的计数按内容交错存放在同一行中，每个请求只访问一次该行；
+ * 移出窗口时用一个共享的游标扫描各窗口待移出的时间片，每个时间片只读取一次
+ */
+class MultiSWLfuFeatureExtractor : public FeatureExtractor
+{
+private:
+    StampedRows W;  //第e行的第j个计数为内容e在第j个窗口内被访问的次数
+    static const size_t PrefetchDistance = 16;  //按请求顺序访问各行时提前预取的请求数
+    vector<int> history_w_lens, history_num_requests, i_slices;
+    vector<int> expire_begs, expire_ends;   //本次各窗口待移出的时间片范围，为空表示不移出
+    vector<size_t> expiring;                //覆盖当前时间片的窗口
+    RequestLoader *loader;
+    SliceRing *history;  //为空时直接从loader读取历史时间片
+
+private:
+    inline Slice get_history_slice(size_t i)
+    {
+        if (this->history != nullptr) {
+            return this->history->get(i);
+        }
+        auto range_ptr = loader->get_slice_range_ptrs(i);
+        return loader->get_slice(range_ptr.first, range_ptr.second);
+    }
+
+    //与SWLfuFeatureExtractor::deque_expired_histories对每个窗口的处理相同
+    inline void deque_expired_histories(int curr_i_slice)
+    {
+        auto k = history_w_lens.size();
+        int t_beg = INT32_MAX, t_end = 0;
+        for (size_t j = 0; j < k; j++) {
+            auto w_len = history_w_lens[j];
+            expire_begs[j] = expire_ends[j] = 0;
+            if (curr_i_slice != i_slices[j] && curr_i_slice > w_len) {
+                expire_begs[j] = std::max(i_slices[j] - w_len, 0);
+                expire_ends[j] = std::max(curr_i_slice - w_len, 0);
+                i_slices[j] = curr_i_slice;
+                if (expire_begs[j] < expire_ends[j]) {
+                    t_beg = std::min(t_beg, expire_begs[j]);
+                    t_end = std::max(t_end, expire_ends[j]);
+                }
+            }
+        }
+
+        for (auto t = t_beg; t < t_end; t++) {
+            expiring.resize(0);
+            for (size_t j = 0; j < k; j++) {
+                if (expire_begs[j] <= t && t < expire_ends[j]) {
+                    expiring.push_back(j);
+                }
+            }
+            if (expiring.empty()) {
+                continue;
+            }
+
+            Slice history_slice = this->get_history_slice(t);
+            for (size_t i = 0; i < history_slice.size; i++) {
+                if (i + PrefetchDistance < history_slice.size) {
+                    this->W.prefetch(history_slice.data[i + PrefetchDistance].content_id);
+                }
+                auto cid = history_slice.data[i].content_id;
+                auto counts = this->W.row(cid);
+                for (auto j: expiring) {
+                    counts[j]--;
+                }
+                this->mark_dirty(cid);
+            }
+            for (auto j: expiring) {
+                history_num_requests[j] -= (int) history_slice.size;
+            }
+        }
+    }
+
+public:
+    MultiSWLfuFeatureExtractor(const vector<int> &history_w_lens, RequestLoader *loader, SliceRing *history = nullptr)
+            : FeatureExtractor(history_w_lens.size()), W(history_w_lens.size(), loader->get_num_contents())
+    {
+        ASSERT(!history_w_lens.empty());
+        this->history_w_lens = history_w_lens;
+        this->loader = loader;
+        this->history = history;
+        if (history != nullptr) {
+            history->reserve_history(*std::max_element(history_w_lens.begin(), history_w_lens.end()));
+        }
+        auto k = history_w_lens.size();
+        this->i_slices.assign(k, 0);
+        this->history_num_requests.assign(k, 0);
+        this->expire_begs.assign(k, 0);
+        this->expire_ends.assign(k, 0);
+    }
+
+    void reset() override
+    {
+        if (VERBOSE) {
+            cout << "MultiSWLfuFeatureExtractor reset." << endl;
+        }
+        std::fill(i_slices.begin(), i_slices.end(), 0);
+        std::fill(history_num_requests.begin(), history_num_requests.end(), 0);
+        W.reset(loader->get_num_contents());
+    }
+
+    inline void update(const Slice &s) override
+    {
+        auto k = history_w_lens.size();
+        for (size_t i = 0; i < s.size; i++) {
+            if (i + PrefetchDistance < s.size) {
+                this->W.prefetch(s.data[i + PrefetchDistance].content_id);
+            }
+            auto counts = this->W.row(s.data[i].content_id);
+            for (size_t j = 0; j < k; j++) {
+                counts[j]++;
+            }
+        }
+        for (size_t j = 0; j < k; j++) {
+            history_num_requests[j] += (int) s.size;
+        }
+
+        if (s.size > 0) {
+            this->deque_expired_histories((int) s.i_slice);
+        }
+    }
+
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t dim_stride) override
+    {
+        //每一维为对应窗口内的请求次数除以窗口内的请求数
+        for (size_t j = 0; j < history_w_lens.size(); j++) {
+            gather_affine_rows(W.raw_slots(), W.get_row_words(), 1 + j, W.size(), W.get_generation(), 0, v, n,
+                               0, history_num_requests[j] + EPS, out + j * dim_stride, row_stride);
+        }
+    }
+
+    bool has_stable_raw_features() const override
+    {
+        return true;
+    }
+
+    void write_raw_features(const ContentType *v, size_t n, double *out, size_t row_stride) override
+    {
+        auto k = history_w_lens.size();
+        for (size_t i = 0; i < n; i++) {
+            auto live = in_table(v[i], W.size());
+            for (size_t j = 0; j < k; j++) {
+                out[i * row_stride + j] = (float) (live ? W.get(v[i], j) : 0);
+            }
+        }
+    }
+
+    void get_feature_transform(double *offsets, double *scales, double *divisors) override
+    {
+        for (size_t j = 0; j < history_w_lens.size(); j++) {
+            offsets[j] = 0;
+            scales[j] = 1;
+            divisors[j] = history_num_requests[j] + EPS;
+        }
+    }
+};
+
+/**
+ * 离线特征：内容到下一次被请求还有多少个请求，基于loader的下一次使用索引。
+ * 与lru特征一样取负号，值越大越应该保留；不再被请求的内容取到请求序列结尾的距离加一
+ */
+class NextUseFeatureExtractor : public FeatureExtractor
+{
+private:
+    StampedVector<uint64_t> W;  //每个内容下一次被请求的位置，0表示尚未被请求过
+    RequestLoader *loader;
+
+    size_t i_slice = 0;
+    uint64_t position = 0;  //下一个待处理请求的位置
+
+public:
+    explicit NextUseFeatureExtractor(RequestLoader *loader)
+            : FeatureExtractor(1), W(loader->get_num_contents(), 0), loader(loader)
+    {
+        loader->build_next_use_index();
+        this->reset();
+    }
+
+    void reset() override
+    {
+        if (VERBOSE) {
+            cout << "NextUseFeatureExtractor reset." << endl;
+        }
+        loader->build_next_use_index();
+        W.reset(loader->get_num_contents());
+        i_slice = 0;
+        position = loader->get_num_slices() > 0 ? loader->get_slice_range_ptrs(0).first : 0;
+    }
+
+    void update(const Slice &s) override
+    {
+        //被动模式下同一时间片分多次处理，只在进入新的时间片时重新定位
+        if (s.i_slice != this->i_slice) {
+            this->i_slice = s.i_slice;
+            this->position = loader->get_slice_range_ptrs(s.i_slice).first;
+        }
+
+        for (size_t i = 0; i < s.size; i++) {
+            this->W.at(s.data[i].content_id) = loader->get_next_use(this->position + i);
+        }
+        this->position += s.size;
+    }
+
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t) override
+    {
+        auto num_requests = loader->get_num_requests();
+        for (size_t i = 0; i < n; i++) {
+            uint64_t next_use = RequestLoader::NeverUsed;
+            if (in_table(v[i], W.size())) {
+                next_use = W.get(v[i]);
+                if (next_use == 0) {
+                    next_use = loader->get_first_use(v[i]);
+                }
+            }
+            //只在第0个时间片之前被请求过的内容，之后的下一次使用未知，视为立即被请求
+            auto dist = next_use == RequestLoader::NeverUsed ? num_requests + 1 - position
+                                                            : std::max(next_use, position) - position;
+            out[i * row_stride] = -(float) dist;
+        }
+    }
+};
+
+//OGD特征存储单元的句柄，即其在OgdEntryPool中的下标
+typedef uint32_t OgdHandle;
+const OgdHandle NoneOgdHandle = UINT32_MAX;
+
+//OGD特征的存储池，以结构数组的形式连续存放，释放的单元通过空闲链表复用
+class OgdEntryPool
+{
+private:
+    vector<OgdHandle> free_list;
+
+public:
+    vector<ContentType> content_ids;
+    vector<float> ws;              //未归一化的特征值，真实特征值为w * W_scale
+    vector<uint32_t> heap_idxs;    //该元素在最小堆中的位置
+
+    inline void reserve(size_t n)
+    {
+        content_ids.reserve(n);
+        ws.reserve(n);
+        heap_idxs.reserve(n);
+    }
+
+    inline OgdHandle alloc(ContentType cid, float w)
+    {
+        if (!free_list.empty()) {
+            auto h = free_list.back();
+            free_list.pop_back();
+            content_ids[h] = cid;
+            ws[h] = w;
+            return h;
+        }
+
+        content_ids.push_back(cid);
+        ws.push_back(w);
+        heap_idxs.push_back(0);
+        return (OgdHandle) (ws.size() - 1);
+    }
+
+    inline void release(OgdHandle h)
+    {
+        content_ids[h] = NoneContentType;
+        free_list.push_back(h);
+    }
+
+    //一次性释放所有单元
+    inline void clear()
+    {
+        content_ids.clear();
+        ws.clear();
+        heap_idxs.clear();
+        free_list.clear();
     }
 };
 
+//带位置索引的最小堆，支持O(log n)的增加键值与弹出最小值
+class OgdIndexedHeap
+{
+private:
+    vector<OgdHandle> heap;
+    OgdEntryPool *pool;
+
+    inline void place(size_t idx, OgdHandle h)
+    {
+        heap[idx] = h;
+        pool->heap_idxs[h] = idx;
+    }
+
+    inline void sift_up(size_t idx)
+    {
+        auto h = heap[idx];
+        auto w = pool->ws[h];
+        while (idx > 0) {
+            size_t parent = (idx - 1) / 2;
+            if (!(w < pool->ws[heap[parent]])) {
+                break;
+            }
+            place(idx, heap[parent]);
+            idx = parent;
+        }
+        place(idx, h);
+    }
+
+    inline void sift_down(size_t idx)
+    {
+        auto h = heap[idx];
+        auto w = pool->ws[h];
+        size_t n = heap.size();
+        while (true) {
+            size_t child = 2 * idx + 1;
+            if (child >= n) {
+                break;
+            }
+            if (child + 1 < n && pool->ws[heap[child + 1]] < pool->ws[heap[child]]) {
+                child++;
+            }
+            if (!(pool->ws[heap[child]] < w)) {
+                break;
+            }
+            place(idx, heap[child]);
+            idx = child;
+        }
+        place(idx, h);
+    }
+
+public:
+    explicit OgdIndexedHeap(OgdEntryPool *pool) : pool(pool) {}
+
+    inline size_t size() const
+    {
+        return heap.size();
+    }
+
+    inline void reserve(size_t n)
+    {
+        heap.reserve(n);
+    }
+
+    inline void clear()
+    {
+        heap.clear();
+    }
+
+    //获取w最小的元素
+    inline OgdHandle top() const
+    {
+        ASSERT(!heap.empty());
+        return heap.front();
+    }
+
+    inline void push(OgdHandle h)
+    {
+        heap.push_back(h);
+        sift_up(heap.size() - 1);
+    }
+
+    //弹出w最小的元素
+    inline OgdHandle pop()
+    {
+        auto min_h = top();
+        auto last = heap.back();
+        heap.pop_back();
+        if (!heap.empty()) {
+            place(0, last);
+            sift_down(0);
+        }
+        return min_h;
+    }
+
+    //元素h的w增加后，调整其在堆中的位置
+    inline void increase(OgdHandle h)
+    {
+        ASSERT(pool->heap_idxs[h] < heap.size() && heap[pool->heap_idxs[h]] == h);
+        sift_down(pool->heap_idxs[h]);
+    }
+};
 
 class OgdFeatureExtractor : public FeatureExtractor
 {
 private:
-    unordered_map<ContentType, float *> W;      //根据内容快速找到内容特征
-    vector<pair<ContentType, float> *> W_heap;  //用于保存内容的特征，并使用最小堆维护特征的顺序
+    StampedVector<OgdHandle> W;                //根据内容快速找到内容特征
+    OgdEntryPool W_pool;                       //用于保存内容的特征
+    OgdIndexedHeap W_heap;                     //使用最小堆维护特征的顺序
     float W_sum = 0;
+    double W_scale = 1;                        //全局缩放因子，归一化只更新该因子，不改动每个元素
 
     size_t max_w_len = 0;
+    RequestLoader *loader;
 
-    static bool cmp(pair<ContentType, float> *a, pair<ContentType, float> *b)
-    {
-        return a->second > b->second;
-    }
+    //缩放因子超出该范围时，将其乘回每个元素，避免浮点数下溢或上溢
+    static constexpr double min_scale = 1e-30, max_scale = 1e6;
 
     virtual float get_eta() = 0;
 
-    inline void delete_expired_elements(float eta)
+    inline void delete_expired_elements(float eta, float w_added)
     {
         //为了避免W无限增长，当W的大小超过最大的长度后，将特征值最小的元素从W中剔除
         float w_deleted = 0;  //用于保存被踢出去的元素的特征值
-        while (W.size() > max_w_len) {
-            auto min_e = W_heap.front();  //获取w最小的元素
-            W.erase(min_e->first);        //将其从W中移除
-
-            w_deleted += (min_e->second); //将其特征值加到w_deleted
+        while (W_heap.size() > max_w_len) {
+            auto min_h = W_heap.pop();                //获取并弹出w最小的元素
+            W.at(W_pool.content_ids[min_h]) = NoneOgdHandle;  //将其从W中移除
+            this->mark_dirty(W_pool.content_ids[min_h]);
 
-            //保持堆的结构
-            pop_heap(W_heap.begin(), W_heap.end(), cmp);
-            W_heap.pop_back();
+            w_deleted += (float) (W_pool.ws[min_h] * W_scale); //将其特征值加到w_deleted
 
-            //释放内存
-            delete min_e;
+            //归还存储单元
+            W_pool.release(min_h);
         }
 
-        //接下来做归一化
-        float W_sum_new = 0;
+        //接下来做归一化，所有元素除以同一个正数，只需更新缩放因子，不会破坏堆的顺序
         float denominator = (W_sum + eta - w_deleted);
-        for (auto &iter: W) {
-            *(iter.second) /= denominator;
-            W_sum_new += *(iter.second);
+        W_scale /= denominator;
+        W_sum = (W_sum + w_added - w_deleted) / denominator;
+
+        if (W_scale < min_scale || W_scale > max_scale) {
+            this->renormalize();
+        }
+    }
+
+    //将缩放因子乘回每个元素
+    inline void renormalize()
+    {
+        for (auto &w: W_pool.ws) {
+            w = (float) (w * W_scale);
+        }
+        W_scale = 1;
+        this->mark_all_dirty();
+    }
+
+    //将内容cid的特征值加上eta
+    inline void add_weight(ContentType cid, float eta)
+    {
+        float w = (float) (eta / W_scale);
+
+        auto &h = W.at(cid);
+        if (h == NoneOgdHandle) {
+            //如果元素之前没有存储，那么从存储池中分配一个新的单元，并加入最小堆
+            h = W_pool.alloc(cid, w);
+            W_heap.push(h);
+        }
+        else {
+            //如果元素存储过，那么加上eta，只调整该元素在堆中的位置
+            W_pool.ws[h] += w;
+            W_heap.increase(h);
         }
-        W_sum = W_sum_new;
     }
 
 protected:
     int count = 0;  //步计数
 
 public:
-    explicit OgdFeatureExtractor(size_t capacity) : FeatureExtractor(1)
+    OgdFeatureExtractor(size_t capacity, RequestLoader *loader)
+            : FeatureExtractor(1), W(loader->get_num_contents(), NoneOgdHandle), W_heap(&W_pool), loader(loader)
     {
         max_w_len = capacity * 100;
-        make_heap(W_heap.begin(), W_heap.end(), cmp);
+        W_pool.reserve(max_w_len + 1);
+        W_heap.reserve(max_w_len + 1);
     }
 
     void reset() override
@@ -365,36 +945,18 @@ public:
 
         count = 0;
 
-        for (auto w: W_heap) {
-            delete w;
-        }
-        W.clear();
+        W.reset(loader->get_num_contents());
+        W_pool.clear();
         W_heap.clear();
+        W_scale = 1;
     }
 
     inline void update_single_request(Request r)
     {
         float eta = get_eta();  //OgdOpt、LFU、LRU三种的eta的计算方式不同
-        auto cid = r.content_id;
-
-        auto it = W.find(cid);
-        if (it == W.end()) {
-            //如果元素之前没有存储，那么创建一个新的键值对
-            auto pair_ptr = new pair<ContentType, float>(cid, eta);
-            //W中保存特征的指针，保证W和W_heap中的特征值的一致
-            W[cid] = &(pair_ptr->second);
-
-            //将键值对的指针保存到最小堆中，更新最小堆
-            W_heap.push_back(pair_ptr);
-            push_heap(W_heap.begin(), W_heap.end(), cmp);
-        }
-        else {
-            //如果元素存储过，那么加上eta，更新最小堆
-            (*it->second) += eta;
-            make_heap(W_heap.begin(), W_heap.end(), cmp);
-        }
 
-        this->delete_expired_elements(eta);
+        this->add_weight(r.content_id, eta);
+        this->delete_expired_elements(eta, eta);
 
         //计数增加
         this->count++;
@@ -408,27 +970,10 @@ public:
             float eta = get_eta();  //OgdOpt、LFU、LRU三种的eta的计算方式不同
 
             for (size_t i = 0; i < s.size; i++) {
-                auto cid = s.data[i].content_id;
-
-                auto it = W.find(cid);
-                if (it == W.end()) {
-                    //如果元素之前没有存储，那么创建一个新的键值对
-                    auto pair_ptr = new pair<ContentType, float>(cid, eta);
-                    //W中保存特征的指针，保证W和W_heap中的特征值的一致
-                    W[cid] = &(pair_ptr->second);
-
-                    //将键值对的指针保存到最小堆中，更新最小堆
-                    W_heap.push_back(pair_ptr);
-                    push_heap(W_heap.begin(), W_heap.end(), cmp);
-                }
-                else {
-                    //如果元素存储过，那么加上eta，更新最小堆
-                    (*it->second) += eta;
-                    make_heap(W_heap.begin(), W_heap.end(), cmp);
-                }
+                this->add_weight(s.data[i].content_id, eta);
             }
 
-            this->delete_expired_elements(eta);
+            this->delete_expired_elements(eta, eta * s.size);
 
             //计数增加
             this->count++;
@@ -442,21 +987,32 @@ public:
         }
     }
 
-    Feature get_features(ContentVector &v) override
+    void write_features(const ContentType *v, size_t n, FeatureType *out, size_t row_stride, size_t) override
     {
-        f_buf.resize(v.size() * this->feature_dims);
+        //真实特征值为w * W_scale，不在W中的内容为0
+        gather_scaled(W.raw_slots(), W.size(), W.get_generation(), NoneOgdHandle, W_pool.ws.data(), v, n,
+                      W_scale, out, row_stride);
+    }
 
-        for (size_t i = 0; i < v.size(); i++) {
-            auto it = W.find(v[i]);
-            if (it == W.end()) {
-                f_buf[i] = 0;
-            }
-            else {
-                f_buf[i] = *(it->second);
-            }
+    //raw为未归一化的特征值w，scale为W_scale；被剔除的内容与重新归一化在对应位置标记
+    bool has_stable_raw_features() const override
+    {
+        return true;
+    }
+
+    void write_raw_features(const ContentType *v, size_t n, double *out, size_t row_stride) override
+    {
+        for (size_t i = 0; i < n; i++) {
+            auto h = in_table(v[i], W.size()) ? W.get(v[i]) : NoneOgdHandle;
+            out[i * row_stride] = h == NoneOgdHandle ? 0 : W_pool.ws[h];
         }
+    }
 
-        return {f_buf.data(), v.size(), feature_dims};
+    void get_feature_transform(double *offsets, double *scales, double *divisors) override
+    {
+        offsets[0] = 0;
+        scales[0] = W_scale;
+        divisors[0] = 1;
     }
 };
 
@@ -470,7 +1026,7 @@ protected:
     }
 
 public:
-    explicit OgdOptimalFeatureExtractor(size_t capacity) : OgdFeatureExtractor(capacity) {}
+    OgdOptimalFeatureExtractor(size_t capacity, RequestLoader *loader) : OgdFeatureExtractor(capacity, loader) {}
 };
 
 class OgdLruFeatureExtractor : public OgdFeatureExtractor
@@ -483,7 +1039,7 @@ protected:
     }
 
 public:
-    explicit OgdLruFeatureExtractor(size_t capacity) : OgdFeatureExtractor(capacity) {}
+    OgdLruFeatureExtractor(size_t capacity, RequestLoader *loader) : OgdFeatureExtractor(capacity, loader) {}
 };
 
 class OgdLfuFeatureExtractor : public OgdFeatureExtractor
@@ -495,7 +1051,7 @@ protected:
     }
 
 public:
-    explicit OgdLfuFeatureExtractor(size_t capacity) : OgdFeatureExtractor(capacity) {}
+    OgdLfuFeatureExtractor(size_t capacity, RequestLoader *loader) : OgdFeatureExtractor(capacity, loader) {}
 };
 
 class FeatureManager
@@ -504,6 +1060,11 @@ private:
     vector<FeatureExtractor *> extractors;
     vector<FeatureType> f_buf;
 
+    //增量观测用到的已变化内容，开启后才记录
+    DirtyContents dirty;
+    bool track_dirty = false;
+    bool all_raw_stable = true;
+
 public:
     size_t feature_dims{0};
 
@@ -511,7 +1072,9 @@ public:
 
     virtual ~FeatureManager()
     {
-        delete[] extractors.data();
+        for (auto e: extractors) {
+            delete e;
+        }
     }
 
     void reset()
@@ -522,39 +1085,119 @@ public:
         for (auto e: extractors) {
             e->reset();
         }
+        this->dirty.mark_all();
     }
 
     void add_feature_extractor(FeatureExtractor *extractor)
     {
         this->extractors.push_back(extractor);
         this->feature_dims += extractor->get_feature_dims();
+        this->all_raw_stable = this->all_raw_stable && extractor->has_stable_raw_features();
+        if (this->track_dirty) {
+            extractor->set_dirty_contents(&this->dirty);
+        }
+        this->dirty.mark_all();
     }
 
     void update(const Slice &s)
     {
+        if (this->track_dirty) {
+            //时间片中的内容命中次数与特征都可能改变
+            for (size_t i = 0; i < s.size; i++) {
+                this->dirty.mark(s.data[i].content_id);
+            }
+            if (!this->all_raw_stable) {
+                this->dirty.mark_all();
+            }
+        }
+
         for (auto &e: this->extractors) {
             e->update(s);
         }
     }
 
+    //开始记录已变化的内容，开启时视为所有内容都已变化
+    void enable_dirty_tracking()
+    {
+        if (!this->track_dirty) {
+            this->track_dirty = true;
+            for (auto e: this->extractors) {
+                e->set_dirty_contents(&this->dirty);
+            }
+        }
+        this->dirty.mark_all();
+    }
+
+    inline bool is_tracking_dirty() const
+    {
+        return this->track_dirty;
+    }
+
+    inline const DirtyContents &get_dirty_contents() const
+    {
+        return this->dirty;
+    }
+
+    //取走一次增量观测后清空标记
+    inline void clear_dirty_contents(size_t num_contents)
+    {
+        this->dirty.clear(num_contents);
+    }
+
+    //将v中前n个内容的原始特征按行写入out，形状为[n, feature_dims]
+    inline void write_raw_features(const ContentType *v, size_t n, double *out)
+    {
+        size_t f_dims = 0;
+        for (auto &e: this->extractors) {
+            e->write_raw_features(v, n, out + f_dims, this->feature_dims);
+            f_dims += e->get_feature_dims();
+        }
+    }
+
+    //写入每一维特征的变换参数，特征 = (float) ((raw + offset) * scale / divisor)
+    inline void get_feature_transform(double *offsets, double *scales, double *divisors)
+    {
+        size_t f_dims = 0;
+        for (auto &e: this->extractors) {
+            e->get_feature_transform(offsets + f_dims, scales + f_dims, divisors + f_dims);
+            f_dims += e->get_feature_dims();
+        }
+    }
+
     inline Feature get_features(ContentVector &v)
     {
         auto content_dims = v.size();
         f_buf.resize(content_dims * this->feature_dims);
-        Feature features(f_buf.data(), content_dims, this->feature_dims);
+        this->write_features(v, content_dims, f_buf.data());
+        return {f_buf.data(), content_dims, this->feature_dims};
+    }
+
+    //按列排列的特征，第k维特征的所有内容连续存放，形状为[feature_dims, content_dims]
+    inline Feature get_features_columns(ContentVector &v)
+    {
+        auto content_dims = v.size();
+        f_buf.resize(content_dims * this->feature_dims);
+        this->write_features_columns(v, content_dims, f_buf.data());
+        return {f_buf.data(), this->feature_dims, content_dims};
+    }
 
+    //提取v的特征，将前content_dims个内容的特征按行写入out中，每个特征提取器直接写入自己的列
+    inline void write_features(ContentVector &v, size_t content_dims, FeatureType *out)
+    {
         size_t f_dims = 0;
         for (auto &e: this->extractors) {
-            auto f = e->get_features(v);
-            for (size_t j = 0; j < content_dims; ++j) {
-                for (size_t i = 0; i < f.feature_dims; ++i) {
-                    features.set(j, f_dims + i, f.get(j, i));
-                }
-            }
-            f_dims += f.feature_dims;
+            e->write_features(v.data(), content_dims, out + f_dims, this->feature_dims, 1);
+            f_dims += e->get_feature_dims();
         }
-
-        return features;
     }
-};
 
+    //提取v的特征，将前content_dims个内容的特征按列写入out中
+    inline void write_features_columns(ContentVector &v, size_t content_dims, FeatureType *out)
+    {
+        size_t f_dims = 0;
+        for (auto &e: this->extractors) {
+            e->write_features(v.data(), content_dims, out + f_dims * content_dims, 1, content_dims);
+            f_dims += e->get_feature_dims();
+        }
+    }
+};
\ No newline at end of file
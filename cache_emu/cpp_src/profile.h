@@ -0,0 +1,140 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * PROFILE: 是否编译热点路径的计时与计数代码
+ * 0: 相关代码在编译时被完全移除
+ * 1: 编译计时代码，每个模拟器在运行时通过set_profiling单独开启，未开启时每个阶段只多一次分支
+ */
+#ifndef PROFILE
+#define PROFILE 1
+#endif
+
+//一步中被计时的阶段
+enum ProfilePhase
+{
+    PhaseSliceFetch = 0,    //读取时间片（流式或压缩数据集时包括读文件与解码）
+    PhaseHitTest,           //逐个请求检测命中
+    PhaseFeatureUpdate,     //FeatureManager::update
+    PhaseCandidates,        //生成候选内容及其命中次数
+    PhaseGetFeatures,       //get_features与observe中的特征计算
+    PhaseUpdateCache,       //update_cache
+    NumProfilePhases
+};
+
+//单个模拟器的计时与计数结果，以值的形式通过C接口返回
+struct ProfileStats
+{
+    uint64_t cycles[NumProfilePhases];  //各阶段累计的时钟周期数
+    uint64_t calls[NumProfilePhases];   //各阶段的调用次数
+    double cycles_per_second;           //由开启计时以来的时钟周期数与经过的时间估计，用于换算成秒
+
+    //Cache中哈希表的探测统计
+    uint64_t num_lookups;       //查找次数
+    uint64_t num_probes;        //探测的槽位总数，平均探测长度为num_probes / num_lookups
+    uint64_t num_collisions;    //第一个槽位不是目标内容（或空槽位）的查找次数
+    uint64_t max_probe_length;  //单次查找探测的最多槽位数
+    uint64_t num_rehashes;      //重建哈希表的次数
+};
+
+//读取时钟周期计数器，非x86平台使用纳秒
+inline uint64_t read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//每个模拟器持有一个，未开启时不读取时钟也不计数
+class Profiler
+{
+private:
+    ProfileStats stats{};
+    bool enabled = false;
+
+    //开启计时的时刻，用于估计时钟频率
+    uint64_t cycles_beg = 0;
+    std::chrono::steady_clock::time_point time_beg;
+
+public:
+    inline bool is_enabled() const
+    {
+        return PROFILE && this->enabled;
+    }
+
+    //开启或关闭计时，开启时清空已有的结果
+    void set_enabled(bool enabled)
+    {
+        this->enabled = PROFILE && enabled;
+        if (this->enabled) {
+            this->clear();
+        }
+    }
+
+    void clear()
+    {
+        std::memset(&this->stats, 0, sizeof(this->stats));
+        this->cycles_beg = read_cycles();
+        this->time_beg = std::chrono::steady_clock::now();
+    }
+
+    //阶段开始时调用，返回开始的时钟周期数
+    inline uint64_t begin() const
+    {
+        return this->is_enabled() ? read_cycles() : 0;
+    }
+
+    //阶段结束时调用
+    inline void end(ProfilePhase phase, uint64_t cycles)
+    {
+        if (this->is_enabled()) {
+            this->stats.cycles[phase] += read_cycles() - cycles;
+            this->stats.calls[phase]++;
+        }
+    }
+
+    //哈希表探测统计写入的位置，未开启时为nullptr
+    inline ProfileStats *probe_stats()
+    {
+        return this->is_enabled() ? &this->stats : nullptr;
+    }
+
+    ProfileStats get_stats() const
+    {
+        auto res = this->stats;
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->time_beg).count();
+        res.cycles_per_second = this->is_enabled() && seconds > 0 ? (double) (read_cycles() - this->cycles_beg) / seconds : 0;
+        return res;
+    }
+};
+
+//在作用域结束时记录一个阶段的耗时
+class ProfileScope
+{
+private:
+    Profiler &profiler;
+    ProfilePhase phase;
+    uint64_t cycles;
+
+public:
+    ProfileScope(Profiler &profiler, ProfilePhase phase)
+            : profiler(profiler), phase(phase), cycles(profiler.begin()) {}
+
+    ~ProfileScope()
+    {
+        this->profiler.end(this->phase, this->cycles);
+    }
+};
+
+#endif //PROFILE_H
@@ -1,25 +1,36 @@
 #pragma once
 
+#include <atomic>
+#include <iostream>
 #include <ostream>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <numeric>
 
 using namespace std;
 
 #include "utils.h"
+#include "trace_file.hpp"
+#include "compressed_trace.hpp"
+#include "thread_pool.hpp"
 
 struct Slice
 {
-    Request *data;
+    const Request *data;
     size_t size;
+    size_t i_slice;  //所属时间片的编号，由SliceRing填写
 
-    Slice() : data(nullptr), size(0) {}
+    Slice() : data(nullptr), size(0), i_slice(0) {}
 
-    Slice(Request *data, size_t size) : data(data), size(size) {}
+    Slice(const Request *data, size_t size, size_t i_slice = 0) : data(data), size(size), i_slice(i_slice) {}
 
     Slice sub_slice(size_t beg = 0, size_t end = -1)
     {
         if (end == -1) { end = size; }
         ASSERT(beg >= 0 && end <= size && beg <= end);
-        return Slice(data + beg, end - beg);
+        return Slice(data + beg, end - beg, i_slice);
     }
 
     Request get(int idx) const
@@ -43,26 +54,667 @@ struct Slice
 class RequestLoader
 {
 private:
-    vector<Request> requests;
+    //请求序列，内容ID已被映射为0..N-1的稠密ID；指向owned_requests或映射的文件
+    const Request *requests = nullptr;
+    size_t num_requests = 0;
+
+    //稠密ID到原始ID的映射，按原始ID升序排列；指向owned_dense_to_raw或映射的文件
+    const ContentType *dense_to_raw = nullptr;
+    size_t num_contents = 0;
+
+    //原始ID到稠密ID的直接映射，仅在原始ID较为紧凑时使用，否则在dense_to_raw上二分查找
+    ContentVector raw_to_dense;
+
+    //由load_dataset导入的数据保存在这里
+    vector<Request> owned_requests;
+    ContentVector owned_dense_to_raw;
+
+    //由load_trace_file映射的文件，所有副本共享同一个映射
+    shared_ptr<MappedFile> mapped_file;
+
+    //由open_trace_stream打开的文件，此时requests为空，请求只在读取时从文件中拷贝
+    shared_ptr<TraceStream> trace_stream;
+
+    //由compress或load_compressed_trace得到的压缩请求序列，此时requests为空，请求只在读取时解码
+    shared_ptr<CompressedTrace> compressed_trace;
+
+    //下一次使用索引：第i个请求到同一内容的下一个请求的距离，NoNextUse表示之后不再被请求；
+    //以及每个内容第一次被请求的位置。由build_next_use_index建立，更换数据集时清空
+    vector<uint32_t> next_use_dists;
+    vector<uint64_t> first_uses;
+
+    //直接映射表的最大长度
+    static constexpr size_t max_direct_ids = 1 << 26;
 
     vector<pair<size_t, size_t>> slice_ptrs;
+    size_t max_slice_size = 0;
 
     TimestampType timestamp_beg = 0, timestamp_end = 0, timestamp_interval = 1;
 
 public:
     explicit RequestLoader() = default;
 
-    //导入数据集
+    //requests与dense_to_raw可能指向自身的成员，不允许拷贝
+    RequestLoader(const RequestLoader &) = delete;
+
+    RequestLoader &operator=(const RequestLoader &) = delete;
+
+    //导入数据集，并将内容ID重新映射为稠密ID，内容ID为负数或ContentType最大值的请求被丢弃
     void load_dataset(ContentType *cs, TimestampType *ts, size_t size)
     {
+        //已有的请求（包括映射、流式读取或压缩的请求）先拷贝出来并还原为原始ID，再与新的请求一起重新映射
+        if (this->is_streaming()) {
+            this->owned_requests.resize(this->num_requests);
+            this->read_requests(0, this->num_requests, this->owned_requests.data());
+        }
+        else if (this->requests != this->owned_requests.data()) {
+            this->owned_requests.assign(this->requests, this->requests + this->num_requests);
+        }
+        for (auto &r: this->owned_requests) {
+            r.content_id = this->to_raw(r.content_id);
+        }
+
+        //无效的原始ID无法映射为稠密ID，丢弃这些请求
+        size_t num_invalid = 0;
+        this->owned_requests.reserve(this->owned_requests.size() + size);
         for (size_t i = 0; i < size; i++) {
-            this->requests.push_back({cs[i], ts[i]});
+            if (!is_valid_raw_id(cs[i])) {
+                num_invalid++;
+                continue;
+            }
+            this->owned_requests.push_back({cs[i], ts[i]});
+        }
+        if (num_invalid > 0) {
+            cout << "load_dataset: dropped " << num_invalid << " requests with negative or too large content ids" << endl;
+        }
+        this->mapped_file.reset();
+        this->trace_stream.reset();
+        this->compressed_trace.reset();
+        this->clear_next_use_index();
+
+        this->build_dense_ids();
+    }
+
+    /**
+     * 以内容ID已是0..num_contents-1的请求序列替换数据集，原始ID即稠密ID，不再重新映射，
+     * 用于直接生成请求序列的场景；没有被请求的内容同样占用一个稠密ID
+     */
+    void load_dense_requests(vector<Request> &&requests, size_t num_contents)
+    {
+        ASSERT(num_contents < (size_t) std::numeric_limits<ContentType>::max());
+
+        this->owned_requests = std::move(requests);
+        this->mapped_file.reset();
+        this->trace_stream.reset();
+        this->compressed_trace.reset();
+        this->clear_next_use_index();
+
+        auto &d2r = this->owned_dense_to_raw;
+        d2r.resize(num_contents);
+        std::iota(d2r.begin(), d2r.end(), 0);
+        this->raw_to_dense.clear();
+        if (num_contents <= max_direct_ids) {
+            this->raw_to_dense = d2r;
+        }
+
+        this->dense_to_raw = d2r.data();
+        this->num_contents = num_contents;
+        this->requests = this->owned_requests.data();
+        this->num_requests = this->owned_requests.size();
+    }
+
+    /**
+     * 以只读方式映射由save_trace_file写入的文件，替换已导入的数据集。
+     * 请求与ID映射表直接使用映射的内存，不做拷贝；载入时扫描一遍映射表与请求，
+     * 检查映射表有序且所有稠密ID都在[0, num_contents)内，损坏或不兼容的文件不会导致越界访问
+     * @param pool  不为空时在线程池中并行检查请求
+     * @return  成功时返回true，文件无效时保留原有数据并返回false
+     */
+    bool load_trace_file(const char *path, ThreadPool *pool = nullptr)
+    {
+        auto file = make_shared<MappedFile>();
+        if (!file->open(path)) {
+            cout << "load_trace_file: cannot map " << path << endl;
+            return false;
+        }
+
+        TraceFileHeader header{};
+        if (file->size() < sizeof(header)) {
+            cout << "load_trace_file: " << path << ": file truncated" << endl;
+            return false;
+        }
+        memcpy(&header, file->data(), sizeof(header));
+
+        auto error = check_trace_header(header, file->size());
+        if (!error.empty()) {
+            cout << "load_trace_file: " << path << ": " << error << endl;
+            return false;
+        }
+
+        auto d2r = (const ContentType *) (file->data() + header.dict_offset);
+        auto requests = (const Request *) (file->data() + header.requests_offset);
+        error = check_trace_dictionary(d2r, header.num_contents);
+        if (error.empty() && !check_content_ids(requests, header.num_requests, header.num_contents, pool)) {
+            error = "content id out of range";
+        }
+        if (!error.empty()) {
+            cout << "load_trace_file: " << path << ": " << error << endl;
+            return false;
+        }
+
+        this->owned_requests = vector<Request>();
+        this->owned_dense_to_raw = ContentVector();
+        this->raw_to_dense = ContentVector();
+
+        this->mapped_file = file;
+        this->trace_stream.reset();
+        this->compressed_trace.reset();
+        this->clear_next_use_index();
+        this->requests = requests;
+        this->num_requests = header.num_requests;
+        this->dense_to_raw = d2r;
+        this->num_contents = header.num_contents;
+
+        return true;
+    }
+
+    /**
+     * 以流的方式打开由save_trace_file写入的文件，替换已导入的数据集。
+     * 只有ID映射表常驻内存，请求在使用时才按时间片读入（见SliceRing），内存占用与请求数量无关
+     * @return  成功时返回true，文件无效时保留原有数据并返回false
+     */
+    bool open_trace_stream(const char *path)
+    {
+        auto stream = make_shared<TraceStream>();
+        auto error = stream->open(path);
+        if (!error.empty()) {
+            cout << "open_trace_stream: " << path << ": " << error << endl;
+            return false;
+        }
+
+        auto &header = stream->get_header();
+        ContentVector d2r(header.num_contents);
+        if (!stream->read_dictionary(d2r.data())) {
+            cout << "open_trace_stream: " << path << ": file truncated" << endl;
+            return false;
+        }
+        error = check_trace_dictionary(d2r.data(), d2r.size());
+        if (!error.empty()) {
+            cout << "open_trace_stream: " << path << ": " << error << endl;
+            return false;
+        }
+
+        this->owned_requests = vector<Request>();
+        this->owned_dense_to_raw.swap(d2r);
+        this->raw_to_dense = ContentVector();
+        this->mapped_file.reset();
+        this->compressed_trace.reset();
+        this->clear_next_use_index();
+
+        this->trace_stream = stream;
+        this->requests = nullptr;
+        this->num_requests = header.num_requests;
+        this->dense_to_raw = this->owned_dense_to_raw.data();
+        this->num_contents = this->owned_dense_to_raw.size();
+
+        return true;
+    }
+
+    /**
+     * 将当前数据集按块压缩（见CompressedTrace），之后请求只在读取时解码
+     * @return  压缩后占用的字节数
+     */
+    size_t compress(size_t block_size = CompressedTrace::DefaultBlockSize)
+    {
+        auto trace = make_shared<CompressedTrace>();
+        ContentVector d2r(this->dense_to_raw, this->dense_to_raw + this->num_contents);
+        trace->encode(this->num_requests, d2r, [this](size_t beg, size_t size, Request *out) {
+            this->read_requests(beg, size, out);
+        }, block_size);
+
+        this->set_compressed_trace(trace);
+        return trace->get_num_bytes();
+    }
+
+    /**
+     * 读入由save_compressed_trace写入的文件，替换已导入的数据集
+     * @return  成功时返回true，文件无效时保留原有数据并返回false
+     */
+    bool load_compressed_trace(const char *path)
+    {
+        auto trace = make_shared<CompressedTrace>();
+        auto error = trace->read(path);
+        if (!error.empty()) {
+            cout << "load_compressed_trace: " << path << ": " << error << endl;
+            return false;
+        }
+
+        this->set_compressed_trace(trace);
+        this->raw_to_dense = ContentVector();
+        this->clear_next_use_index();
+        return true;
+    }
+
+    //将压缩的数据集写入文件，数据集未压缩时返回false
+    bool save_compressed_trace(const char *path) const
+    {
+        if (this->compressed_trace == nullptr) {
+            cout << "save_compressed_trace: the dataset is not compressed" << endl;
+            return false;
+        }
+        return this->compressed_trace->write(path);
+    }
+
+    //请求是否不在内存中（流式读取或压缩），此时只能通过read_slice获取请求
+    inline bool is_streaming() const
+    {
+        return this->trace_stream != nullptr || this->compressed_trace != nullptr;
+    }
+
+    //将当前数据集写入二进制文件，供load_trace_file使用
+    bool save_trace_file(const char *path) const
+    {
+        if (this->is_streaming()) {
+            cout << "save_trace_file: the requests are not in memory" << endl;
+            return false;
+        }
+        return write_trace_file(path, this->dense_to_raw, this->num_contents, this->requests, this->num_requests);
+    }
+
+    //内容数量，即稠密ID的取值范围
+    inline size_t get_num_contents() const
+    {
+        return this->num_contents;
+    }
+
+    //稠密ID转换为原始ID
+    inline ContentType to_raw(ContentType e) const
+    {
+        if (e >= 0) {
+            return this->dense_to_raw[e];
+        }
+        //数据集中不存在的内容被编码为小于-1的ID
+        return e == NoneContentType ? NoneContentType : -2 - e;
+    }
+
+    //原始ID是否可以导入：非负且小于ContentType的最大值，数据集外的ID才能编码为-2 - raw
+    static inline bool is_valid_raw_id(ContentType raw)
+    {
+        return raw >= 0 && raw < std::numeric_limits<ContentType>::max();
+    }
+
+    /**
+     * 原始ID转换为稠密ID，数据集中不存在的内容映射为小于-1的ID，不会与任何请求冲突。
+     * 小于-1的ID均已用于编码数据集外的非负原始ID，其他无效的原始ID（见is_valid_raw_id）映射为NoneContentType，按空位处理
+     */
+    inline ContentType to_dense(ContentType raw) const
+    {
+        if (!is_valid_raw_id(raw)) {
+            return NoneContentType;
+        }
+
+        if (!this->raw_to_dense.empty()) {
+            if ((size_t) raw < this->raw_to_dense.size() && this->raw_to_dense[raw] != NoneContentType) {
+                return this->raw_to_dense[raw];
+            }
+        }
+        else {
+            auto end = this->dense_to_raw + this->num_contents;
+            auto it = std::lower_bound(this->dense_to_raw, end, raw);
+            if (it != end && *it == raw) {
+                return (ContentType) (it - this->dense_to_raw);
+            }
+        }
+        return -2 - raw;
+    }
+
+    //没有下一次使用
+    static constexpr uint64_t NeverUsed = UINT64_MAX;
+
+    /**
+     * 从后向前扫描一遍请求序列，建立下一次使用索引，已建立时直接返回。
+     * 每个请求只占4个字节，距离超过UINT32_MAX的下一次使用视为不再使用
+     */
+    void build_next_use_index()
+    {
+        if (this->has_next_use_index()) {
+            return;
+        }
+
+        this->next_use_dists.resize(this->num_requests);
+        this->first_uses.assign(this->num_contents, NeverUsed);
+
+        //此时first_uses记录每个内容在已扫描的请求中最早的位置
+        vector<Request> chunk(std::min(this->num_requests, (size_t) 1 << 16));
+        for (auto end = this->num_requests; end > 0;) {
+            auto beg = end - std::min(end, chunk.size());
+            this->read_requests(beg, end - beg, chunk.data());
+
+            for (auto i = end; i-- > beg;) {
+                auto &last = this->first_uses[chunk[i - beg].content_id];
+                this->next_use_dists[i] = last == NeverUsed ? NoNextUse : (uint32_t) std::min(last - i, (uint64_t) NoNextUse);
+                last = i;
+            }
+            end = beg;
+        }
+    }
+
+    inline bool has_next_use_index() const
+    {
+        return this->next_use_dists.size() == this->num_requests && this->first_uses.size() == this->num_contents;
+    }
+
+    //第i个请求之后同一内容下一次被请求的位置，不再被请求时返回NeverUsed
+    inline uint64_t get_next_use(size_t i) const
+    {
+        ASSERT(i < this->next_use_dists.size());
+        auto dist = this->next_use_dists[i];
+        return dist == NoNextUse ? NeverUsed : i + dist;
+    }
+
+    //内容第一次被请求的位置
+    inline uint64_t get_first_use(ContentType e) const
+    {
+        ASSERT(e >= 0 && (size_t) e < this->first_uses.size());
+        return this->first_uses[e];
+    }
+
+private:
+    static constexpr uint32_t NoNextUse = UINT32_MAX;
+
+    void clear_next_use_index()
+    {
+        this->next_use_dists = vector<uint32_t>();
+        this->first_uses = vector<uint64_t>();
+    }
+
+    /**
+     * 读取第beg个请求开始的size个请求，不论请求在内存、文件或压缩块中。
+     * 流式读取失败（读文件出错、文件在打开后被截断或改写）时无法继续模拟，打印错误并终止进程，
+     * 否则未初始化或越界的内容ID会在特征提取器与切片中造成越界访问
+     */
+    void read_requests(size_t beg, size_t size, Request *out, CompressedTrace::Cursor *cursor = nullptr) const
+    {
+        if (this->trace_stream != nullptr) {
+            auto ok = this->trace_stream->read_requests(beg, size, out);
+            for (size_t i = 0; ok && i < size; i++) {
+                ok = out[i].content_id >= 0 && (size_t) out[i].content_id < this->num_contents;
+            }
+            if (!ok) {
+                cerr << "RequestLoader: failed to read requests [" << beg << ", " << beg + size
+                     << ") from the trace stream" << endl;
+                std::abort();
+            }
+        }
+        else if (this->compressed_trace != nullptr) {
+            this->compressed_trace->decode(beg, size, out, cursor);
+        }
+        else {
+            std::copy(this->requests + beg, this->requests + beg + size, out);
+        }
+    }
+
+    //以压缩的请求序列替换当前数据集，稠密ID保持不变
+    void set_compressed_trace(const shared_ptr<CompressedTrace> &trace)
+    {
+        this->owned_requests = vector<Request>();
+        this->owned_dense_to_raw = ContentVector();
+        this->mapped_file.reset();
+        this->trace_stream.reset();
+
+        this->compressed_trace = trace;
+        this->requests = nullptr;
+        this->num_requests = trace->get_num_requests();
+        this->dense_to_raw = trace->get_dense_to_raw().data();
+        this->num_contents = trace->get_dense_to_raw().size();
+    }
+
+    //建立稠密ID，稠密ID的顺序与原始ID的顺序一致
+    void build_dense_ids()
+    {
+        auto &d2r = this->owned_dense_to_raw;
+        d2r.clear();
+        this->raw_to_dense.clear();
+
+        ContentType max_raw = 0;
+        for (auto &r: this->owned_requests) {
+            max_raw = std::max(max_raw, r.content_id);
+        }
+
+        if ((size_t) max_raw < std::min(4 * this->owned_requests.size() + 1024, max_direct_ids)) {
+            //原始ID较为紧凑，使用直接映射表
+            this->raw_to_dense.assign((size_t) max_raw + 1, NoneContentType);
+            for (auto &r: this->owned_requests) {
+                this->raw_to_dense[r.content_id] = 0;
+            }
+            for (size_t raw = 0; raw < this->raw_to_dense.size(); raw++) {
+                if (this->raw_to_dense[raw] != NoneContentType) {
+                    this->raw_to_dense[raw] = (ContentType) d2r.size();
+                    d2r.push_back((ContentType) raw);
+                }
+            }
+        }
+        else {
+            //原始ID较为稀疏，排序去重后二分查找
+            for (auto &r: this->owned_requests) {
+                d2r.push_back(r.content_id);
+            }
+            std::sort(d2r.begin(), d2r.end());
+            d2r.erase(std::unique(d2r.begin(), d2r.end()), d2r.end());
+            d2r.shrink_to_fit();
         }
+
+        this->dense_to_raw = d2r.data();
+        this->num_contents = d2r.size();
+
+        for (auto &r: this->owned_requests) {
+            r.content_id = this->to_dense(r.content_id);
+        }
+        this->requests = this->owned_requests.data();
+        this->num_requests = this->owned_requests.size();
+    }
+
+private:
+    //检查所有请求的稠密ID都在[0, num_contents)内，请求被分成若干段，各段可以在线程池中并行检查
+    static bool check_content_ids(const Request *requests, size_t num_requests, size_t num_contents,
+                                  ThreadPool *pool)
+    {
+        size_t num_tasks = pool == nullptr ? 1 : 4 * pool->get_num_threads();
+        atomic<bool> ok{true};
+
+        auto task = [&](size_t k) {
+            auto beg = num_requests * k / num_tasks, end = num_requests * (k + 1) / num_tasks;
+            bool task_ok = true;
+            for (auto i = beg; i < end; i++) {
+                //转为无符号数后一次比较同时排除负数
+                task_ok &= (uint32_t) requests[i].content_id < num_contents;
+            }
+            if (!task_ok) {
+                ok = false;
+            }
+        };
+
+        if (pool != nullptr) {
+            pool->parallel_for(num_tasks, task);
+        }
+        else {
+            task(0);
+        }
+        return ok;
+    }
+
+    //按需读取请求的时间戳，请求不在内存中时缓存最近读入的一块请求
+    class TimestampReader
+    {
+    private:
+        const RequestLoader *loader;
+        vector<Request> chunk;
+        size_t chunk_beg = 0;
+
+        static constexpr size_t chunk_size = 4096;
+
+    public:
+        explicit TimestampReader(const RequestLoader *loader) : loader(loader) {}
+
+        inline TimestampType operator()(size_t i)
+        {
+            if (!loader->is_streaming()) {
+                return loader->requests[i].timestamp;
+            }
+            if (i < chunk_beg || i >= chunk_beg + chunk.size()) {
+                chunk_beg = i;
+                chunk.resize(std::min(chunk_size, loader->num_requests - i));
+                loader->read_requests(chunk_beg, chunk.size(), chunk.data());
+            }
+            return chunk[i - chunk_beg].timestamp;
+        }
+    };
+
+    //从lo开始查找第一个时间戳不小于t的请求：先倍增步长找到区间，再二分，耗时与跳过的请求数成对数关系
+    size_t lower_bound_timestamp(TimestampReader &timestamp_at, int64_t t, size_t lo) const
+    {
+        auto n = this->num_requests;
+        if (lo >= n || timestamp_at(lo) >= t) {
+            return lo;
+        }
+
+        //时间片通常很短，先逐个检查后面的几个请求
+        for (size_t i = 0; i < 8; i++) {
+            if (++lo >= n || timestamp_at(lo) >= t) {
+                return lo;
+            }
+        }
+
+        //此时timestamp_at(lo) < t
+        size_t step = 1, hi = lo + 1;
+        while (hi < n && timestamp_at(hi) < t) {
+            lo = hi;
+            step <<= 1;
+            hi = lo + step;
+        }
+        hi = std::min(hi, n);
+
+        //timestamp_at(lo) < t，且hi == n或timestamp_at(hi) >= t
+        while (hi - lo > 1) {
+            auto mid = lo + (hi - lo) / 2;
+            if (timestamp_at(mid) < t) {
+                lo = mid;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return hi;
+    }
+
+    /**
+     * 建立slice_ptrs：第0个时间片从first_ptr开始，第i个时间片在第一个时间戳不小于end_time(i)的请求处结束。
+     * 时间片被分成若干段，每段先二分查找起点，再逐个时间片倍增查找终点，各段可以在线程池中并行处理
+     */
+    void build_slice_ptrs(size_t num_slices, size_t first_ptr, const function<int64_t(size_t)> &end_time,
+                          ThreadPool *pool)
+    {
+        this->slice_ptrs.assign(num_slices, {0, 0});
+
+        size_t num_tasks = pool == nullptr ? 1 : std::min(num_slices, 4 * pool->get_num_threads());
+        num_tasks = std::max(num_tasks, (size_t) 1);
+
+        auto task = [&](size_t k) {
+            auto s_beg = num_slices * k / num_tasks, s_end = num_slices * (k + 1) / num_tasks;
+            TimestampReader timestamp_at(this);
+
+            auto ptr = s_beg == 0 ? first_ptr : this->lower_bound_timestamp(timestamp_at, end_time(s_beg - 1), first_ptr);
+            for (auto i = s_beg; i < s_end; i++) {
+                auto ptr_end = this->lower_bound_timestamp(timestamp_at, end_time(i), ptr);
+                this->slice_ptrs[i] = {ptr, ptr_end};
+                ptr = ptr_end;
+            }
+        };
+
+        if (pool != nullptr) {
+            pool->parallel_for(num_tasks, task);
+        }
+        else {
+            task(0);
+        }
+
+        this->update_max_slice_size();
+    }
+
+    void update_max_slice_size()
+    {
+        this->max_slice_size = 0;
+        for (auto &ptrs: this->slice_ptrs) {
+            this->max_slice_size = std::max(this->max_slice_size, ptrs.second - ptrs.first);
+        }
+    }
+
+    //检查请求按时间戳排序，且每个时间片中的请求都落在时间片的时间范围内，仅在调试时执行
+    void check_slices(const function<int64_t(size_t)> &end_time)
+    {
+        TimestampReader timestamp_at(this);
+        for (size_t i = 0; i < this->slice_ptrs.size(); i++) {
+            auto ptrs = this->slice_ptrs[i];
+            for (auto j = ptrs.first; j < ptrs.second; j++) {
+                ASSERT(j == 0 || timestamp_at(j - 1) <= timestamp_at(j));
+                ASSERT(timestamp_at(j) < end_time(i));
+                ASSERT(i == 0 || timestamp_at(j) >= end_time(i - 1));
+            }
+        }
+    }
+
+    //参数无效时清空分片
+    void clear_slices()
+    {
+        this->slice_ptrs.clear();
+        this->max_slice_size = 0;
+    }
+
+public:
+    //检查slice_by_time的参数，返回空字符串表示有效，否则返回错误原因
+    static string check_time_slicing(TimestampType t_beg, TimestampType t_end, TimestampType t_interval)
+    {
+        if (t_interval <= 0) {
+            return "interval must be positive";
+        }
+        if (t_end < t_beg) {
+            return "t_end must not be earlier than t_beg";
+        }
+        return "";
+    }
+
+    //检查slice_by_boundaries的参数，返回空字符串表示有效，否则返回错误原因
+    static string check_boundaries(const TimestampType *boundaries, size_t size)
+    {
+        for (size_t i = 1; i < size; i++) {
+            if (boundaries[i - 1] >= boundaries[i]) {
+                return "boundaries must be strictly increasing";
+            }
+        }
+        return "";
     }
 
-    //按时间分片
-    size_t slice_by_time(TimestampType t_beg, TimestampType t_end, TimestampType t_interval)
+    //检查slice_by_count的参数，返回空字符串表示有效，否则返回错误原因
+    static string check_count_slicing(size_t num_requests_per_slice)
     {
+        return num_requests_per_slice == 0 ? "num_requests_per_slice must be positive" : "";
+    }
+
+    /**
+     * 按时间分片，第i个时间片包含时间戳在[t_beg + i * t_interval, t_beg + (i + 1) * t_interval)中的请求，
+     * 早于t_beg的请求归入第0个时间片。请求必须按时间戳排序
+     * @param pool  不为空时在线程池中并行查找各时间片的边界
+     * @return      时间片的个数；参数无效（见check_time_slicing）时打印原因、清空分片并返回0
+     */
+    size_t slice_by_time(TimestampType t_beg, TimestampType t_end, TimestampType t_interval, ThreadPool *pool = nullptr)
+    {
+        auto error = check_time_slicing(t_beg, t_end, t_interval);
+        if (!error.empty()) {
+            cout << "slice_by_time: " << error << endl;
+            this->clear_slices();
+            return 0;
+        }
+
         this->timestamp_beg = t_beg;
         this->timestamp_end = t_end;
         this->timestamp_interval = t_interval;
@@ -70,43 +722,80 @@ public:
         // 计算分片数量
         size_t num_slices = ceil(1.0 * (t_end - t_beg) / t_interval);
 
-        // 分片指针，表示一个分片的起始于终止位置
-        size_t ptr_beg = 0, ptr_end = 0;
+        auto end_time = [=](size_t i) {
+            return (int64_t) t_beg + (int64_t) (i + 1) * t_interval;
+        };
+        this->build_slice_ptrs(num_slices, 0, end_time, pool);
 
-        // 记录时间
-        TimestampType last_time = t_beg;
+        if (DEBUG) {
+            this->check_slices(end_time);
+        }
 
-        for (size_t i = 0; i < num_slices; ++i) {
-            TimestampType next_time = last_time + t_interval;
-            while (ptr_end < this->get_num_requests()
-                   && this->requests[ptr_end].timestamp < next_time) {
-                ptr_end++;
-            }
-            this->slice_ptrs.emplace_back(ptr_beg, ptr_end);
-            ptr_beg = ptr_end;
+        return num_slices;
+    }
 
-            last_time = next_time;
+    /**
+     * 按给定的时间边界分片，第i个时间片包含时间戳在[boundaries[i], boundaries[i + 1])中的请求
+     * @param boundaries    严格递增的时间边界
+     * @param size          边界个数，时间片个数为size - 1
+     * @return              时间片的个数；边界不严格递增时打印原因、清空分片并返回0
+     */
+    size_t slice_by_boundaries(const TimestampType *boundaries, size_t size, ThreadPool *pool = nullptr)
+    {
+        auto error = check_boundaries(boundaries, size);
+        if (!error.empty()) {
+            cout << "slice_by_boundaries: " << error << endl;
+        }
+        if (size < 2 || !error.empty()) {
+            this->clear_slices();
+            return 0;
         }
 
-        //检查同一个slice里面的所有请求是否能被get_i_slice_by_timestamp映射到一块
-        for (size_t i = 0; i < num_slices; i++) {
-            auto ptrs = this->get_slice_range_ptrs(i);
-            auto slice = this->get_slice(ptrs.first, ptrs.second);
+        //get_i_slice_by_timestamp只适用于等间隔的时间片，这里只记录时间范围
+        this->timestamp_beg = boundaries[0];
+        this->timestamp_end = boundaries[size - 1];
+        this->timestamp_interval = boundaries[size - 1] - boundaries[0];
 
-            if (slice.size != 0) {
-                int t_slice_0 = this->get_i_slice_by_timestamp(slice.get(0).timestamp);
+        TimestampReader timestamp_at(this);
+        auto first_ptr = this->lower_bound_timestamp(timestamp_at, boundaries[0], 0);
+        auto end_time = [=](size_t i) {
+            return (int64_t) boundaries[i + 1];
+        };
+        this->build_slice_ptrs(size - 1, first_ptr, end_time, pool);
 
-                for (int j = 1; j < slice.size; ++j) {
-                    auto t_slice_j = this->get_i_slice_by_timestamp(slice.get(j).timestamp);
-                    ASSERT(t_slice_0 == t_slice_j);
-                }
-            }
+        if (DEBUG) {
+            this->check_slices(end_time);
+        }
+
+        return size - 1;
+    }
+
+    /**
+     * 按请求数分片，每个时间片包含连续的num_requests_per_slice个请求（最后一个时间片可能更少）
+     * @return  时间片的个数；num_requests_per_slice为0时打印原因、清空分片并返回0
+     */
+    size_t slice_by_count(size_t num_requests_per_slice)
+    {
+        auto error = check_count_slicing(num_requests_per_slice);
+        if (!error.empty()) {
+            cout << "slice_by_count: " << error << endl;
+            this->clear_slices();
+            return 0;
         }
 
+        auto n = this->num_requests;
+        auto num_slices = (n + num_requests_per_slice - 1) / num_requests_per_slice;
+
+        this->slice_ptrs.resize(num_slices);
+        for (size_t i = 0; i < num_slices; i++) {
+            this->slice_ptrs[i] = {i * num_requests_per_slice, std::min((i + 1) * num_requests_per_slice, n)};
+        }
+        this->update_max_slice_size();
+
         return num_slices;
     }
 
-    //根据时间戳得到请求所在的slice的编号
+    //根据时间戳得到请求所在的slice的编号，只适用于slice_by_time
     inline int get_i_slice_by_timestamp(TimestampType t)
     {
         ASSERT(t >= timestamp_beg && t <= timestamp_end);
@@ -120,19 +809,35 @@ public:
         return this->slice_ptrs[i_slice];
     }
 
-    //根据起始与终止指针获取片段
+    //根据起始与终止指针获取片段，流式读取时不可用
     inline Slice get_slice(size_t ptr_beg, size_t ptr_end)
     {
+        ASSERT(!this->is_streaming());
         ASSERT((ptr_beg <= ptr_end) && (ptr_end <= this->get_num_requests()));
-        auto data = &this->requests[ptr_beg];
+        auto data = this->requests + ptr_beg;
         auto size = ptr_end - ptr_beg;
         return Slice(data, size);
     }
 
+    //获取片段，请求在内存中时直接返回，否则读入buf，返回的片段在buf被修改前有效；
+    //cursor用于按顺序读取压缩的请求时从上一次结束的位置继续解码
+    inline Slice read_slice(size_t ptr_beg, size_t ptr_end, vector<Request> &buf,
+                            CompressedTrace::Cursor *cursor = nullptr)
+    {
+        if (!this->is_streaming()) {
+            return this->get_slice(ptr_beg, ptr_end);
+        }
+
+        ASSERT((ptr_beg <= ptr_end) && (ptr_end <= this->get_num_requests()));
+        buf.resize(ptr_end - ptr_beg);
+        this->read_requests(ptr_beg, buf.size(), buf.data(), cursor);
+        return Slice(buf.data(), buf.size());
+    }
+
     //请求数量
     inline size_t get_num_requests()
     {
-        return this->requests.size();
+        return this->num_requests;
     }
 
     //片段数量
@@ -140,4 +845,93 @@ public:
     {
         return slice_ptrs.size();
     }
+
+    //最大的片段长度
+    inline size_t get_max_slice_size()
+    {
+        return this->max_slice_size;
+    }
+};
+
+/**
+ * 模拟器私有的时间片缓存，保存最近读取的若干个时间片。
+ * 请求在内存中时直接返回loader中的片段；流式读取时按需从文件读入，
+ * 槽位数由需要回看历史时间片的特征（滑动窗口）决定，因此内存占用与请求序列长度无关
+ */
+class SliceRing
+{
+private:
+    RequestLoader *loader;
+
+    vector<vector<Request>> bufs;   //每个槽位的请求
+    vector<size_t> slot_slices;     //每个槽位保存的时间片编号，NoneSlice表示空槽位
+    vector<Request> scratch;        //已被淘汰的时间片临时读入这里
+    CompressedTrace::Cursor cursor; //按顺序读取新的时间片时的解码位置
+
+    static constexpr size_t NoneSlice = SIZE_MAX;
+
+public:
+    explicit SliceRing(RequestLoader *loader) : loader(loader), bufs(1), slot_slices(1, NoneSlice) {}
+
+    //保证最近history_len个时间片（不含当前时间片）仍在缓存中
+    void reserve_history(size_t history_len)
+    {
+        //当前时间片、history_len个历史时间片以及将被淘汰的一个时间片
+        auto num_slots = history_len + 2;
+        if (num_slots > bufs.size()) {
+            bufs.resize(num_slots);
+            slot_slices.assign(num_slots, NoneSlice);
+        }
+    }
+
+    inline size_t get_num_slots() const
+    {
+        return bufs.size();
+    }
+
+    //流式读取时常驻内存的请求数
+    size_t get_num_resident_requests() const
+    {
+        size_t n = scratch.capacity();
+        for (auto &buf: bufs) {
+            n += buf.capacity();
+        }
+        return n;
+    }
+
+    void reset()
+    {
+        std::fill(slot_slices.begin(), slot_slices.end(), NoneSlice);
+        cursor = CompressedTrace::Cursor();
+    }
+
+    //获取第i_slice个时间片，返回的片段在读取更新的时间片之前有效
+    inline Slice get(size_t i_slice)
+    {
+        auto slice = this->read(i_slice);
+        slice.i_slice = i_slice;
+        return slice;
+    }
+
+private:
+    inline Slice read(size_t i_slice)
+    {
+        auto ptrs = loader->get_slice_range_ptrs(i_slice);
+        if (!loader->is_streaming()) {
+            return loader->get_slice(ptrs.first, ptrs.second);
+        }
+
+        auto slot = i_slice % bufs.size();
+        if (slot_slices[slot] == i_slice) {
+            return Slice(bufs[slot].data(), bufs[slot].size());
+        }
+
+        //比槽位中的时间片更早的时间片已被淘汰，不再放回缓存
+        if (slot_slices[slot] != NoneSlice && slot_slices[slot] > i_slice) {
+            return loader->read_slice(ptrs.first, ptrs.second, scratch);
+        }
+
+        slot_slices[slot] = i_slice;
+        return loader->read_slice(ptrs.first, ptrs.second, bufs[slot], &cursor);
+    }
 };
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#else
+#define SIMD_X86 0
+#endif
+
+using namespace std;
+
+#include "utils.h"
+
+/**
+ * 特征提取中按内容ID批量查表的核心循环。
+ * 表为StampedVector::raw_slots()返回的槽位数组，每个槽位依次为世代与32位的值；
+ * 或StampedRows::raw_slots()返回的行数组，每行占row_words个字，第0个字为世代，读取其中第value_index个字。
+ * 世代过期或ID不在[0, size)中的内容读出默认值。
+ * 结果写入out[i * stride]，stride为1时连续写入。
+ * x86上在运行时检测AVX2，可用时每次处理8个内容，结果与标量实现逐位一致
+ */
+
+//是否使用AVX2，编译时可以通过-DUSE_AVX2=0关闭
+#ifndef USE_AVX2
+#define USE_AVX2 1
+#endif
+
+//运行时是否允许使用AVX2，用于基准测试中与标量实现对比
+inline bool &simd_avx2_allowed()
+{
+    static bool allowed = true;
+    return allowed;
+}
+
+inline bool simd_has_avx2()
+{
+#if SIMD_X86 && USE_AVX2
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2 && simd_avx2_allowed();
+#else
+    return false;
+#endif
+}
+
+//单个内容：(float) ((double) (float) (value + offset) / divisor)
+inline float gather_affine_one(const uint32_t *slots, size_t row_words, size_t value_index, size_t size,
+                               uint32_t generation, int32_t default_value, ContentType key, int32_t offset,
+                               double divisor)
+{
+    auto value = default_value;
+    if (key >= 0 && (size_t) key < size && slots[row_words * key] == generation) {
+        value = (int32_t) slots[row_words * key + value_index];
+    }
+    return (float) ((double) (float) (value + offset) / divisor);
+}
+
+//单个内容：句柄有效时为(float) (ws[handle] * scale)，否则为0
+inline float gather_scaled_one(const uint32_t *slots, size_t size, uint32_t generation, uint32_t none_handle,
+                               const float *ws, ContentType key, double scale)
+{
+    if (key >= 0 && (size_t) key < size && slots[2 * key] == generation && slots[2 * key + 1] != none_handle) {
+        return (float) (ws[slots[2 * key + 1]] * scale);
+    }
+    return 0;
+}
+
+#if SIMD_X86
+
+//将8个结果写入out[i * stride]
+__attribute__((target("avx2")))
+inline void simd_store_strided(__m256 f, float *out, size_t stride)
+{
+    if (stride == 1) {
+        _mm256_storeu_ps(out, f);
+        return;
+    }
+    alignas(32) float buf[8];
+    _mm256_store_ps(buf, f);
+    for (size_t k = 0; k < 8; k++) {
+        out[k * stride] = buf[k];
+    }
+}
+
+//读取8个内容的槽位，返回有效（ID在表中且世代未过期）的掩码，值写入value
+__attribute__((target("avx2")))
+inline __m256i simd_gather_slots(const uint32_t *slots, size_t row_words, size_t value_index, size_t size,
+                                 uint32_t generation, const ContentType *keys, __m256i &value)
+{
+    auto k = _mm256_loadu_si256((const __m256i *) keys);
+    auto in_table = _mm256_and_si256(_mm256_cmpgt_epi32(k, _mm256_set1_epi32(-1)),
+                                     _mm256_cmpgt_epi32(_mm256_set1_epi32((int32_t) size), k));
+    auto idx = _mm256_mullo_epi32(k, _mm256_set1_epi32((int32_t) row_words));
+    auto base = (const int *) slots;
+    auto stamp = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base, idx, in_table, 4);
+    value = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base + value_index, idx, in_table, 4);
+    return _mm256_and_si256(in_table, _mm256_cmpeq_epi32(stamp, _mm256_set1_epi32((int32_t) generation)));
+}
+
+__attribute__((target("avx2")))
+inline size_t gather_affine_avx2(const uint32_t *slots, size_t row_words, size_t value_index, size_t size,
+                                 uint32_t generation, int32_t default_value, const ContentType *keys, size_t n,
+                                 int32_t offset, double divisor, float *out, size_t stride)
+{
+    auto div = _mm256_set1_pd(divisor);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i value;
+        auto live = simd_gather_slots(slots, row_words, value_index, size, generation, keys + i, value);
+        value = _mm256_blendv_epi8(_mm256_set1_epi32(default_value), value, live);
+        auto f = _mm256_cvtepi32_ps(_mm256_add_epi32(value, _mm256_set1_epi32(offset)));
+        if (divisor != 1) {
+            auto lo = _mm256_div_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(f)), div);
+            auto hi = _mm256_div_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)), div);
+            f = _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+        }
+        simd_store_strided(f, out + i * stride, stride);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+inline size_t gather_scaled_avx2(const uint32_t *slots, size_t size, uint32_t generation, uint32_t none_handle,
+                                 const float *ws, const ContentType *keys, size_t n, double scale,
+                                 float *out, size_t stride)
+{
+    auto s = _mm256_set1_pd(scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i handle;
+        auto live = simd_gather_slots(slots, 2, 1, size, generation, keys + i, handle);
+        live = _mm256_andnot_si256(_mm256_cmpeq_epi32(handle, _mm256_set1_epi32((int32_t) none_handle)), live);
+        auto w = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), ws, handle, _mm256_castsi256_ps(live), 4);
+        auto lo = _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(w)), s);
+        auto hi = _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(w, 1)), s);
+        auto f = _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+        //无效的内容取0，而不是0 * scale（scale为负无穷或NaN时两者不同）
+        f = _mm256_and_ps(f, _mm256_castsi256_ps(live));
+        simd_store_strided(f, out + i * stride, stride);
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * 按行读取：out[i * stride] = (float) ((double) (float) (value(keys[i]) + offset) / divisor)，
+ * 其中value为第keys[i]行的第value_index个字
+ */
+inline void gather_affine_rows(const uint32_t *slots, size_t row_words, size_t value_index, size_t size,
+                               uint32_t generation, int32_t default_value, const ContentType *keys, size_t n,
+                               int32_t offset, double divisor, float *out, size_t stride)
+{
+    size_t i = 0;
+#if SIMD_X86
+    //下标按32位有符号数计算，表的总字数需小于2^31
+    if (simd_has_avx2() && size * row_words < ((size_t) 1 << 31)) {
+        i = gather_affine_avx2(slots, row_words, value_index, size, generation, default_value, keys, n, offset,
+                               divisor, out, stride);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i * stride] = gather_affine_one(slots, row_words, value_index, size, generation, default_value, keys[i],
+                                            offset, divisor);
+    }
+}
+
+/**
+ * out[i * stride] = (float) ((double) (float) (value(keys[i]) + offset) / divisor)，
+ * 用于LFU（计数）、LRU（最后访问时间减去当前时间）与SWLfu（计数除以窗口内请求数）特征
+ */
+inline void gather_affine(const uint32_t *slots, size_t size, uint32_t generation, int32_t default_value,
+                          const ContentType *keys, size_t n, int32_t offset, double divisor,
+                          float *out, size_t stride)
+{
+    gather_affine_rows(slots, 2, 1, size, generation, default_value, keys, n, offset, divisor, out, stride);
+}
+
+/**
+ * 槽位的值为ws中的下标，out[i * stride] = (float) (ws[handle(keys[i])] * scale)，无效句柄取0，
+ * 用于OGD特征
+ */
+inline void gather_scaled(const uint32_t *slots, size_t size, uint32_t generation, uint32_t none_handle,
+                          const float *ws, const ContentType *keys, size_t n, double scale,
+                          float *out, size_t stride)
+{
+    size_t i = 0;
+#if SIMD_X86
+    if (simd_has_avx2() && size * 2 < ((size_t) 1 << 31)) {
+        i = gather_scaled_avx2(slots, size, generation, none_handle, ws, keys, n, scale, out, stride);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i * stride] = gather_scaled_one(slots, size, generation, none_handle, ws, keys[i], scale);
+    }
+}
@@ -0,0 +1,576 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+using namespace std;
+
+#include "utils.h"
+#include "request.hpp"
+
+static constexpr uint32_t NoneStackSlot = UINT32_MAX;
+
+//内容到其最近一次被请求的槽位的映射，以稠密ID为下标，适用于统计所有内容
+class DenseSlotMap
+{
+private:
+    vector<uint32_t> slots;
+
+public:
+    void reset(size_t num_contents, size_t)
+    {
+        slots.assign(num_contents, NoneStackSlot);
+    }
+
+    inline uint32_t get(ContentType e) const
+    {
+        return slots[e];
+    }
+
+    inline void set(ContentType e, uint32_t slot)
+    {
+        slots[e] = slot;
+    }
+
+    inline void erase(ContentType e)
+    {
+        slots[e] = NoneStackSlot;
+    }
+
+    inline size_t get_num_bytes() const
+    {
+        return slots.capacity() * sizeof(uint32_t);
+    }
+};
+
+/**
+ * 内容到其最近一次被请求的槽位的映射，以开放寻址哈希表（线性探测）保存，内存只与被统计的内容数有关。
+ * 表按预计的内容数一次分配，装载率不超过1/2，超出时才加倍；删除时将后续的元素前移，不留墓碑
+ */
+class HashSlotMap
+{
+private:
+    struct Entry
+    {
+        ContentType key;  //NoneContentType表示空槽位
+        uint32_t slot;
+    };
+
+    vector<Entry> entries;
+    size_t mask = 0;
+    size_t num_used = 0;
+    int shift = 64;
+
+    static constexpr size_t min_entries = 16;
+
+    inline size_t home(ContentType key) const
+    {
+        //Fibonacci哈希，与ContentTable相同
+        return (size_t) (((uint64_t) (uint32_t) key * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    //查找key所在的位置，不存在时返回探测结束处的空槽位
+    inline size_t probe(ContentType key) const
+    {
+        size_t i = home(key);
+        while (entries[i].key != NoneContentType && entries[i].key != key) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    inline void rehash(size_t num_entries)
+    {
+        vector<Entry> old_entries(num_entries, Entry{NoneContentType, NoneStackSlot});
+        old_entries.swap(entries);
+
+        mask = num_entries - 1;
+        shift = 64;
+        for (size_t n = num_entries; n > 1; n >>= 1) {
+            shift--;
+        }
+        for (auto &entry: old_entries) {
+            if (entry.key != NoneContentType) {
+                entries[probe(entry.key)] = entry;
+            }
+        }
+    }
+
+public:
+    //清空映射，并按expected_size个内容分配哈希表
+    void reset(size_t, size_t expected_size)
+    {
+        size_t num_entries = min_entries;
+        while (num_entries < 2 * (expected_size + 1)) {
+            num_entries <<= 1;
+        }
+        entries.clear();
+        num_used = 0;
+        rehash(num_entries);
+    }
+
+    inline uint32_t get(ContentType e) const
+    {
+        auto &entry = entries[probe(e)];
+        return entry.key == e ? entry.slot : NoneStackSlot;
+    }
+
+    inline void set(ContentType e, uint32_t slot)
+    {
+        auto i = probe(e);
+        if (entries[i].key == e) {
+            entries[i].slot = slot;
+            return;
+        }
+
+        if (2 * (num_used + 1) > entries.size()) {
+            rehash(2 * entries.size());
+            i = probe(e);
+        }
+        entries[i] = {e, slot};
+        num_used++;
+    }
+
+    inline void erase(ContentType e)
+    {
+        auto i = probe(e);
+        if (entries[i].key != e) {
+            return;
+        }
+
+        //后续元素的起始位置不在(i, j]之间时，可以前移到i而不破坏探测序列
+        for (size_t j = (i + 1) & mask; entries[j].key != NoneContentType; j = (j + 1) & mask) {
+            if (((j - home(entries[j].key)) & mask) >= ((j - i) & mask)) {
+                entries[i] = entries[j];
+                i = j;
+            }
+        }
+        entries[i] = {NoneContentType, NoneStackSlot};
+        num_used--;
+    }
+
+    inline size_t get_num_bytes() const
+    {
+        return entries.capacity() * sizeof(Entry);
+    }
+};
+
+/**
+ * 栈距离计数器：每个内容最近一次被请求的时刻在树状数组中记为1，两次请求之间的栈距离即其间标记的个数加一。
+ * 时刻只占用约2倍于标记个数的槽位，用完后将仍有标记的槽位压缩到前面，每次请求的复杂度为O(log M)
+ */
+template<class SlotMap>
+class StackDistanceCounter
+{
+private:
+    SlotMap last_slots;
+    vector<int32_t> tree;               //树状数组，下标从1开始
+    vector<ContentType> slot_contents;  //每个槽位上的内容
+    uint32_t next_slot = 1;
+    uint32_t num_marks = 0;             //被统计的内容数，即所有标记的个数
+
+    inline void add(uint32_t i, int32_t v)
+    {
+        for (; i < tree.size(); i += i & -i) {
+            tree[i] += v;
+        }
+    }
+
+    //槽位1..i中的标记个数
+    inline uint32_t prefix_sum(uint32_t i) const
+    {
+        int32_t s = 0;
+        for (; i > 0; i -= i & -i) {
+            s += tree[i];
+        }
+        return (uint32_t) s;
+    }
+
+    //槽位用完时，将有标记的槽位按顺序压缩到1..num_marks，并以线性时间重建树状数组；
+    //标记超过槽位数的一半时槽位数加倍
+    void compact()
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 1; i < next_slot; i++) {
+            auto e = slot_contents[i];
+            if (e != NoneContentType && last_slots.get(e) == i) {
+                slot_contents[++n] = e;
+                last_slots.set(e, n);
+            }
+        }
+        ASSERT(n == num_marks);
+
+        if (2 * (size_t) n + 1 > tree.size()) {
+            tree.resize(4 * (size_t) n + 1);
+            slot_contents.resize(tree.size());
+        }
+        std::fill(slot_contents.begin() + n + 1, slot_contents.end(), NoneContentType);
+
+        std::fill(tree.begin(), tree.end(), 0);
+        std::fill(tree.begin() + 1, tree.begin() + n + 1, 1);
+        for (uint32_t i = 1; i < tree.size(); i++) {
+            auto j = i + (i & -i);
+            if (j < tree.size()) {
+                tree[j] += tree[i];
+            }
+        }
+        next_slot = n + 1;
+    }
+
+public:
+    //清空计数器，expected_marks为预计的内容数，用于分配槽位
+    void reset(size_t num_contents, size_t expected_marks)
+    {
+        auto num_slots = std::max(2 * expected_marks, (size_t) 1024);
+        last_slots.reset(num_contents, expected_marks);
+        tree.assign(num_slots + 1, 0);
+        slot_contents.assign(num_slots + 1, NoneContentType);
+        next_slot = 1;
+        num_marks = 0;
+    }
+
+    //处理一个请求，返回栈距离，首次请求返回0
+    inline uint32_t access(ContentType e)
+    {
+        if (next_slot == tree.size()) {
+            compact();
+        }
+
+        uint32_t distance = 0;
+        auto last = last_slots.get(e);
+        if (last != NoneStackSlot) {
+            //last之后的标记都对应在此之后被请求过的不同内容
+            distance = num_marks - prefix_sum(last) + 1;
+            add(last, -1);
+            slot_contents[last] = NoneContentType;
+        }
+        else {
+            num_marks++;
+        }
+
+        add(next_slot, 1);
+        slot_contents[next_slot] = e;
+        last_slots.set(e, next_slot);
+        next_slot++;
+
+        return distance;
+    }
+
+    //不再统计内容e，之后它的请求视为首次请求
+    inline void remove(ContentType e)
+    {
+        auto last = last_slots.get(e);
+        if (last != NoneStackSlot) {
+            add(last, -1);
+            slot_contents[last] = NoneContentType;
+            last_slots.erase(e);
+            num_marks--;
+        }
+    }
+
+    inline size_t size() const
+    {
+        return num_marks;
+    }
+
+    //占用的内存字节数
+    inline size_t get_num_bytes() const
+    {
+        return last_slots.get_num_bytes() + tree.capacity() * sizeof(int32_t)
+               + slot_contents.capacity() * sizeof(ContentType);
+    }
+};
+
+/**
+ * Mattson栈距离分析：一遍扫描请求序列，得到LRU在所有缓存容量下的命中率（即缺失率曲线），
+ * 容量为c的LRU缓存命中当且仅当栈距离不超过c，总复杂度为O(N log M)。
+ * run统计所有请求；run_sampled按SHARDS（Waldspurger et al., FAST 2015）的方法只统计内容哈希值
+ * 低于阈值的请求，栈距离按采样率放大，内存只与被采样的内容数有关
+ */
+class StackDistanceProfiler
+{
+private:
+    //SHARDS中哈希值的取值范围
+    static constexpr uint64_t HashModulus = (uint64_t) 1 << 24;
+
+    FloatVector hit_ratios;          //hit_ratios[c]为容量为c时的命中率
+    FloatVector slice_hit_ratios;    //每个时间片在给定容量下的命中率，按时间片、容量的顺序排列
+    double sampling_rate = 1;        //最后一次分析结束时的采样率
+    size_t num_bytes = 0;            //最后一次分析中栈距离计数器与直方图占用的内存
+
+    //按容量从小到大统计每个时间片中栈距离落在相邻两个容量之间的请求数
+    class SliceHitCounter
+    {
+    private:
+        const int *capacities;
+        vector<size_t> order;
+        vector<double> sorted_capacities;
+        vector<size_t> bucket_counts;
+        FloatVector *out;
+
+    public:
+        SliceHitCounter(const int *capacities, size_t num_capacities, size_t num_slices, FloatVector *out)
+                : capacities(capacities), order(num_capacities), bucket_counts(num_capacities + 1), out(out)
+        {
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return capacities[a] < capacities[b];
+            });
+            for (auto k: order) {
+                sorted_capacities.push_back((double) std::max(capacities[k], 0));
+            }
+            out->assign(num_slices * num_capacities, 0);
+        }
+
+        inline bool empty() const
+        {
+            return order.empty();
+        }
+
+        inline void begin_slice()
+        {
+            std::fill(bucket_counts.begin(), bucket_counts.end(), 0);
+        }
+
+        //记录一次非首次请求，distance为（放大后的）栈距离
+        inline void add(double distance)
+        {
+            auto k = std::lower_bound(sorted_capacities.begin(), sorted_capacities.end(), distance)
+                     - sorted_capacities.begin();
+            bucket_counts[k]++;
+        }
+
+        //第i_slice个时间片结束，num_requests为其中被统计的请求数
+        inline void end_slice(size_t i_slice, size_t num_requests)
+        {
+            size_t num_hits = 0;
+            for (size_t k = 0; k < order.size(); k++) {
+                num_hits += bucket_counts[k];
+                (*out)[i_slice * order.size() + order[k]] = (float) num_hits / (num_requests + EPS);
+            }
+        }
+    };
+
+    //SHARDS使用的内容哈希值，取值范围为[0, HashModulus)
+    static inline uint64_t hash_content(ContentType e)
+    {
+        //splitmix64
+        uint64_t x = (uint64_t) (uint32_t) e + 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return (x ^ (x >> 31)) & (HashModulus - 1);
+    }
+
+public:
+    /**
+     * 扫描loader中所有时间片的请求，统计所有请求的栈距离
+     * @param capacities        需要按时间片统计命中率的容量，可以为空
+     * @param num_capacities    容量个数
+     * @return  处理的请求数
+     */
+    size_t run(RequestLoader &loader, const int *capacities = nullptr, size_t num_capacities = 0)
+    {
+        auto num_contents = loader.get_num_contents();
+        auto num_slices = loader.get_num_slices();
+
+        StackDistanceCounter<DenseSlotMap> counter;
+        counter.reset(num_contents, num_contents);
+        vector<uint64_t> histogram(num_contents + 1, 0);  //histogram[d]为栈距离为d的请求数，下标0为首次请求
+        SliceHitCounter slice_hits(capacities, num_capacities, num_slices, &slice_hit_ratios);
+
+        size_t num_requests = 0;
+        vector<Request> buf;
+        CompressedTrace::Cursor cursor;
+        for (size_t i = 0; i < num_slices; i++) {
+            auto ptrs = loader.get_slice_range_ptrs(i);
+            auto slice = loader.read_slice(ptrs.first, ptrs.second, buf, &cursor);
+
+            slice_hits.begin_slice();
+            for (size_t j = 0; j < slice.size; j++) {
+                auto distance = counter.access(slice.data[j].content_id);
+                histogram[distance]++;
+                if (!slice_hits.empty() && distance > 0) {
+                    slice_hits.add(distance);
+                }
+            }
+            slice_hits.end_slice(i, slice.size);
+            num_requests += slice.size;
+        }
+
+        hit_ratios.assign(num_contents + 1, 0);
+        uint64_t num_hits = 0;
+        for (size_t c = 1; c <= num_contents; c++) {
+            num_hits += histogram[c];
+            hit_ratios[c] = (float) num_hits / (num_requests + EPS);
+        }
+
+        sampling_rate = 1;
+        num_bytes = counter.get_num_bytes() + histogram.capacity() * sizeof(uint64_t);
+        return num_requests;
+    }
+
+    /**
+     * 按内容哈希采样估计命中率曲线（SHARDS），结果的格式与run相同。
+     * 容量小于1 / rate（采样后的栈距离小于1）时的结果不可靠：这部分命中率由少数热门内容决定，
+     * 它们是否被采样带来的偏差全部由SHARDS-adj计入栈距离1，再按容量线性插值，
+     * 例如Zipf分布α = 1.2、采样率0.1时容量10处的误差可达±0.3；需要小容量的命中率时应使用run
+     * @param rate          采样率，取值范围(0, 1]；max_samples不为0时为初始采样率
+     * @param max_samples   为0时固定采样率；否则最多同时统计max_samples个内容，
+     *                      超出时降低采样率并移除哈希值最大的内容，内存上限与max_samples成正比
+     * @param capacities        需要按时间片统计命中率的容量，可以为空
+     * @param num_capacities    容量个数
+     * @return  处理的请求数（包括未被采样的请求）
+     */
+    size_t run_sampled(RequestLoader &loader, double rate, size_t max_samples,
+                       const int *capacities = nullptr, size_t num_capacities = 0)
+    {
+        ASSERT(rate > 0 && rate <= 1);
+
+        auto num_contents = loader.get_num_contents();
+        auto num_slices = loader.get_num_slices();
+
+        //哈希值低于threshold的内容被采样，采样率为threshold / HashModulus
+        auto threshold = std::max((uint64_t) (rate * HashModulus), (uint64_t) 1);
+        rate = (double) threshold / HashModulus;
+        bool fixed_size = max_samples > 0;
+
+        auto expected_samples = fixed_size ? max_samples : (size_t) (rate * num_contents) + 1;
+        StackDistanceCounter<HashSlotMap> counter;
+        counter.reset(num_contents, expected_samples);
+
+        //固定采样个数时，被采样的内容按哈希值组成最大堆，降低阈值时从堆顶移除
+        vector<pair<uint64_t, ContentType>> samples;
+
+        //直方图以采样率base_rate下的栈距离为下标，下标0为首次请求，实际的计数为直方图中的值乘以count_scale。
+        //降低采样率时只需缩小count_scale，采样率低于base_rate的一半时才按新的采样率重排直方图
+        double base_rate = rate;
+        double count_scale = 1;
+        vector<double> histogram(expected_samples + 2, 0);
+        double num_sampled = 0;  //被采样的请求数，按当前采样率折算
+        SliceHitCounter slice_hits(capacities, num_capacities, num_slices, &slice_hit_ratios);
+
+        size_t num_requests = 0;
+        vector<Request> buf;
+        CompressedTrace::Cursor cursor;
+        for (size_t i = 0; i < num_slices; i++) {
+            auto ptrs = loader.get_slice_range_ptrs(i);
+            auto slice = loader.read_slice(ptrs.first, ptrs.second, buf, &cursor);
+
+            size_t num_slice_sampled = 0;
+            slice_hits.begin_slice();
+            for (size_t j = 0; j < slice.size; j++) {
+                auto e = slice.data[j].content_id;
+                auto h = hash_content(e);
+                if (h >= threshold) {
+                    continue;
+                }
+
+                auto num_tracked = counter.size();
+                auto distance = counter.access(e);
+                size_t k = 0;
+                if (distance > 0) {
+                    k = base_rate == rate ? distance
+                                          : std::max((size_t) std::llround(distance * base_rate / rate), (size_t) 1);
+                    if (!slice_hits.empty()) {
+                        slice_hits.add(distance / rate);
+                    }
+                }
+                if (k >= histogram.size()) {
+                    histogram.resize(2 * k, 0);
+                }
+                histogram[k] += 1 / count_scale;
+                num_sampled++;
+                num_slice_sampled++;
+
+                if (fixed_size && counter.size() > num_tracked) {
+                    samples.emplace_back(h, e);
+                    std::push_heap(samples.begin(), samples.end());
+
+                    if (counter.size() > max_samples) {
+                        //移除哈希值最大的所有内容，新的阈值为它们的哈希值
+                        threshold = samples.front().first;
+                        while (!samples.empty() && samples.front().first == threshold) {
+                            counter.remove(samples.front().second);
+                            std::pop_heap(samples.begin(), samples.end());
+                            samples.pop_back();
+                        }
+
+                        auto new_rate = (double) threshold / HashModulus;
+                        count_scale *= new_rate / rate;
+                        num_sampled *= new_rate / rate;
+                        rate = new_rate;
+
+                        if (rate * 2 < base_rate) {
+                            auto scale = rate / base_rate;
+                            vector<double> rebased(histogram.size(), 0);
+                            rebased[0] = histogram[0] * count_scale;
+                            for (size_t d = 1; d < histogram.size(); d++) {
+                                auto d_new = std::max((size_t) std::llround(d * scale), (size_t) 1);
+                                rebased[d_new] += histogram[d] * count_scale;
+                            }
+                            histogram.swap(rebased);
+                            base_rate = rate;
+                            count_scale = 1;
+                        }
+                    }
+                }
+            }
+            slice_hits.end_slice(i, num_slice_sampled);
+            num_requests += slice.size;
+        }
+
+        //SHARDS-adj：按当前采样率折算的期望采样数为num_requests * rate，少数热门内容是否被采样会使实际采样数偏离期望，
+        //偏差主要来自栈距离很小的请求，因此将差值计入最小的栈距离
+        if (histogram.size() > 1) {
+            auto expected = num_requests * rate;
+            histogram[1] += (expected - num_sampled) / count_scale;
+            num_sampled = expected;
+        }
+
+        //容量c对应采样率base_rate下的栈距离x = c * base_rate，
+        //采样后的栈距离d近似均匀分布在原栈距离的(d - 1, d]区间，因此对x的小数部分线性插值
+        hit_ratios.assign(num_contents + 1, 0);
+        double num_hits = 0;
+        size_t d = 1;
+        for (size_t c = 1; c <= num_contents; c++) {
+            auto x = c * base_rate;
+            for (; d < histogram.size() && d <= x; d++) {
+                num_hits += histogram[d];
+            }
+            auto partial = d < histogram.size() ? (x - (d - 1)) * histogram[d] : 0;
+            auto ratio = (num_hits + partial) * count_scale / (num_sampled + EPS);
+            hit_ratios[c] = (float) std::min(std::max(ratio, 0.0), 1.0);
+        }
+
+        sampling_rate = rate;
+        num_bytes = counter.get_num_bytes() + histogram.capacity() * sizeof(double)
+                    + samples.capacity() * sizeof(samples[0]);
+        return num_requests;
+    }
+
+    //容量为0..M时LRU的命中率，M为内容数量
+    inline FloatVector *get_hit_ratios()
+    {
+        return &this->hit_ratios;
+    }
+
+    //每个时间片在给定的各个容量下的命中率，形状为[时间片数, 容量个数]
+    inline FloatVector *get_slice_hit_ratios()
+    {
+        return &this->slice_hit_ratios;
+    }
+
+    //最后一次分析结束时的采样率
+    inline double get_sampling_rate() const
+    {
+        return this->sampling_rate;
+    }
+
+    //最后一次分析中栈距离计数器与直方图占用的内存字节数，不包括输出的命中率曲线
+    inline size_t get_num_bytes() const
+    {
+        return this->num_bytes;
+    }
+};
@@ -1,7 +1,327 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "apis.h"
+#include "cache_emu.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
 
-int main()
+/**
+ * 参数扫描：只加载一次请求序列，依次按各个时间间隔分片，
+ * 每种分片下在线程池中并行运行所有容量与策略的组合，各模拟器共享只读的请求序列。
+ *
+ * 用法：test_cache_emu --trace PATH --capacities 100,1000 [--policies lru,arc] [--intervals 1,10]
+ *                      [--format bin|stream|compressed|text] [--threads N] [--output PATH]
+ *   --format    bin：save_trace_file写入的文件（默认）；stream：同一文件，按需从文件读取；
+ *               compressed：save_compressed_trace写入的文件；text：每行一个请求“内容ID 时间戳”，以空格或逗号分隔
+ *   --output    结果文件，以.json结尾时输出JSON，否则输出CSV；默认输出CSV到标准输出
+ * 策略的命中与否与分片无关，hit_ratio在各个时间间隔下相同；随时间间隔变化的是各时间片命中率的分布，
+ * 输出非空时间片命中率的均值与10%、50%、90%分位数
+ */
+
+struct SweepOptions
 {
-    return 0;
+    string trace_path;
+    string format = "bin";
+    vector<int> capacities;
+    vector<string> policies = {"lru"};
+    vector<TimestampType> intervals = {1};
+    size_t num_threads = std::max(thread::hardware_concurrency(), 1u);
+    string output_path;
+};
+
+struct SweepResult
+{
+    string policy;
+    int capacity;
+    TimestampType interval;
+    size_t num_slices;
+    size_t num_requests;
+    float hit_ratio;
+    float slice_hit_mean;           //非空时间片命中率的均值
+    float slice_hit_p10, slice_hit_p50, slice_hit_p90;  //非空时间片命中率的分位数
+    double seconds;
+};
+
+static vector<string> split(const string &s, char sep)
+{
+    vector<string> items;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, sep)) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+//解析以逗号分隔的正整数列表，失败时返回false
+template<class T>
+static bool parse_positive_ints(const string &s, vector<T> &out)
+{
+    out.clear();
+    for (auto &item: split(s, ',')) {
+        char *end = nullptr;
+        auto v = strtoll(item.c_str(), &end, 10);
+        if (*end != '\0' || v <= 0 || v > std::numeric_limits<T>::max()) {
+            return false;
+        }
+        out.push_back((T) v);
+    }
+    return !out.empty();
+}
+
+static void print_usage()
+{
+    cerr << "usage: test_cache_emu --trace PATH --capacities C1,C2,... [--policies P1,P2,...] [--intervals I1,I2,...]"
+         << " [--format bin|stream|compressed|text] [--threads N] [--output PATH]" << endl;
 }
 
+//解析命令行参数，失败时返回false
+static bool parse_options(int argc, char **argv, SweepOptions &options)
+{
+    for (int i = 1; i < argc; i++) {
+        string key = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "missing value for " << key << endl;
+            return false;
+        }
+        string value = argv[++i];
+
+        bool ok = true;
+        if (key == "--trace") {
+            options.trace_path = value;
+        }
+        else if (key == "--format") {
+            options.format = value;
+            ok = value == "bin" || value == "stream" || value == "compressed" || value == "text";
+        }
+        else if (key == "--capacities") {
+            ok = parse_positive_ints(value, options.capacities);
+        }
+        else if (key == "--policies") {
+            options.policies = split(value, ',');
+            ok = !options.policies.empty();
+        }
+        else if (key == "--intervals") {
+            ok = parse_positive_ints(value, options.intervals);
+        }
+        else if (key == "--threads") {
+            vector<int> num_threads;
+            ok = parse_positive_ints(value, num_threads) && num_threads.size() == 1;
+            options.num_threads = ok ? num_threads[0] : 1;
+        }
+        else if (key == "--output") {
+            options.output_path = value;
+        }
+        else {
+            cerr << "unknown option " << key << endl;
+            return false;
+        }
+
+        if (!ok) {
+            cerr << "invalid value for " << key << ": " << value << endl;
+            return false;
+        }
+    }
+
+    if (options.trace_path.empty() || options.capacities.empty()) {
+        cerr << "--trace and --capacities are required" << endl;
+        return false;
+    }
+    return true;
+}
+
+//读入文本格式的请求序列，成功时返回true
+static bool load_text_trace(const string &path, RequestLoader &loader)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == nullptr) {
+        cerr << "cannot open " << path << endl;
+        return false;
+    }
+
+    vector<ContentType> cs;
+    vector<TimestampType> ts;
+    ContentType c;
+    TimestampType t;
+    while (fscanf(f, "%d%*[ ,\t]%d", &c, &t) == 2) {
+        cs.push_back(c);
+        ts.push_back(t);
+    }
+    bool ok = feof(f) != 0;
+    fclose(f);
+
+    if (!ok) {
+        cerr << path << ": malformed line after " << cs.size() << " requests" << endl;
+        return false;
+    }
+    loader.load_dataset(cs.data(), ts.data(), cs.size());
+    return true;
+}
+
+static bool load_trace(const SweepOptions &options, RequestLoader &loader)
+{
+    auto path = options.trace_path.c_str();
+    if (options.format == "bin") {
+        return loader.load_trace_file(path);
+    }
+    if (options.format == "stream") {
+        return loader.open_trace_stream(path);
+    }
+    if (options.format == "compressed") {
+        return loader.load_compressed_trace(path);
+    }
+    return load_text_trace(options.trace_path, loader);
+}
+
+//统计非空时间片命中率的均值与分位数（取最近秩），写入r
+static void summarize_slice_hit_rates(const FloatVector &hit_rates, RequestLoader &loader, SweepResult &r)
+{
+    vector<float> rates;
+    for (size_t i = 0; i < hit_rates.size(); i++) {
+        auto ptrs = loader.get_slice_range_ptrs(i);
+        if (ptrs.second > ptrs.first) {
+            rates.push_back(hit_rates[i]);
+        }
+    }
+    if (rates.empty()) {
+        r.slice_hit_mean = r.slice_hit_p10 = r.slice_hit_p50 = r.slice_hit_p90 = 0;
+        return;
+    }
+
+    double sum = 0;
+    for (auto v: rates) {
+        sum += v;
+    }
+    r.slice_hit_mean = (float) (sum / rates.size());
+
+    std::sort(rates.begin(), rates.end());
+    auto quantile = [&](double q) {
+        return rates[std::min((size_t) (q * rates.size()), rates.size() - 1)];
+    };
+    r.slice_hit_p10 = quantile(0.1);
+    r.slice_hit_p50 = quantile(0.5);
+    r.slice_hit_p90 = quantile(0.9);
+}
+
+static void write_csv(ostream &os, const vector<SweepResult> &results)
+{
+    os << "policy,capacity,interval,num_slices,num_requests,hit_ratio,"
+       << "slice_hit_mean,slice_hit_p10,slice_hit_p50,slice_hit_p90,seconds" << endl;
+    for (auto &r: results) {
+        os << r.policy << ',' << r.capacity << ',' << r.interval << ',' << r.num_slices << ',' << r.num_requests
+           << ',' << r.hit_ratio << ',' << r.slice_hit_mean << ',' << r.slice_hit_p10 << ',' << r.slice_hit_p50
+           << ',' << r.slice_hit_p90 << ',' << r.seconds << endl;
+    }
+}
+
+static void write_json(ostream &os, const vector<SweepResult> &results)
+{
+    os << "[" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &r = results[i];
+        os << "  {\"policy\": \"" << r.policy << "\", \"capacity\": " << r.capacity << ", \"interval\": "
+           << r.interval << ", \"num_slices\": " << r.num_slices << ", \"num_requests\": " << r.num_requests
+           << ", \"hit_ratio\": " << r.hit_ratio << ", \"slice_hit_mean\": " << r.slice_hit_mean
+           << ", \"slice_hit_p10\": " << r.slice_hit_p10 << ", \"slice_hit_p50\": " << r.slice_hit_p50
+           << ", \"slice_hit_p90\": " << r.slice_hit_p90 << ", \"seconds\": " << r.seconds << "}"
+           << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    os << "]" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    SweepOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+
+    RequestLoader loader;
+    auto t_load = chrono::steady_clock::now();
+    if (!load_trace(options, loader) || loader.get_num_requests() == 0) {
+        cerr << "failed to load " << options.trace_path << endl;
+        return 1;
+    }
+    cerr << "loaded " << loader.get_num_requests() << " requests, " << loader.get_num_contents() << " contents in "
+         << chrono::duration<double>(chrono::steady_clock::now() - t_load).count() << " s" << endl;
+
+    //先检查策略名；Belady需要的下一次使用索引也在这里建立，之后各线程只读
+    for (auto &policy: options.policies) {
+        auto emu = new_policy_cache_emu(policy, 1, &loader);
+        if (emu == nullptr) {
+            cerr << "unknown policy " << policy << endl;
+            return 1;
+        }
+        delete emu;
+    }
+
+    vector<Request> buf;
+    auto n = loader.get_num_requests();
+    auto t_beg = loader.read_slice(0, 1, buf).data[0].timestamp;
+    auto t_end = loader.read_slice(n - 1, n, buf).data[0].timestamp + 1;
+
+    ThreadPool pool(options.num_threads);
+    vector<SweepResult> results;
+    for (auto interval: options.intervals) {
+        auto num_slices = loader.slice_by_time(t_beg, t_end, interval, &pool);
+
+        //同一分片下的所有组合，策略在外层，结果按策略、容量的顺序排列
+        vector<SweepResult> grid;
+        for (auto &policy: options.policies) {
+            for (auto capacity: options.capacities) {
+                grid.push_back({policy, capacity, interval, num_slices, 0, 0, 0, 0, 0, 0, 0});
+            }
+        }
+
+        pool.parallel_for(grid.size(), [&](size_t k) {
+            auto &r = grid[k];
+            auto emu = new_policy_cache_emu(r.policy, r.capacity, &loader);
+            emu->reset();
+
+            auto t_run = chrono::steady_clock::now();
+            r.num_requests = emu->run();
+            r.seconds = chrono::duration<double>(chrono::steady_clock::now() - t_run).count();
+            r.hit_ratio = emu->get_mean_hit_rate();
+            summarize_slice_hit_rates(*emu->get_slice_hit_rates(), loader, r);
+            delete emu;
+        });
+
+        cerr << "interval " << interval << ": " << num_slices << " slices, " << grid.size() << " runs" << endl;
+        results.insert(results.end(), grid.begin(), grid.end());
+    }
+
+    if (options.output_path.empty()) {
+        write_csv(cout, results);
+        return 0;
+    }
+
+    ofstream out(options.output_path);
+    auto &path = options.output_path;
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+        write_json(out, results);
+    }
+    else {
+        write_csv(out, results);
+    }
+    out.close();
+
+    if (!out) {
+        cerr << "failed to write " << options.output_path << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+#include "utils.h"
+
+/**
+ * 固定大小的线程池，用于并行处理互不相关的任务（例如多个模拟器）。
+ * 调用parallel_for的线程也参与计算，因此num_threads为1时不创建任何工作线程
+ */
+class ThreadPool
+{
+private:
+    vector<thread> workers;
+
+    mutex mtx;
+    condition_variable cv_task, cv_done;
+
+    //当前任务
+    const function<void(size_t)> *task = nullptr;
+    size_t num_tasks = 0;
+    atomic<size_t> next_task{0};
+    size_t num_busy = 0;       //仍在处理当前任务的工作线程数
+    size_t task_id = 0;        //任务编号，用于唤醒工作线程
+    bool stopping = false;
+
+    //进程允许使用的核，按编号升序；无法获取时为空
+    static vector<int> allowed_cores()
+    {
+        vector<int> cores;
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &cpu_set)) {
+                    cores.push_back(i);
+                }
+            }
+        }
+#endif
+        return cores;
+    }
+
+    //将当前线程绑定到指定的核，失败时打印警告并保持原先的绑定
+    static void pin_to_core(int core)
+    {
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(core, &cpu_set);
+        auto err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        if (err != 0) {
+            cerr << "ThreadPool: failed to pin worker thread to core " << core << " (error " << err << ")" << endl;
+        }
+#endif
+    }
+
+    //领取并执行任务，直到所有任务都被领取
+    inline void run_tasks()
+    {
+        size_t i;
+        while ((i = next_task.fetch_add(1)) < num_tasks) {
+            (*task)(i);
+        }
+    }
+
+    //core为负数时不绑定
+    void worker_loop(int core)
+    {
+        if (core >= 0) {
+            pin_to_core(core);
+        }
+
+        size_t last_task_id = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(mtx);
+                cv_task.wait(lock, [&]() { return stopping || task_id != last_task_id; });
+                if (stopping) {
+                    return;
+                }
+                last_task_id = task_id;
+            }
+
+            run_tasks();
+
+            {
+                unique_lock<mutex> lock(mtx);
+                if (--num_busy == 0) {
+                    cv_done.notify_one();
+                }
+            }
+        }
+    }
+
+public:
+    /**
+     * @param num_threads   线程数（包括调用者线程）
+     * @param pin_cores     是否将工作线程绑定到不同的核。第i个线程绑定到进程允许使用的第i个核（超出时循环），
+     *                      调用者线程（第0个）不绑定，以免影响调用者在线程池之外的工作
+     */
+    explicit ThreadPool(size_t num_threads = 1, bool pin_cores = false)
+    {
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        auto cores = pin_cores ? allowed_cores() : vector<int>();
+        for (size_t i = 1; i < num_threads; i++) {
+            auto core = cores.empty() ? -1 : cores[i % cores.size()];
+            workers.emplace_back(&ThreadPool::worker_loop, this, core);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            unique_lock<mutex> lock(mtx);
+            stopping = true;
+        }
+        cv_task.notify_all();
+        for (auto &w: workers) {
+            w.join();
+        }
+    }
+
+    inline size_t get_num_threads() const
+    {
+        return workers.size() + 1;
+    }
+
+    //对0..n-1的每个下标调用func，返回时所有调用均已完成；func的各次调用之间不能有数据依赖
+    void parallel_for(size_t n, const function<void(size_t)> &func)
+    {
+        if (workers.empty() || n <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                func(i);
+            }
+            return;
+        }
+
+        {
+            unique_lock<mutex> lock(mtx);
+            task = &func;
+            num_tasks = n;
+            next_task = 0;
+            num_busy = workers.size();
+            task_id++;
+        }
+        cv_task.notify_all();
+
+        run_tasks();
+
+        unique_lock<mutex> lock(mtx);
+        cv_done.wait(lock, [&]() { return num_busy == 0; });
+        task = nullptr;
+    }
+};
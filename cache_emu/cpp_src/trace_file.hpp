@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "utils.h"
+
+/**
+ * 二进制请求序列文件格式（版本1），所有字段均为本机字节序：
+ *   TraceFileHeader
+ *   ContentType dense_to_raw[num_contents]   稠密ID到原始ID的映射，按原始ID升序排列
+ *   Request requests[num_requests]           按时间戳排序的请求，内容ID为稠密ID
+ * 各段的偏移量均按8字节对齐，读取时直接mmap，请求与映射表不需要任何拷贝
+ */
+struct TraceFileHeader
+{
+    char magic[8];              //固定为TraceMagic
+    uint32_t version;           //格式版本
+    uint32_t byte_order;        //写入TraceByteOrder，用于检查字节序
+    uint32_t header_size;       //sizeof(TraceFileHeader)
+    uint32_t record_size;       //sizeof(Request)
+    uint64_t num_contents;      //内容数量
+    uint64_t num_requests;      //请求数量
+    uint64_t dict_offset;       //dense_to_raw相对文件开头的偏移量
+    uint64_t requests_offset;   //requests相对文件开头的偏移量
+};
+
+static constexpr char TraceMagic[8] = {'C', 'E', 'M', 'U', 'T', 'R', 'C', '\0'};
+static constexpr uint32_t TraceVersion = 1;
+static constexpr uint32_t TraceByteOrder = 0x01020304;
+
+//向上对齐到8字节
+inline uint64_t align_trace_offset(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+/**
+ * 只读映射的文件，析构时解除映射
+ */
+class MappedFile
+{
+private:
+    void *addr = nullptr;
+    size_t length = 0;
+
+public:
+    MappedFile() = default;
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (addr != nullptr) {
+            munmap(addr, length);
+        }
+    }
+
+    //映射整个文件，失败时返回false
+    bool open(const char *path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        length = (size_t) st.st_size;
+        addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (addr == MAP_FAILED) {
+            addr = nullptr;
+            length = 0;
+            return false;
+        }
+        return true;
+    }
+
+    inline const char *data() const
+    {
+        return (const char *) addr;
+    }
+
+    inline size_t size() const
+    {
+        return length;
+    }
+};
+
+//检查文件头，返回空字符串表示文件有效，否则返回错误原因
+inline string check_trace_header(const TraceFileHeader &header, size_t file_size)
+{
+    if (memcmp(header.magic, TraceMagic, sizeof(TraceMagic)) != 0) {
+        return "not a trace file";
+    }
+    if (header.version != TraceVersion) {
+        return "unsupported version " + to_string(header.version);
+    }
+    if (header.byte_order != TraceByteOrder) {
+        return "byte order mismatch";
+    }
+    if (header.header_size != sizeof(TraceFileHeader) || header.record_size != sizeof(Request)) {
+        return "record layout mismatch";
+    }
+    if (header.num_contents > (uint64_t) std::numeric_limits<ContentType>::max()) {
+        return "too many contents";
+    }
+    if (header.dict_offset % 8 != 0 || header.requests_offset % 8 != 0
+        || header.dict_offset < sizeof(TraceFileHeader)) {
+        return "corrupted section offsets";
+    }
+    //各段先与剩余大小比较，避免乘法与加法溢出
+    if (header.dict_offset > file_size
+        || header.num_contents > (file_size - header.dict_offset) / sizeof(ContentType)) {
+        return "file truncated";
+    }
+    if (header.requests_offset < header.dict_offset + header.num_contents * sizeof(ContentType)) {
+        return "corrupted section offsets";
+    }
+    if (header.requests_offset > file_size
+        || header.num_requests > (file_size - header.requests_offset) / sizeof(Request)) {
+        return "file truncated";
+    }
+    return "";
+}
+
+//检查ID映射表：原始ID非负、小于ContentType的最大值且严格递增，to_dense依赖这一点做二分查找
+inline string check_trace_dictionary(const ContentType *dense_to_raw, size_t num_contents)
+{
+    for (size_t i = 0; i < num_contents; i++) {
+        if (dense_to_raw[i] < 0 || dense_to_raw[i] == std::numeric_limits<ContentType>::max()
+            || (i > 0 && dense_to_raw[i] <= dense_to_raw[i - 1])) {
+            return "corrupted content dictionary";
+        }
+    }
+    return "";
+}
+
+//写入请求序列文件，成功时返回true
+inline bool write_trace_file(const char *path, const ContentType *dense_to_raw, size_t num_contents,
+                             const Request *requests, size_t num_requests)
+{
+    TraceFileHeader header{};
+    memcpy(header.magic, TraceMagic, sizeof(TraceMagic));
+    header.version = TraceVersion;
+    header.byte_order = TraceByteOrder;
+    header.header_size = sizeof(TraceFileHeader);
+    header.record_size = sizeof(Request);
+    header.num_contents = num_contents;
+    header.num_requests = num_requests;
+    header.dict_offset = align_trace_offset(sizeof(TraceFileHeader));
+    header.requests_offset = align_trace_offset(header.dict_offset + num_contents * sizeof(ContentType));
+
+    FILE *f = fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    static const char padding[8] = {0};
+    auto dict_end = header.dict_offset + num_contents * sizeof(ContentType);
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+              && fwrite(padding, 1, header.dict_offset - sizeof(header), f) == header.dict_offset - sizeof(header)
+              && fwrite(dense_to_raw, sizeof(ContentType), num_contents, f) == num_contents
+              && fwrite(padding, 1, header.requests_offset - dict_end, f) == header.requests_offset - dict_end
+              && fwrite(requests, sizeof(Request), num_requests, f) == num_requests;
+
+    return fclose(f) == 0 && ok;
+}
+
+/**
+ * 以流的方式读取请求序列文件，只在需要时用pread读取指定范围的请求，
+ * 不同线程可以同时读取
+ */
+class TraceStream
+{
+private:
+    int fd = -1;
+    TraceFileHeader header{};
+
+public:
+    TraceStream() = default;
+
+    TraceStream(const TraceStream &) = delete;
+
+    TraceStream &operator=(const TraceStream &) = delete;
+
+    ~TraceStream()
+    {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    //打开文件并检查文件头，返回空字符串表示成功，否则返回错误原因
+    string open(const char *path)
+    {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return "cannot open file";
+        }
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header)
+            || !read_at(&header, sizeof(header), 0)) {
+            return "file truncated";
+        }
+        return check_trace_header(header, (size_t) st.st_size);
+    }
+
+    inline const TraceFileHeader &get_header() const
+    {
+        return header;
+    }
+
+    //从offset处读取size字节，成功时返回true
+    bool read_at(void *buf, size_t size, uint64_t offset) const
+    {
+        auto p = (char *) buf;
+        while (size > 0) {
+            auto n = pread(fd, p, size, (off_t) offset);
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    //读取ID映射表
+    bool read_dictionary(ContentType *out) const
+    {
+        return read_at(out, header.num_contents * sizeof(ContentType), header.dict_offset);
+    }
+
+    //读取第beg个请求开始的size个请求
+    bool read_requests(size_t beg, size_t size, Request *out) const
+    {
+        ASSERT(beg + size <= header.num_requests);
+        return read_at(out, size * sizeof(Request), header.requests_offset + beg * sizeof(Request));
+    }
+};
@@ -23,7 +23,6 @@ const ContentType NoneContentType = -1;
 const TimestampType NoneTimestampType = -1;
 
 #define EPS 1e-6            //精度
-#define MAX_CONTENTS 1e7    //最大ID值
 
 struct Request
 {
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "utils.h"
+#include "request.hpp"
+#include "thread_pool.hpp"
+
+//合成请求序列的参数
+struct WorkloadConfig
+{
+    size_t num_requests = 1000000;
+    TimestampType num_timestamps = 1000;    //时间戳的范围为[0, num_timestamps)
+    uint64_t seed = 0;
+
+    //IRM：每个请求独立地按Zipf分布从num_contents个内容中选取，排名第r的内容的概率正比于1 / r^alpha
+    size_t num_contents = 100000;
+    double alpha = 0.8;
+
+    //热度漂移：每经过一个时间戳，排名到内容的映射平移drift_rate个内容，原先的热门内容逐渐变冷
+    double drift_rate = 0;
+
+    //昼夜变化：时间戳t的请求到达率正比于1 + diurnal_amplitude * sin(2 * pi * t / diurnal_period)
+    double diurnal_amplitude = 0;
+    TimestampType diurnal_period = 1000;
+
+    //散粒噪声模型（SNM）：num_shots个新内容在整个时间范围内均匀出现，每个内容只在出现后的shot_lifetime个时间戳内被请求，
+    //请求量服从形状参数为shot_shape的Pareto分布；shot_fraction为这部分请求占所有请求的比例
+    size_t num_shots = 0;
+    TimestampType shot_lifetime = 100;
+    double shot_shape = 1.5;
+    double shot_fraction = 0;
+
+    //只被请求一次的内容占所有请求的比例
+    double one_hit_fraction = 0;
+
+    //检查参数，返回空字符串表示合法，否则返回错误原因；比较均写成!(x >= 0)的形式，NaN同样不合法
+    string check() const
+    {
+        if (num_requests == 0 || num_timestamps <= 0 || num_contents == 0) {
+            return "num_requests, num_timestamps and num_contents must be positive";
+        }
+        if (!(alpha >= 0) || !std::isfinite(alpha)) {
+            return "alpha must be a finite non-negative number";
+        }
+        if (!(drift_rate >= 0) || !std::isfinite(drift_rate)) {
+            return "drift_rate must be a finite non-negative number";
+        }
+        if (!(diurnal_amplitude >= 0 && diurnal_amplitude < 1)) {
+            return "diurnal_amplitude must be in [0, 1)";
+        }
+        if (diurnal_period <= 0) {
+            return "diurnal_period must be positive";
+        }
+        if (!(shot_fraction >= 0 && shot_fraction <= 1) || !(one_hit_fraction >= 0 && one_hit_fraction <= 1)
+            || !(shot_fraction + one_hit_fraction <= 1)) {
+            return "shot_fraction and one_hit_fraction must be in [0, 1] with a sum of at most 1";
+        }
+        if (num_shots > 0 && (shot_lifetime <= 0 || !(shot_shape > 0) || !std::isfinite(shot_shape))) {
+            return "shot_lifetime and shot_shape must be positive";
+        }
+        //只被请求一次的内容至多num_requests个
+        auto max_contents = (uint64_t) num_contents + num_shots + (one_hit_fraction > 0 ? num_requests : 0);
+        if (num_contents > INT32_MAX || num_shots > INT32_MAX || max_contents >= (uint64_t) INT32_MAX) {
+            return "too many contents for 32-bit content IDs";
+        }
+        return "";
+    }
+};
+
+/**
+ * 合成请求序列生成器，直接填充RequestLoader。
+ * 请求按固定大小分块生成，每块使用由种子与块编号确定的随机数，因此结果与线程数无关，可以重现。
+ * 内容的稠密ID依次为：IRM内容[0, num_contents)，SNM内容[num_contents, num_contents + num_shots)，之后为只被请求一次的内容
+ */
+class WorkloadGenerator
+{
+private:
+    static constexpr size_t ChunkSize = 1 << 16;
+
+    WorkloadConfig config;
+
+    vector<size_t> timestamp_ends;  //时间戳t的请求为[timestamp_ends[t - 1], timestamp_ends[t])
+    vector<double> shot_births;     //每个SNM内容出现的时刻，升序
+    vector<double> shot_weights;    //SNM内容请求量的前缀和，长度为num_shots + 1
+
+    //Zipf分布的拒绝-逆变换采样（Hörmann & Derflinger 1996），不需要按内容数量分配的表
+    double zipf_h_x1 = 0, zipf_h_n = 0, zipf_s = 0;
+
+    //SplitMix64随机数生成器
+    struct Random
+    {
+        uint64_t state;
+
+        explicit Random(uint64_t seed) : state(seed) {}
+
+        inline uint64_t next()
+        {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        //[0, 1)上的均匀分布
+        inline double uniform()
+        {
+            return (double) (next() >> 11) * 0x1.0p-53;
+        }
+    };
+
+    //第i_chunk块中第stream个随机数序列的种子
+    inline uint64_t chunk_seed(size_t i_chunk, uint64_t stream) const
+    {
+        Random r(config.seed ^ (0xD1B54A32D192ED03ULL * (i_chunk * 2 + stream + 1)));
+        return r.next();
+    }
+
+    //log(1 + x) / x
+    static inline double helper1(double x)
+    {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    //(exp(x) - 1) / x
+    static inline double helper2(double x)
+    {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+    }
+
+    inline double zipf_h(double x) const
+    {
+        return std::exp(-config.alpha * std::log(x));
+    }
+
+    //zipf_h的积分
+    inline double zipf_h_integral(double x) const
+    {
+        auto log_x = std::log(x);
+        return helper2((1 - config.alpha) * log_x) * log_x;
+    }
+
+    inline double zipf_h_integral_inverse(double x) const
+    {
+        auto t = std::max(x * (1 - config.alpha), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+    //按Zipf分布采样排名，返回[0, num_contents)
+    inline size_t sample_zipf(Random &rng) const
+    {
+        auto n = config.num_contents;
+        while (true) {
+            auto u = zipf_h_n + rng.uniform() * (zipf_h_x1 - zipf_h_n);
+            auto x = zipf_h_integral_inverse(u);
+            auto k = std::min(std::max((size_t) (x + 0.5), (size_t) 1), n);
+            if (k - x <= zipf_s || u >= zipf_h_integral(k + 0.5) - zipf_h((double) k)) {
+                return k - 1;
+            }
+        }
+    }
+
+    //第i个请求是否为只被请求一次的内容，使用单独的随机数序列，两遍生成时结果一致
+    inline bool is_one_hit(Random &rng) const
+    {
+        return config.one_hit_fraction > 0 && rng.uniform() < config.one_hit_fraction;
+    }
+
+    //时间戳t前的累计到达率
+    inline double arrival_integral(double t) const
+    {
+        if (config.diurnal_amplitude == 0) {
+            return t;
+        }
+        auto w = 2 * M_PI / config.diurnal_period;
+        return t + config.diurnal_amplitude * (1 - std::cos(w * t)) / w;
+    }
+
+    void setup()
+    {
+        auto &c = config;
+        ASSERT(c.check().empty());
+
+        //每个时间戳的请求数与到达率成正比，总数恰好为num_requests
+        timestamp_ends.resize(c.num_timestamps);
+        auto total = arrival_integral(c.num_timestamps);
+        for (TimestampType t = 0; t < c.num_timestamps; t++) {
+            timestamp_ends[t] = (size_t) ((double) c.num_requests * (arrival_integral(t + 1) / total));
+        }
+        timestamp_ends.back() = c.num_requests;
+
+        zipf_h_x1 = zipf_h_integral(1.5) - 1;
+        zipf_h_n = zipf_h_integral(c.num_contents + 0.5);
+        zipf_s = 2 - zipf_h_integral_inverse(zipf_h_integral(2.5) - zipf_h(2));
+
+        shot_births.resize(c.num_shots);
+        shot_weights.assign(c.num_shots + 1, 0);
+        Random rng(chunk_seed(SIZE_MAX / 2, 0));
+        for (size_t i = 0; i < c.num_shots; i++) {
+            shot_births[i] = (double) c.num_timestamps * i / c.num_shots;
+            shot_weights[i + 1] = shot_weights[i] + std::pow(1 - rng.uniform(), -1 / c.shot_shape);
+        }
+    }
+
+    //生成第i_chunk块的请求，one_hit_base为块内第一个只被请求一次的内容的ID
+    void generate_chunk(size_t i_chunk, ContentType one_hit_base, Request *out) const
+    {
+        auto &c = config;
+        auto beg = i_chunk * ChunkSize, end = std::min(beg + ChunkSize, c.num_requests);
+        Random rng(chunk_seed(i_chunk, 0)), one_hit_rng(chunk_seed(i_chunk, 1));
+
+        auto t = (TimestampType) (std::upper_bound(timestamp_ends.begin(), timestamp_ends.end(), beg)
+                                  - timestamp_ends.begin());
+        TimestampType shot_t = -1;
+        size_t shot_lo = 0, shot_hi = 0;
+        auto shot_base = (ContentType) c.num_contents;
+
+        for (auto i = beg; i < end; i++) {
+            while (i >= timestamp_ends[t]) {
+                t++;
+            }
+
+            ContentType e;
+            if (is_one_hit(one_hit_rng)) {
+                e = one_hit_base++;
+            }
+            else {
+                if (c.num_shots > 0 && c.shot_fraction > 0 && t != shot_t) {
+                    //出现于(t - shot_lifetime, t]的内容仍在被请求
+                    shot_t = t;
+                    shot_lo = std::upper_bound(shot_births.begin(), shot_births.end(), (double) t - c.shot_lifetime)
+                              - shot_births.begin();
+                    shot_hi = std::upper_bound(shot_births.begin(), shot_births.end(), (double) t)
+                              - shot_births.begin();
+                }
+
+                auto u = rng.uniform() * (1 - c.one_hit_fraction);
+                if (u < c.shot_fraction && shot_lo < shot_hi) {
+                    auto w = shot_weights[shot_lo] + rng.uniform() * (shot_weights[shot_hi] - shot_weights[shot_lo]);
+                    auto k = std::upper_bound(shot_weights.begin() + shot_lo + 1, shot_weights.begin() + shot_hi, w)
+                             - shot_weights.begin() - 1;
+                    e = shot_base + (ContentType) k;
+                }
+                else {
+                    auto rank = sample_zipf(rng);
+                    auto shift = (size_t) (c.drift_rate * t) % c.num_contents;
+                    e = (ContentType) ((rank + shift) % c.num_contents);
+                }
+            }
+            out[i - beg] = {e, t};
+        }
+    }
+
+public:
+    //config需要先通过WorkloadConfig::check
+    explicit WorkloadGenerator(const WorkloadConfig &config) : config(config)
+    {
+        this->setup();
+    }
+
+    /**
+     * 生成请求序列并替换loader中的数据集
+     * @param pool  不为空时在线程池中并行生成
+     * @return      内容数量
+     */
+    size_t generate(RequestLoader &loader, ThreadPool *pool = nullptr) const
+    {
+        auto num_chunks = (config.num_requests + ChunkSize - 1) / ChunkSize;
+        auto parallel_for = [&](const function<void(size_t)> &func) {
+            if (pool != nullptr) {
+                pool->parallel_for(num_chunks, func);
+            }
+            else {
+                for (size_t i = 0; i < num_chunks; i++) {
+                    func(i);
+                }
+            }
+        };
+
+        //第一遍统计每块中只被请求一次的内容数，以便为它们分配连续的ID
+        vector<size_t> one_hit_offsets(num_chunks + 1, 0);
+        if (config.one_hit_fraction > 0) {
+            parallel_for([&](size_t i_chunk) {
+                Random one_hit_rng(chunk_seed(i_chunk, 1));
+                auto size = std::min(ChunkSize, config.num_requests - i_chunk * ChunkSize);
+                size_t n = 0;
+                for (size_t i = 0; i < size; i++) {
+                    n += is_one_hit(one_hit_rng);
+                }
+                one_hit_offsets[i_chunk + 1] = n;
+            });
+            std::partial_sum(one_hit_offsets.begin(), one_hit_offsets.end(), one_hit_offsets.begin());
+        }
+
+        auto one_hit_base = config.num_contents + config.num_shots;
+        auto num_contents = one_hit_base + one_hit_offsets.back();
+        ASSERT(num_contents < (size_t) std::numeric_limits<ContentType>::max());
+
+        vector<Request> requests(config.num_requests);
+        parallel_for([&](size_t i_chunk) {
+            generate_chunk(i_chunk, (ContentType) (one_hit_base + one_hit_offsets[i_chunk]),
+                           requests.data() + i_chunk * ChunkSize);
+        });
+
+        loader.load_dense_requests(std::move(requests), num_contents);
+        return num_contents;
+    }
+};
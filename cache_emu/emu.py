@@ -14,9 +14,35 @@ lib_path = os.path.join(_package_root, "./build/libcacheemu.so")
 lib_cache_emu = ctypes_utils.load_lib(lib_path)
 
 ctypes_utils.setup_res_type(lib_cache_emu.load_dataset, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.load_trace_file, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.save_trace_file, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.open_trace_stream, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.compress_dataset, ctypes.c_size_t)
+ctypes_utils.setup_res_type(lib_cache_emu.load_compressed_trace, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.save_compressed_trace, ctypes.c_int32)
 ctypes_utils.setup_res_type(lib_cache_emu.slice_dataset_by_time, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.slice_dataset_by_boundaries, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.slice_dataset_by_count, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.generate_dataset, ctypes.c_size_t)
+ctypes_utils.setup_arg_types(lib_cache_emu.generate_dataset,
+                             [ctypes.c_size_t, ctypes.c_int32, ctypes.c_uint64,
+                              ctypes.c_size_t, ctypes.c_double, ctypes.c_double,
+                              ctypes.c_double, ctypes.c_int32,
+                              ctypes.c_size_t, ctypes.c_int32, ctypes.c_double, ctypes.c_double,
+                              ctypes.c_double])
+ctypes_utils.setup_res_type(lib_cache_emu.profile_stack_distances, ctypes.c_size_t)
+ctypes_utils.setup_res_type(lib_cache_emu.profile_stack_distances_sampled, ctypes.c_size_t)
+ctypes_utils.setup_arg_types(lib_cache_emu.profile_stack_distances_sampled,
+                             [ctypes.c_double, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t])
+ctypes_utils.setup_res_type(lib_cache_emu.get_stack_distance_sampling_rate, ctypes.c_double)
+ctypes_utils.setup_res_type(lib_cache_emu.get_lru_hit_ratio_curve, ctypes_utils.FloatBuffer)
+ctypes_utils.setup_res_type(lib_cache_emu.get_lru_slice_hit_ratios, ctypes_utils.FloatBuffer)
 ctypes_utils.setup_res_type(lib_cache_emu.init_cache_emu, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.init_policy_cache_emu, ctypes.c_int32)
+ctypes_utils.setup_res_type(lib_cache_emu.run_policy, ctypes.c_size_t)
+ctypes_utils.setup_res_type(lib_cache_emu.get_slice_hit_rates, ctypes_utils.FloatBuffer)
 ctypes_utils.setup_res_type(lib_cache_emu.step, ctypes_utils.Triple)
+ctypes_utils.setup_res_type(lib_cache_emu.step_until_miss, ctypes_utils.Triple)
 ctypes_utils.setup_res_type(lib_cache_emu.get_cache_contents, ctypes_utils.IntBuffer)
 ctypes_utils.setup_res_type(lib_cache_emu.get_candidates, ctypes_utils.IntBuffer)
 ctypes_utils.setup_res_type(lib_cache_emu.get_candidate_frequencies, ctypes_utils.FloatBuffer)
@@ -24,10 +50,24 @@ ctypes_utils.setup_res_type(lib_cache_emu.get_step_elements, ctypes_utils.IntBuf
 ctypes_utils.setup_res_type(lib_cache_emu.feature_dims, ctypes.c_size_t)
 ctypes_utils.setup_res_type(lib_cache_emu.setup_traditional_feature_types, ctypes.c_void_p)
 ctypes_utils.setup_res_type(lib_cache_emu.setup_swlfu_feature_types, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.setup_next_use_feature, ctypes.c_void_p)
 ctypes_utils.setup_res_type(lib_cache_emu.get_features, ctypes_utils.FloatBuffer)
+ctypes_utils.setup_res_type(lib_cache_emu.get_features_columns, ctypes_utils.FloatBuffer)
 ctypes_utils.setup_res_type(lib_cache_emu.get_mean_hit_rate, ctypes.c_float)
 ctypes_utils.setup_res_type(lib_cache_emu.finished, ctypes.c_int32)
 ctypes_utils.setup_res_type(lib_cache_emu.on_episode_end, ctypes.c_float)
+ctypes_utils.setup_res_type(lib_cache_emu.get_max_slice_size, ctypes.c_size_t)
+ctypes_utils.setup_res_type(lib_cache_emu.get_num_requests, ctypes.c_size_t)
+ctypes_utils.setup_res_type(lib_cache_emu.get_num_contents, ctypes.c_size_t)
+ctypes_utils.setup_res_type(lib_cache_emu.set_profiling, ctypes.c_int32)
+ctypes_utils.setup_arg_types(lib_cache_emu.set_profiling, [ctypes.c_int32, ctypes.c_bool])
+ctypes_utils.setup_res_type(lib_cache_emu.get_profile_stats, ctypes_utils.ProfileStats)
+ctypes_utils.setup_res_type(lib_cache_emu.clear_profile_stats, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.step_observe, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.step_observe_delta, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.step_batch, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.set_num_threads, ctypes.c_void_p)
+ctypes_utils.setup_res_type(lib_cache_emu.get_num_threads, ctypes.c_int32)
 
 
 def init_loader(data, t_beg: int, t_end: int, t_interval=1):
@@ -39,17 +79,150 @@ def init_loader(data, t_beg: int, t_end: int, t_interval=1):
     num_requests = len(content_ids)
     lib_cache_emu.load_dataset(content_ids.ctypes, timestamps.ctypes, num_requests)
     
-    num_steps = lib_cache_emu.slice_dataset_by_time(int(t_beg), int(t_end), t_interval)
+    num_steps = slice_dataset_by_time(int(t_beg), int(t_end), t_interval)
     
     return num_requests, num_steps, (t_beg, t_end)
 
 
+def init_loader_from_workload(num_requests: int, num_timestamps: int = 1000, seed: int = 0,
+                              num_contents: int = 100000, alpha: float = 0.8, drift_rate: float = 0.0,
+                              diurnal_amplitude: float = 0.0, diurnal_period: int = 1000,
+                              num_shots: int = 0, shot_lifetime: int = 100, shot_shape: float = 1.5,
+                              shot_fraction: float = 0.0, one_hit_fraction: float = 0.0, t_interval=1):
+    # 在C++中直接生成合成请求序列（参数含义见apis.h中的generate_dataset），不经过pandas与numpy，
+    # 生成的内容数量可以通过get_num_contents获取
+    if min(num_requests, num_contents, num_shots) < 0:
+        raise ValueError("num_requests, num_contents and num_shots must be non-negative")
+    num_contents = lib_cache_emu.generate_dataset(num_requests, num_timestamps, seed,
+                                                  num_contents, alpha, drift_rate,
+                                                  diurnal_amplitude, diurnal_period,
+                                                  num_shots, shot_lifetime, shot_shape, shot_fraction,
+                                                  one_hit_fraction)
+    if num_contents == 0:
+        # 错误原因由generate_dataset打印
+        raise ValueError("invalid workload parameters")
+    
+    num_steps = slice_dataset_by_time(0, num_timestamps, t_interval)
+    
+    return num_requests, num_steps, (0, num_timestamps)
+
+
+def init_loader_from_trace_file(path: str, t_beg: int, t_end: int, t_interval=1):
+    # 映射由save_trace_file生成的二进制文件，不经过pandas与numpy，载入时只并行扫描一遍请求检查内容ID
+    if not lib_cache_emu.load_trace_file(path.encode()):
+        raise IOError("cannot load trace file: {}".format(path))
+    
+    num_steps = slice_dataset_by_time(int(t_beg), int(t_end), t_interval)
+    
+    return lib_cache_emu.get_num_requests(), num_steps, (t_beg, t_end)
+
+
+def init_loader_from_trace_stream(path: str, t_beg: int, t_end: int, t_interval=1):
+    # 流式读取二进制文件，请求不常驻内存，适用于超出内存大小的请求序列
+    if not lib_cache_emu.open_trace_stream(path.encode()):
+        raise IOError("cannot open trace file: {}".format(path))
+    
+    num_steps = slice_dataset_by_time(int(t_beg), int(t_end), t_interval)
+    
+    return lib_cache_emu.get_num_requests(), num_steps, (t_beg, t_end)
+
+
+def init_loader_from_compressed_trace(path: str, t_beg: int, t_end: int, t_interval=1):
+    # 读入由save_compressed_trace生成的压缩文件，请求在模拟时按需解码
+    if not lib_cache_emu.load_compressed_trace(path.encode()):
+        raise IOError("cannot load compressed trace: {}".format(path))
+    
+    num_steps = slice_dataset_by_time(int(t_beg), int(t_end), t_interval)
+    
+    return lib_cache_emu.get_num_requests(), num_steps, (t_beg, t_end)
+
+
+def compress_dataset(block_size: int = 0):
+    # 压缩已加载的数据集，返回压缩后占用的字节数
+    return lib_cache_emu.compress_dataset(block_size)
+
+
+def save_compressed_trace(path: str):
+    if not lib_cache_emu.save_compressed_trace(path.encode()):
+        raise IOError("cannot save compressed trace: {}".format(path))
+
+
+def save_trace_file(path: str):
+    # 将init_loader加载的数据集保存为二进制文件
+    if not lib_cache_emu.save_trace_file(path.encode()):
+        raise IOError("cannot save trace file: {}".format(path))
+
+
+def slice_dataset_by_time(t_beg: int, t_end: int, t_interval=1):
+    # 对已加载的数据集重新分片，耗时与时间片个数成正比，可用于扫描不同的时间间隔
+    num_steps = lib_cache_emu.slice_dataset_by_time(int(t_beg), int(t_end), t_interval)
+    if num_steps < 0:
+        # 错误原因由slice_dataset_by_time打印
+        raise ValueError("invalid time slicing: t_beg={}, t_end={}, t_interval={}".format(t_beg, t_end, t_interval))
+    return num_steps
+
+
+def slice_dataset_by_boundaries(boundaries):
+    boundaries = np.ascontiguousarray(boundaries, dtype=np.int32)
+    num_steps = lib_cache_emu.slice_dataset_by_boundaries(boundaries.ctypes, boundaries.shape[0])
+    if num_steps < 0:
+        raise ValueError("boundaries must be strictly increasing")
+    return num_steps
+
+
+def slice_dataset_by_count(num_requests_per_slice: int):
+    if num_requests_per_slice <= 0:
+        raise ValueError("num_requests_per_slice must be positive")
+    return lib_cache_emu.slice_dataset_by_count(num_requests_per_slice)
+
+
+def profile_lru_hit_ratios(slice_capacities=(), sampling_rate=1.0, max_samples=0):
+    """
+    一遍扫描已加载的数据集，计算LRU在所有容量下的命中率，返回的数组不拷贝数据，下一次调用前有效
+    :param slice_capacities: 需要按时间片统计命中率的容量
+    :param sampling_rate: 小于1时按内容哈希采样估计（SHARDS），max_samples不为0时为初始采样率；
+                          采样时容量小于1 / sampling_rate的命中率不可靠
+    :param max_samples: 不为0时最多同时统计的内容数，超出时自动降低采样率
+    :return: (命中率曲线[内容数量+1], 每个时间片的命中率[时间片数, len(slice_capacities)])
+    """
+    capacities = np.array(slice_capacities, dtype=np.int32)
+    if sampling_rate < 1.0 or max_samples > 0:
+        lib_cache_emu.profile_stack_distances_sampled(sampling_rate, max_samples,
+                                                      capacities.ctypes, capacities.shape[0])
+    else:
+        lib_cache_emu.profile_stack_distances(capacities.ctypes, capacities.shape[0])
+    
+    curve = ctypes_utils.buffer_as_numpy(lib_cache_emu.get_lru_hit_ratio_curve(), np.float32)
+    slice_hit_ratios = ctypes_utils.buffer_as_numpy(lib_cache_emu.get_lru_slice_hit_ratios(), np.float32)
+    num_capacities = capacities.shape[0]
+    return curve, slice_hit_ratios.reshape((slice_hit_ratios.shape[0] // max(num_capacities, 1), num_capacities))
+
+
+def get_max_slice_size():
+    return lib_cache_emu.get_max_slice_size()
+
+
+def get_num_requests():
+    return lib_cache_emu.get_num_requests()
+
+
+def get_num_contents():
+    return lib_cache_emu.get_num_contents()
+
+
+def set_num_threads(num_threads: int, pin_cores: bool = False):
+    # 设置批量接口使用的线程数，ctypes.cdll在调用期间会释放GIL，其他Python线程可以同时运行
+    lib_cache_emu.set_num_threads(num_threads, pin_cores)
+
+
 class CacheEmu:
     def __init__(self, capacity, passive_mode=False):
         self.capacity = capacity
         
         self.handler = lib_cache_emu.init_cache_emu(capacity, passive_mode)
         self.last_contents = None
+        self.observation = None
+        self.delta = None
     
     def reset(self):
         lib_cache_emu.reset(self.handler)
@@ -57,6 +230,92 @@ class CacheEmu:
     def step(self):
         return lib_cache_emu.step(self.handler)
     
+    def step_until_miss(self):
+        # 仅用于被动模式：连续处理请求直到miss，返回(处理的请求数, 是否miss, 跨越的时间片边界数)
+        return lib_cache_emu.step_until_miss(self.handler)
+    
+    def step_observe(self):
+        """
+        推进一步，并将候选内容、命中次数与特征直接写入新分配的numpy数组，只需一次FFI调用
+        :return: (三元组, 候选内容, 命中次数, 特征, 是否结束)
+        """
+        if self.observation is None:
+            max_candidates = self.capacity + get_max_slice_size()
+            self.observation = ctypes_utils.StepObservation()
+            self.observation.max_candidates = max_candidates
+        
+        max_candidates = self.observation.max_candidates
+        candidates = np.empty(max_candidates, dtype=np.int32)
+        frequencies = np.empty(max_candidates, dtype=np.float32)
+        features = np.empty((max_candidates, self.feature_dims()), dtype=np.float32)
+        
+        obs = self.observation
+        obs.candidates = candidates.ctypes.data_as(ctypes.POINTER(ctypes.c_int32))
+        obs.frequencies = frequencies.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+        obs.features = features.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+        lib_cache_emu.step_observe(self.handler, ctypes.byref(obs))
+        
+        n = obs.num_candidates
+        return obs.triple, candidates[:n], frequencies[:n], features[:n], bool(obs.done)
+    
+    def step_observe_delta(self, materialize: bool = False):
+        """
+        推进一步，只从C++取回自上次增量观测以来变化的行，默认只做与变化的行数成正比的工作，
+        调用者（如GPU上）修补自己缓存的张量后按 特征 = (raw + offsets) * scales / divisors 变换。
+        未出现在rows中的行候选内容与原始特征不变，命中次数为0
+        :param materialize: 为True时额外在Python中修补完整的观测并做变换，开销与容量成正比
+        :return: (三元组, 候选内容个数, 变化的行号, 这些行的候选内容, 命中次数, 原始特征,
+                  (offsets, scales, divisors), 是否结束)；
+                 materialize为True时返回(三元组, 候选内容, 命中次数, 特征, 是否结束, 变化的行号)，与step_observe相同并附加行号
+        """
+        if self.delta is None:
+            max_candidates = self.capacity + get_max_slice_size()
+            f_dims = self.feature_dims()
+            obs = ctypes_utils.DeltaObservation()
+            obs.max_candidates = max_candidates
+            
+            # 输出缓冲区与缓存的完整观测，只分配一次
+            buffers = {
+                'rows': np.empty(max_candidates, dtype=np.int32),
+                'candidates': np.empty(max_candidates, dtype=np.int32),
+                'frequencies': np.empty(max_candidates, dtype=np.float32),
+                'raw_features': np.empty((max_candidates, f_dims), dtype=np.float64),
+                'offsets': np.empty(f_dims, dtype=np.float64),
+                'scales': np.empty(f_dims, dtype=np.float64),
+                'divisors': np.empty(f_dims, dtype=np.float64),
+            }
+            for name, buf in buffers.items():
+                setattr(obs, name, buf.ctypes.data_as(ctypes.POINTER(np.ctypeslib.as_ctypes_type(buf.dtype))))
+            
+            cached = {
+                'candidates': np.full(max_candidates, -1, dtype=np.int32),
+                'raw_features': np.zeros((max_candidates, f_dims), dtype=np.float64),
+            }
+            self.delta = (obs, buffers, cached)
+        
+        obs, buffers, cached = self.delta
+        lib_cache_emu.step_observe_delta(self.handler, ctypes.byref(obs))
+        
+        # 缓冲区在下一次调用时被覆盖，只复制变化的行
+        n, k = obs.num_candidates, obs.num_rows
+        rows = buffers['rows'][:k].copy()
+        candidates = buffers['candidates'][:k].copy()
+        frequencies = buffers['frequencies'][:k].copy()
+        raw_features = buffers['raw_features'][:k].copy()
+        transform = (buffers['offsets'].copy(), buffers['scales'].copy(), buffers['divisors'].copy())
+        
+        # 缓存的完整观测每步也只修补变化的行，因此可以随时切换materialize
+        cached['candidates'][rows] = candidates
+        cached['raw_features'][rows] = raw_features
+        if not materialize:
+            return obs.triple, n, rows, candidates, frequencies, raw_features, transform, bool(obs.done)
+        
+        full_frequencies = np.zeros(n, dtype=np.float32)
+        full_frequencies[rows] = frequencies
+        offsets, scales, divisors = transform
+        features = ((cached['raw_features'][:n] + offsets) * scales / divisors).astype(np.float32)
+        return obs.triple, cached['candidates'][:n].copy(), full_frequencies, features, bool(obs.done), rows
+    
     def get_step_elements(self):
         res = lib_cache_emu.get_step_elements(self.handler)
         return ctypes_utils.buffer_to_numpy(res, np.int32)
@@ -86,6 +345,7 @@ class CacheEmu:
     
     def setup_features(self, use_lfu_feature: bool = False, use_lru_feature: bool = False,
                        use_ogd_opt_feature: bool = False,
+                       use_next_use_feature: bool = False,
                        use_bert_feature=False,
                        wlfu_w_lens: list = [], **kwargs):
         lib_cache_emu.setup_traditional_feature_types(
@@ -97,10 +357,20 @@ class CacheEmu:
         
         wlfu_w_lens = np.array(wlfu_w_lens, dtype=np.int32)
         lib_cache_emu.setup_swlfu_feature_types(self.handler, wlfu_w_lens.ctypes, wlfu_w_lens.shape[0])
+        
+        # 离线特征：到下一次被请求的距离，只用于模仿学习
+        if use_next_use_feature:
+            lib_cache_emu.setup_next_use_feature(self.handler)
     
-    def get_features(self, contents: np.array):
+    def get_features(self, contents: np.array, column_major: bool = False):
+        # column_major为True时返回形状为(feature_dims, num_contents)的数组，每一维特征连续存放
         assert (contents.dtype == np.int32)
         num_contents = contents.shape[0]
+        if column_major:
+            feature_struct = lib_cache_emu.get_features_columns(self.handler, contents.ctypes, num_contents)
+            features = ctypes_utils.buffer_to_numpy(feature_struct, np.float32)
+            return features.reshape((self.feature_dims(), num_contents))
+        
         feature_struct = lib_cache_emu.get_features(self.handler, contents.ctypes, num_contents)
         features = ctypes_utils.buffer_to_numpy(feature_struct, np.float32)
         features = features.reshape((num_contents, self.feature_dims()))
@@ -118,3 +388,85 @@ class CacheEmu:
     
     def on_episode_end(self):
         return lib_cache_emu.on_episode_end(self.handler)
+    
+    def set_profiling(self, enabled: bool = True):
+        # 开启或关闭各阶段的计时与Cache哈希表的探测统计，编译时未启用PROFILE时返回False
+        return bool(lib_cache_emu.set_profiling(self.handler, enabled))
+    
+    def get_profile_stats(self):
+        # 返回扁平的字典：各阶段的时钟周期数、调用次数与秒数，以及哈希表的探测统计
+        return lib_cache_emu.get_profile_stats(self.handler).to_dict()
+    
+    def clear_profile_stats(self):
+        lib_cache_emu.clear_profile_stats(self.handler)
+
+
+class PolicyCacheEmu(CacheEmu):
+    """
+    使用固定替换策略（lru, lfu, fifo, arc, 2q, lirs, s3fifo, belady）的模拟器，所有请求在C++中处理，用于计算基线
+    """
+    
+    def __init__(self, capacity, policy: str):
+        self.capacity = capacity
+        self.policy = policy
+        
+        self.handler = lib_cache_emu.init_policy_cache_emu(capacity, policy.encode())
+        assert self.handler >= 0, "unknown cache policy: {}".format(policy)
+        self.last_contents = None
+        self.observation = None
+        self.delta = None
+    
+    def run(self):
+        # 处理剩余的所有时间片，返回处理的请求数
+        return lib_cache_emu.run_policy(self.handler)
+    
+    def get_slice_hit_rates(self):
+        res = lib_cache_emu.get_slice_hit_rates(self.handler)
+        return ctypes_utils.buffer_to_numpy(res, np.float32)
+
+
+class CacheEmuBatch:
+    """
+    多个模拟器的批量接口，一次FFI调用推进所有模拟器，结果写入预先分配的numpy数组
+    """
+    
+    def __init__(self, emus: list, max_candidates: int):
+        self.emus = emus
+        self.max_candidates = max_candidates
+        
+        n = len(emus)
+        feature_dim = emus[0].feature_dims()
+        
+        self.handlers = np.array([emu.handler for emu in emus], dtype=np.int32)
+        self.candidates = np.full((n, max_candidates), -1, dtype=np.int32)
+        self.num_candidates = np.zeros(n, dtype=np.int32)
+        self.features = np.zeros((n, max_candidates, feature_dim), dtype=np.float32)
+        self.rewards = np.zeros((n, max_candidates), dtype=np.float32)
+        self.dones = np.zeros(n, dtype=np.int32)
+        self.num_steps = np.zeros(n, dtype=np.int32)
+    
+    def step(self, actions: np.array):
+        actions = np.ascontiguousarray(actions, dtype=np.uint8)
+        assert (actions.shape == self.candidates.shape)
+        
+        lib_cache_emu.step_batch(
+            self.handlers.ctypes, len(self.emus), actions.ctypes, self.max_candidates,
+            self.candidates.ctypes, self.num_candidates.ctypes, self.features.ctypes, self.rewards.ctypes,
+            self.dones.ctypes, self.num_steps.ctypes
+        )
+        
+        return self.features, self.rewards, self.dones.astype(bool), self.num_steps
+    
+    def observe(self, i: int):
+        # 将第i个模拟器当前的候选内容与特征写入批量数组，用于reset之后
+        emu = self.emus[i]
+        candidates = emu.get_candidates()[:self.max_candidates]
+        size = candidates.shape[0]
+        
+        self.candidates[i] = -1
+        self.candidates[i, :size] = candidates
+        self.num_candidates[i] = size
+        self.features[i] = 0
+        self.features[i, :size] = emu.get_features(candidates)
+        self.rewards[i] = 0
+        self.dones[i] = emu.finished()
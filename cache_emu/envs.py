@@ -2,7 +2,7 @@ import gym
 import numpy as np
 
 from .callback import CallbackManager
-from .emu import CacheEmu
+from .emu import CacheEmu, CacheEmuBatch, get_max_slice_size, set_num_threads
 
 
 class ActiveCacheEnv(gym.Env):
@@ -43,12 +43,8 @@ class ActiveCacheEnv(gym.Env):
         self.emu.update_cache(new_contents)
         
         while True:
-            n_requests_processed, n_contents_missed, n_requests_remained = self.emu.step().tuple()
-            
-            self.candidates = self.emu.get_candidates()
-            observation = self.emu.get_features(self.candidates)
-            reward = self.emu.get_candidate_frequencies()
-            done = self.emu.finished()
+            triple, self.candidates, reward, observation, done = self.emu.step_observe()
+            n_requests_processed, n_contents_missed, n_requests_remained = triple.tuple()
             
             step_end_info = self.callback_manger.on_step_end()
             info.update(step_end_info)
@@ -62,6 +58,74 @@ class ActiveCacheEnv(gym.Env):
         pass
 
 
+class VecActiveCacheEnv(gym.Env):
+    """
+    多个主动模式环境的向量化版本，每一步只需一次FFI调用。
+    观测、奖励与动作的第一维为环境，第二维为候选内容，候选内容不足时以0填充
+    """
+    
+    def __init__(self, capacity: int, num_envs: int, callback_managers: list = None, feature_config={},
+                 num_threads: int = 1, pin_cores: bool = False):
+        self.capacity = capacity
+        self.num_envs = num_envs
+        
+        set_num_threads(num_threads, pin_cores)
+        
+        self.emus = [CacheEmu(capacity, passive_mode=False) for _ in range(num_envs)]
+        self.callback_managers = callback_managers
+        
+        for emu in self.emus:
+            emu.setup_features(**feature_config)
+        
+        content_dim = capacity + get_max_slice_size()
+        feature_dim = self.emus[0].feature_dims()
+        
+        self.batch = CacheEmuBatch(self.emus, content_dim)
+        
+        self.action_space = gym.spaces.MultiBinary((num_envs, content_dim))
+        self.observation_space = gym.spaces.Box(
+            low=np.zeros((num_envs, content_dim, feature_dim), dtype=np.float32),
+            high=np.ones((num_envs, content_dim, feature_dim), dtype=np.float32)
+        )
+    
+    @property
+    def candidates(self):
+        return self.batch.candidates
+    
+    @property
+    def num_candidates(self):
+        return self.batch.num_candidates
+    
+    def reset(self):
+        for i, emu in enumerate(self.emus):
+            emu.reset()
+            if self.callback_managers is not None:
+                self.callback_managers[i].reset()
+                self.callback_managers[i].on_game_begin()
+            self.batch.observe(i)
+        
+        return self.batch.features.copy()
+    
+    def close(self):
+        if self.callback_managers is not None:
+            for cm in self.callback_managers:
+                cm.on_game_end()
+    
+    def step(self, action: np.array):
+        observation, reward, done, num_steps = self.batch.step(action)
+        
+        infos = [{} for _ in range(self.num_envs)]
+        if self.callback_managers is not None:
+            for i, cm in enumerate(self.callback_managers):
+                for _ in range(num_steps[i]):
+                    infos[i].update(cm.on_step_end())
+        
+        return observation.copy(), reward.copy(), done, infos
+    
+    def render(self, mode='human'):
+        pass
+
+
 class PassiveCacheEnv(gym.Env):
     def __init__(self, capacity: int, callback_manager: CallbackManager = None, feature_config={}):
         self.capacity = capacity
@@ -100,19 +164,12 @@ class PassiveCacheEnv(gym.Env):
         new_contents = self.candidates[action]
         self.emu.update_cache(new_contents)
         
-        reward = np.zeros(self.capacity + 1, dtype=np.float32)
+        n_requests_processed, n_contents_missed, n_slices_crossed = self.emu.step_until_miss().tuple()
+        reward = self.emu.get_candidate_frequencies()
         
-        while True:
-            n_requests_processed, n_contents_missed, n_requests_remained = self.emu.step().tuple()
-            
-            reward += self.emu.get_candidate_frequencies()
-            if n_requests_remained == 0:
-                step_end_info = self.callback_manger.on_step_end()
-                info.update(step_end_info)
-            
-            done = self.emu.finished()
-            if n_contents_missed > 0 or done:
-                break
+        for _ in range(n_slices_crossed):
+            step_end_info = self.callback_manger.on_step_end()
+            info.update(step_end_info)
         
         self.candidates = self.emu.get_candidates()
         observation = self.emu.get_features(self.candidates)
@@ -162,19 +219,12 @@ class PassiveCacheEnv2(gym.Env):
         new_contents = self.candidates[action]
         self.emu.update_cache(new_contents)
         
-        reward = np.zeros(self.capacity + 1, dtype=np.float32)
+        n_requests_processed, n_contents_missed, n_slices_crossed = self.emu.step_until_miss().tuple()
+        reward = self.emu.get_candidate_frequencies()
         
-        while True:
-            n_requests_processed, n_contents_missed, n_requests_remained = self.emu.step().tuple()
-            
-            reward += self.emu.get_candidate_frequencies()
-            if n_requests_remained == 0:
-                step_end_info = self.callback_manger.on_step_end()
-                info.update(step_end_info)
-            
-            done = self.emu.finished()
-            if n_contents_missed > 0 or done:
-                break
+        for _ in range(n_slices_crossed):
+            step_end_info = self.callback_manger.on_step_end()
+            info.update(step_end_info)
         
         self.candidates = self.emu.get_candidates()
         observation = self.emu.get_features(self.candidates)
@@ -46,6 +46,68 @@ class Triple(ctypes.Structure):
         return self.first, self.second, self.third
 
 
+# 用于step_observe，数组由调用者（numpy）分配
+class StepObservation(ctypes.Structure):
+    _fields_ = [
+        ('triple', Triple),
+        ('candidates', ctypes.POINTER(ctypes.c_int32)),
+        ('frequencies', ctypes.POINTER(ctypes.c_float)),
+        ('features', ctypes.POINTER(ctypes.c_float)),
+        ('max_candidates', ctypes.c_size_t),
+        ('num_candidates', ctypes.c_size_t),
+        ('done', ctypes.c_int32)
+    ]
+
+
+# 用于step_observe_delta，数组由调用者（numpy）分配，只包含变化的行
+class DeltaObservation(ctypes.Structure):
+    _fields_ = [
+        ('triple', Triple),
+        ('rows', ctypes.POINTER(ctypes.c_int32)),
+        ('candidates', ctypes.POINTER(ctypes.c_int32)),
+        ('frequencies', ctypes.POINTER(ctypes.c_float)),
+        ('raw_features', ctypes.POINTER(ctypes.c_double)),
+        ('offsets', ctypes.POINTER(ctypes.c_double)),
+        ('scales', ctypes.POINTER(ctypes.c_double)),
+        ('divisors', ctypes.POINTER(ctypes.c_double)),
+        ('max_candidates', ctypes.c_size_t),
+        ('num_candidates', ctypes.c_size_t),
+        ('num_rows', ctypes.c_size_t),
+        ('done', ctypes.c_int32)
+    ]
+
+
+# 计时的阶段，与profile.h中的ProfilePhase一致
+PROFILE_PHASES = ('slice_fetch', 'hit_test', 'feature_update', 'candidates', 'get_features', 'update_cache')
+
+
+# 模拟器的计时与计数结果，与profile.h中的ProfileStats一致
+class ProfileStats(ctypes.Structure):
+    _fields_ = [
+        ('cycles', ctypes.c_uint64 * len(PROFILE_PHASES)),
+        ('calls', ctypes.c_uint64 * len(PROFILE_PHASES)),
+        ('cycles_per_second', ctypes.c_double),
+        ('num_lookups', ctypes.c_uint64),
+        ('num_probes', ctypes.c_uint64),
+        ('num_collisions', ctypes.c_uint64),
+        ('max_probe_length', ctypes.c_uint64),
+        ('num_rehashes', ctypes.c_uint64)
+    ]
+    
+    def to_dict(self):
+        # 转成扁平的字典，便于记录到日志或画图
+        res = {}
+        for i, phase in enumerate(PROFILE_PHASES):
+            res[phase + '/cycles'] = self.cycles[i]
+            res[phase + '/calls'] = self.calls[i]
+            if self.cycles_per_second > 0:
+                res[phase + '/seconds'] = self.cycles[i] / self.cycles_per_second
+        for name in ('num_lookups', 'num_probes', 'num_collisions', 'max_probe_length', 'num_rehashes'):
+            res['cache/' + name] = getattr(self, name)
+        res['cache/mean_probe_length'] = self.num_probes / max(self.num_lookups, 1)
+        return res
+
+
 # 将返回的buffer转成对应的numpy数组
 def buffer_to_numpy(buf, dtype: np.dtype):
     # 获取对应的C类型
@@ -53,3 +115,10 @@ def buffer_to_numpy(buf, dtype: np.dtype):
     data_np = np.zeros(buf.size, dtype=dtype)
     ctypes.memmove(data_np.ctypes, buf.data, ctypes.sizeof(c_type) * buf.size)
     return data_np
+
+
+# 将返回的buffer直接包装成numpy数组，不拷贝数据，数组只在C++端的数据被修改前有效
+def buffer_as_numpy(buf, dtype: np.dtype):
+    if buf.size == 0:
+        return np.zeros(0, dtype=dtype)
+    return np.ctypeslib.as_array(buf.data, shape=(buf.size,)).view(dtype)